@@ -32,9 +32,11 @@ Control *control;
 Control::Control() {
   control = this;
   nalloc = 0;
-  next = 0;
   nsensors = 0;
   registering_from = 0;
+  blocks = 0;
+  nblocks = 0;
+  seq = 0;
 
   manual_stop = timed_stop = false;
   manual_start = timed_start = triggered_start = false;
@@ -49,6 +51,8 @@ Control::Control() {
       sensors[i].fieldtypes[j] = FT_NONE;
       sensors[i].fields[j] = 0;
     }
+    chains[i].head = chains[i].tail = -1;
+    chains[i].pending = false;
   }
   for (int i=0; i<MAX_TRIGGERS; i++) {
     triggers[i].trigger_min = false;
@@ -64,9 +68,9 @@ Control::Control() {
 
 Control::~Control() {
   control = 0;
-  if (data) {
-    free((void *)data);
-    data = 0;
+  if (blocks) {
+    free((void *)blocks);
+    blocks = 0;
   }
 }
 
@@ -96,46 +100,334 @@ int Control::RegisterSensor(const char *name) {
 }
 
 void Control::SensorRegisterField(int sensor, char *field, ft field_type) {
-  int fn = sensors[nsensors].fn++;
+  int fn = sensors[sensor].fn++;
 
   sensors[sensor].fields[fn] = field;
   sensors[sensor].fieldtypes[fn] = field_type;
 }
 
-// Return success indicator
+/*
+ * The allocation is expressed in samples as they used to be stored (timestamp and all fields, uncompressed).
+ * The same amount of memory is now used for compressed blocks, which hold several times more samples.
+ * Return success indicator
+ */
 bool Control::AllocateMemory() {
-  data = (sensordata *)malloc(nalloc * sizeof(sensordata));
-  if (! data)
+  if (blocks)
+    free((void *)blocks);
+
+  nblocks = nalloc * (sizeof(time_t) + MAX_FIELDS * sizeof(int32_t)) / sizeof(sampleblock);
+  if (nblocks < 1)
+    nblocks = 1;
+  blocks = (sampleblock *)malloc(nblocks * sizeof(sampleblock));
+  if (! blocks) {
+    nblocks = 0;
     return false;
-
-  for (int i=0; i<nalloc; i++) {
-    data[i].sensorid = -1;
-    data[i].ts = 0;
   }
+
+  for (int i=0; i<nblocks; i++)
+    blocks[i].sensorid = 0xFF;
+  for (int i=0; i<MAX_SENSORS; i++)
+    chains[i].head = chains[i].tail = -1;
   return true;
 }
 
+/*
+ * Get a block to append to this sensor's chain. If none are free, the oldest block
+ * (of any sensor) is recycled.
+ */
+int16_t Control::NewBlock(int sensor) {
+  int16_t b = -1;
+
+  for (int i=0; i<nblocks; i++)
+    if (blocks[i].sensorid == 0xFF) {
+      b = i;
+      break;
+    }
+
+  if (b < 0) {
+    int victim = -1;
+    for (int i=0; i<MAX_SENSORS; i++) {
+      int16_t h = chains[i].head;
+      if (h >= 0 && (victim < 0 || blocks[h].first < blocks[chains[victim].head].first))
+        victim = i;
+    }
+    b = chains[victim].head;
+    chains[victim].head = blocks[b].next;
+    if (chains[victim].tail == b)
+      chains[victim].tail = -1;
+  }
+
+  blocks[b].next = -1;
+  blocks[b].sensorid = sensor;
+  blocks[b].count = 0;
+  blocks[b].used = 0;
+  blocks[b].first = blocks[b].last = 0;
+  blocks[b].first_seq = blocks[b].last_seq = 0;
+
+  sensorchain *c = &chains[sensor];
+  if (c->tail >= 0)
+    blocks[c->tail].next = b;
+  else
+    c->head = b;
+  c->tail = b;
+
+  return b;
+}
+
+/*
+ * Encode the pending sample of a sensor, return its length.
+ *
+ * The sequence number is stored as a varint of the gap with the previous sample of this sensor.
+ * Timestamps are stored as a zigzag varint of the delta of the delta, so regular samples take one byte.
+ * Field values are XOR-ed with the previous value, much like Gorilla but byte aligned :
+ * a nibble per field holds the number of bytes stored (0 .. 4), and bit 3 says whether these are
+ * the high bytes (trailing zeroes dropped) rather than the low bytes (leading zeroes dropped).
+ */
+int Control::EncodeSample(int sensor, bool first, uint8_t *rec) {
+  sensorchain *c = &chains[sensor];
+  int len = 0;
+
+  uint32_t gap = first ? 0 : c->seq - c->prev_seq - 1;
+  while (gap >= 0x80) {
+    rec[len++] = (gap & 0x7F) | 0x80;
+    gap >>= 7;
+  }
+  rec[len++] = gap;
+
+  int32_t dod = first ? (int32_t)c->ts : (int32_t)(c->ts - c->prev_ts) - c->prev_delta;
+  uint32_t zz = ((uint32_t)dod << 1) ^ (uint32_t)(dod >> 31);
+  while (zz >= 0x80) {
+    rec[len++] = (zz & 0x7F) | 0x80;
+    zz >>= 7;
+  }
+  rec[len++] = zz;
+
+  int fn = sensors[sensor].fn;
+  int ctl = len;
+  len += (fn + 1) / 2;
+  for (int i=ctl; i<len; i++)
+    rec[i] = 0;
+
+  for (int f=0; f<fn; f++) {
+    uint32_t x = c->data[f] ^ (first ? 0 : c->prev[f]);
+    int nib = 0;
+
+    if (x != 0) {
+      int lz = 0, tz = 0;
+      while ((x >> (24 - 8 * lz)) == 0) lz++;
+      while (((x >> (8 * tz)) & 0xFF) == 0) tz++;
+
+      if (tz > lz) {
+        nib = (4 - tz) | 0x08;
+	x >>= 8 * tz;
+      } else
+        nib = 4 - lz;
+      for (int i=0; i<(nib & 0x07); i++, x >>= 8)
+        rec[len++] = x & 0xFF;
+    }
+    rec[ctl + f / 2] |= nib << (4 * (f % 2));
+  }
+  return len;
+}
+
+/*
+ * Compress the pending sample of this sensor into its chain
+ */
+void Control::StoreSample(int sensor) {
+  sensorchain *c = &chains[sensor];
+  uint8_t rec[5 + 5 + MAX_FIELDS / 2 + MAX_FIELDS * 4];
+
+  if (! c->pending || nblocks == 0)
+    return;
+  c->pending = false;
+
+  int16_t b = c->tail;
+  int len = 0;
+  if (b >= 0 && blocks[b].count < 255) {
+    len = EncodeSample(sensor, blocks[b].count == 0, rec);
+    if (blocks[b].used + len > SAMPLE_BLOCK_SIZE)
+      b = -1;
+  } else
+    b = -1;
+
+  if (b < 0) {
+    b = NewBlock(sensor);
+    len = EncodeSample(sensor, true, rec);
+  }
+
+  sampleblock *bp = &blocks[b];
+  memcpy(bp->buf + bp->used, rec, len);
+  bp->used += len;
+  if (bp->count++ == 0) {
+    bp->first = c->ts;
+    bp->first_seq = c->seq;
+    c->prev_delta = 0;
+  } else
+    c->prev_delta = (int32_t)(c->ts - c->prev_ts);
+  bp->last = c->ts;
+  bp->last_seq = c->seq;
+
+  c->prev_ts = c->ts;
+  c->prev_seq = c->seq;
+  for (int f=0; f<MAX_FIELDS; f++)
+    c->prev[f] = c->data[f];
+}
+
 void Control::RegisterData(int sensor, time_t ts) {
+  if (sensor < 0 || sensor >= nsensors)
+    return;
+
   amount++;
-  next = (next + 1) % nalloc;
-  data[next].ts = ts;
-  data[next].sensorid = sensor;
+  StoreSample(sensor);
+
+  sensorchain *c = &chains[sensor];
+  c->pending = true;
+  c->ts = ts;
+  c->seq = ++seq;
   for (int i=0; i<MAX_FIELDS; i++)
-    data[next].data[i].i = 0;
+    c->data[i] = 0;
 }
 
 void Control::RegisterData(int sensor, int field, float value) {
-  data[next].data[field].f = value;
+  if (sensor < 0 || sensor >= nsensors || field < 0 || field >= MAX_FIELDS)
+    return;
+  memcpy(&chains[sensor].data[field], &value, sizeof(value));
 }
 
 void Control::RegisterData(int sensor, int field, int value) {
-  data[next].data[field].i = value;
+  if (sensor < 0 || sensor >= nsensors || field < 0 || field >= MAX_FIELDS)
+    return;
+  chains[sensor].data[field] = value;
 }
 
-time_t Control::getTimestamp(int ix) {
-  if (ix < 0 || ix >= nalloc || data == 0)
-    return 0;
-  return data[ix].ts;
+/*
+ * Prepare to walk the samples of a sensor. Samples older than "since" or newer than "until" are skipped,
+ * as are those with sequence number up to "after", and no more than "limit" are returned.
+ * Blocks entirely before "since" or "after" are skipped without decoding.
+ */
+void Control::startSamples(int sensor, sampleiter *it, time_t since, time_t until, int limit, uint32_t after) {
+  memset(it, 0, sizeof(sampleiter));
+  it->sensor = sensor;
+  it->since = since;
+  it->until = until;
+  it->after = after;
+  it->limit = (limit > 0) ? limit : -1;
+  it->block = (sensor < 0 || sensor >= nsensors) ? -1 : chains[sensor].head;
+  it->pending = (sensor < 0 || sensor >= nsensors);
+
+  while (it->block >= 0 && ((since && blocks[it->block].last < since) || blocks[it->block].last_seq <= after))
+    it->block = blocks[it->block].next;
+}
+
+/*
+ * Sequence number of the newest sample of a sensor, or of all sensors.
+ * Sequence numbers increase over all sensors, so they can be used as a cursor in queries.
+ */
+uint32_t Control::getSequence(int sensor) {
+  if (sensor < 0 || sensor >= nsensors)
+    return seq;
+
+  sensorchain *c = &chains[sensor];
+  if (c->pending)
+    return c->seq;
+  if (c->tail >= 0)
+    return blocks[c->tail].last_seq;
+  return 0;
+}
+
+/*
+ * Decode the next sample in range into the iterator, return false at the end
+ */
+bool Control::nextSample(sampleiter *it) {
+  if (it->limit == 0)
+    return false;
+
+  while (NextSample(it)) {
+    if ((it->since && it->ts < it->since) || it->seq <= it->after)
+      continue;
+    if (it->until && it->ts > it->until) {
+      it->limit = 0;
+      return false;
+    }
+    if (it->limit > 0)
+      it->limit--;
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Decode the next sample into the iterator, return false at the end
+ */
+bool Control::NextSample(sampleiter *it) {
+  while (it->block >= 0) {
+    sampleblock *bp = &blocks[it->block];
+
+    if (it->n < bp->count) {
+      const uint8_t *p = bp->buf + it->off;
+      uint32_t gap = 0, zz = 0;
+      int shift = 0;
+      do {
+        gap |= (uint32_t)(*p & 0x7F) << shift;
+	shift += 7;
+      } while (*p++ & 0x80);
+      it->seq = (it->n == 0) ? bp->first_seq : it->seq + 1 + gap;
+
+      shift = 0;
+      do {
+        zz |= (uint32_t)(*p & 0x7F) << shift;
+	shift += 7;
+      } while (*p++ & 0x80);
+      int32_t dod = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+
+      if (it->n == 0) {
+        it->ts = dod;
+	it->delta = 0;
+      } else {
+        it->delta += dod;
+	it->ts += it->delta;
+      }
+
+      int fn = sensors[it->sensor].fn;
+      const uint8_t *ctl = p;
+      p += (fn + 1) / 2;
+      for (int f=0; f<fn; f++) {
+        int nib = (ctl[f / 2] >> (4 * (f % 2))) & 0x0F;
+	int nb = nib & 0x07;
+	uint32_t x = 0;
+	for (int i=0; i<nb; i++)
+	  x |= (uint32_t)*p++ << (8 * i);
+	if ((nib & 0x08) && nb > 0)
+	  x <<= 8 * (4 - nb);
+	if (it->n == 0)
+	  it->data[f].i = x;
+	else
+	  it->data[f].i ^= x;
+      }
+
+      it->off = p - bp->buf;
+      it->n++;
+      return true;
+    }
+
+    it->block = bp->next;
+    it->off = 0;
+    it->n = 0;
+  }
+
+  // The newest sample, not compressed yet
+  if (! it->pending) {
+    it->pending = true;
+    sensorchain *c = &chains[it->sensor];
+    if (c->pending) {
+      it->ts = c->ts;
+      it->seq = c->seq;
+      for (int f=0; f<MAX_FIELDS; f++)
+        it->data[f].i = c->data[f];
+      return true;
+    }
+  }
+  return false;
 }
 
 ft Control::getFieldType(int sensor, int field) {
@@ -157,20 +449,6 @@ const char *Control::getSensorName(int sensor) {
   return sensors[sensor].name;
 }
 
-int Control::getDataSensor(int ix) {
-  if (ix < 0 || ix >= nalloc)
-    return -1;
-  return data[ix].sensorid;
-}
-
-float Control::getDataFloat(int ix, int field) {
-  return data[ix].data[field].f;
-}
-
-int Control::getDataInt(int ix, int field) {
-  return data[ix].data[field].i;
-}
-
 void Control::sensorData(uint8 sid, time_t ts, float a, float b, float c, float d) {
   sensors[sid].ts = ts;
   sensors[sid].data[0].f = a;
@@ -65,9 +65,51 @@ struct sensorid {
   int		mdelay;
 };
 
-struct sensordata {
-  uint8		sensorid;
+/*
+ * Samples are stored per sensor, compressed, in a chain of fixed size blocks.
+ * Each block can be decoded on its own : the first sample in a block is encoded against zero.
+ */
+#define	SAMPLE_BLOCK_SIZE	112
+
+struct sampleblock {
+  int16_t	next;			// Next (newer) block of the same sensor, -1 at the end
+  uint8_t	sensorid;		// 0xFF if free
+  uint8_t	count;			// Number of samples in this block
+  uint16_t	used;			// Bytes used in buf
+  time_t	first, last;		// Timestamps of the first and last sample
+  uint32_t	first_seq, last_seq;	// Sequence numbers of the first and last sample
+  uint8_t	buf[SAMPLE_BLOCK_SIZE];
+};
+
+struct sensorchain {
+  int16_t	head, tail;		// Oldest and newest block, -1 if none
+
+  // Encoder state, reset at the start of each block
+  time_t	prev_ts;
+  uint32_t	prev_seq;
+  int32_t	prev_delta;
+  uint32_t	prev[MAX_FIELDS];
+
+  // The newest sample stays here until the next one is registered
+  bool		pending;
+  time_t	ts;
+  uint32_t	seq;
+  uint32_t	data[MAX_FIELDS];
+};
+
+// Walk the samples of one sensor, oldest first, optionally limited to a time range and count
+struct sampleiter {
+  int		sensor;
+  time_t	since, until;		// 0 means no limit
+  uint32_t	after;			// Only samples with a higher sequence number
+  int		limit;			// Samples left to return, -1 means no limit
+  int16_t	block;
+  uint16_t	off;
+  uint8_t	n;			// Sample index in the current block
+  bool		pending;		// Blocks done, the pending sample was returned
   time_t	ts;
+  uint32_t	seq;
+  int32_t	delta;
   union {
     float	f;
     int32_t	i;
@@ -120,13 +162,12 @@ public:
   bool setAllocation(int num);
   int getAllocation();
 
-  time_t getTimestamp(int ix);
-  int getDataSensor(int ix);
+  void startSamples(int sensor, sampleiter *it, time_t since = 0, time_t until = 0, int limit = 0, uint32_t after = 0);
+  uint32_t getSequence(int sensor = -1);
+  bool nextSample(sampleiter *it);
   ft getFieldType(int sensor, int field);
   const char *getSensorName(int sensor);
   const char *getFieldName(int sensor, int field);
-  float getDataFloat(int ix, int field);
-  int getDataInt(int ix, int field);
 
   bool isRegistering(uint8 sid, time_t ts, float a, float b = 0.0, float c = 0.0, float d = 0.0);
   bool isRegistering(uint8 sid, time_t ts, uint32 a, uint32 b = 0, uint32 c = 0, uint32 d = 0);
@@ -141,18 +182,25 @@ public:
 
 private:
   int		nalloc;
-  int		next;
   int		nsensors;
   bool		manual_start, manual_stop;
   bool		timed_start, timed_stop;
   bool		triggered_start;
   time_t	registering_from;
   int		amount;
+  uint32_t	seq;			// Sequence number of the last registered sample, over all sensors
 
   bool AllocateMemory();
   
   struct sensorid sensors[MAX_SENSORS];
-  struct sensordata *data;
+  struct sensorchain chains[MAX_SENSORS];
+  struct sampleblock *blocks;
+  int		nblocks;
+
+  void StoreSample(int sensor);
+  int EncodeSample(int sensor, bool first, uint8_t *rec);
+  int16_t NewBlock(int sensor);
+  bool NextSample(sampleiter *it);
 
   // Start conditions
   struct trigger triggers[MAX_TRIGGERS];
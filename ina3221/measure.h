@@ -32,6 +32,7 @@
 #define OTA_ID		"measure"
 
 extern char		*timestamp(time_t);
+extern void		sensors_loop(time_t);
 extern WiFiClient	espClient;
 extern String		ips, gws;
 extern time_t		boot_time;
@@ -179,16 +179,23 @@ void loop() {
 
   delay(1);
 
-#ifdef DO_AHT
-  aht10_loop(the_time);
-#endif
-  ina3221_loop(the_time);
-  d1mini_loop(the_time);
-  ads1115_loop(the_time);
+  sensors_loop(the_time);
 
   ws_loop();
 }
 
+/*
+ * Measure, separate from loop() so the web server can keep measuring while a query waits for data.
+ */
+void sensors_loop(time_t now) {
+#ifdef DO_AHT
+  aht10_loop(now);
+#endif
+  ina3221_loop(now);
+  d1mini_loop(now);
+  ads1115_loop(now);
+}
+
 void time_is_set(bool from_sntp) {
   time_t now = time(0);
   struct tm *tmp = localtime(&now);
@@ -25,6 +25,7 @@
 
 #include <ESP8266WiFi.h>
 #include <ESP8266WebServer.h>
+#include <ArduinoOTA.h>
 
 #include <coredecls.h>
 #include <TZ.h>
@@ -42,6 +43,45 @@ ESP8266WebServer	*ws = 0;
 #define	SEND(x)	ws->sendContent(x)
 // #define	SEND(x)	{ Serial.printf("%s", x); ws->sendContent(x); }
 
+// Maximum time (seconds) a long poll query waits for new data : no other client is served meanwhile
+#define	MAX_WAIT	5
+
+/*
+ * Pick up the optional range arguments of a query, e.g.
+ *   http://measure.local/json/INA3221?since=1630000000&until=1630003600&limit=100
+ *   http://measure.local/json/INA3221?after=1234
+ * Times are in seconds since the epoch, missing arguments mean no limit.
+ * The "after" cursor is the "next" value of a previous JSON reply.
+ */
+static void QueryRange(time_t *since, time_t *until, int *limit, uint32_t *after) {
+  *since = ws->hasArg("since") ? atol(ws->arg("since").c_str()) : 0;
+  *until = ws->hasArg("until") ? atol(ws->arg("until").c_str()) : 0;
+  *limit = ws->hasArg("limit") ? atoi(ws->arg("limit").c_str()) : 0;
+  *after = ws->hasArg("after") ? strtoul(ws->arg("after").c_str(), 0, 10) : 0;
+}
+
+/*
+ * Long poll : with ?after=<seq>&wait=<seconds>, hold the reply until there is a sample newer than
+ * the cursor (of this sensor, or any if sid is -1), or until the wait time is over.
+ * Keep measuring and accepting OTA meanwhile, we're called from loop() so nobody else will.
+ */
+static void WaitForData(int sid) {
+  if (! ws->hasArg("after") || ! ws->hasArg("wait"))
+    return;
+
+  uint32_t after = strtoul(ws->arg("after").c_str(), 0, 10);
+  int wait = atoi(ws->arg("wait").c_str());
+  if (wait > MAX_WAIT)
+    wait = MAX_WAIT;
+
+  unsigned long start = millis();
+  while (control->getSequence(sid) <= after && millis() - start < wait * 1000UL) {
+    ArduinoOTA.handle();
+    sensors_loop(time(0));
+    delay(10);
+  }
+}
+
 static void QuerySensor(int sid, bool html) {
     // Serial.printf("QuerySensor(%d,%s)\n", sid, html ? "html" : "json");
     const char *sn = control->getSensorName(sid);
@@ -73,42 +113,47 @@ static void QuerySensor(int sid, bool html) {
     } else
       SEND("\"values\": [\n");
 
-    for (int i=0; i<control->getAllocation(); i++) {
-      time_t ts = control->getTimestamp(i);
-      if (ts == 0)
-        continue;
-
+    // Only this sensor's samples in the requested range, oldest first
+    time_t since, until;
+    int limit;
+    uint32_t after, next;
+    QueryRange(&since, &until, &limit, &after);
+    next = after;
+
+    sampleiter it;
+    control->startSamples(sid, &it, since, until, limit, after);
+    while (control->nextSample(&it)) {
+      time_t ts = it.ts;
       tm *tmp = localtime(&ts);
 
-      // Is this data chunk about the sensor under investigation ?
-      int sn = control->getDataSensor(i);
-      if (sid != sn)
-        continue;
-
       float t, h;
-      t = control->getDataFloat(i, 0);
+      t = it.data[0].f;
       const char *fn[4];
         fn[0] = "timestamp";
       	fn[1] = control->getFieldName(sid, 0);
 	fn[2] = control->getFieldName(sid, 1);
-      h = control->getDataFloat(i, 1);
+      h = it.data[1].f;
 
-      char line[80];
+      char line[120];
       if (html)
         sprintf(line, "<tr><td>%04d.%02d.%02d %02d:%02d:%02d</td><td>%3.1f</td><td>%2.0f</td></tr>\n",
           tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday, tmp->tm_hour, tmp->tm_min, tmp->tm_sec,
           t, h);
       else
-        sprintf(line, "{\"%s\": \"%04d.%02d.%02d %02d:%02d:%02d\", \"%s\": \"%3.1f\", \"%s\": \"%2.0f\"},\n",
+        sprintf(line, "%s{\"%s\": \"%04d.%02d.%02d %02d:%02d:%02d\", \"%s\": \"%3.1f\", \"%s\": \"%2.0f\"}",
+	  (next == after) ? "" : ",\n",
 	  fn[0], tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday, tmp->tm_hour, tmp->tm_min, tmp->tm_sec,
           fn[1], t,
 	  fn[2], h);
       SEND(line);
+      next = it.seq;
     }
     if (html) {
       SEND("</table>\n");
-    } else
-      SEND("]}\n");
+    } else {
+      sprintf(line, "\n], \"next\": %u}\n", next);
+      SEND(line);
+    }
 }
 
 static void QuerySensors(bool html) {
@@ -344,35 +389,184 @@ static void handleJsonQuery() {
   const char *uri = ws->uri().c_str();
   // Serial.printf("%s(%s)\n", __FUNCTION__, uri);
 
+  // Query everything, or an individual sensor
+  int sid = -1;
+  if (uri != 0 && strncmp(uri, "/json/", 6) == 0) {
+    for (int i=0; i<MAX_SENSORS; i++) {
+      const char *sn = control->getSensorName(i);
+      if (sn != 0 && strcmp(sn, uri+6) == 0)	// Prefixed by "/json/"
+        sid = i;
+    }
+  }
+
+  WaitForData(sid);
+
   if (! ws->chunkedResponseModeStart(200, "text/json")) {
     ws->send(500, "Want HTTP/1.1 for chunked responses");
     // Serial.printf("%s: want HTTP/1.1", __FUNCTION__);
     return;
   }
-  ws->sendContent("{");
 
-  // Query everything
-  if (uri == 0 || uri[1] == 0) {
+  if (sid < 0) {
+    ws->sendContent("{");
     QuerySensors(false);
     return;
   }
 
-  // Query for an individual sensor
-  for (int sid=0; sid<MAX_SENSORS; sid++) {
-    const char *sn = control->getSensorName(sid);
-    if (sn == 0) {
-      // Serial.printf("%s: checking sensor %d {null}\n", __FUNCTION__, sid);
+  QuerySensor(sid, false);
+  ws->chunkedResponseFinalize();
+}
+
+/*
+ * Binary export of one sensor's samples, e.g. http://measure.local/export/INA3221?since=1630000000
+ * Takes the same range arguments as the JSON query, and HTTP Range requests to resume a download.
+ *
+ * Format, all little endian :
+ *   header	"MSR1", uint8 version, uint8 nfields, uint16 record length, uint32 record count
+ *   sensor	name, 16 bytes
+ *   fields	nfields times : uint8 type (enum ft), name in 15 bytes
+ *   records	uint32 sequence number, uint32 timestamp, nfields times uint32 (float or int as registered)
+ */
+#define	EXPORT_VERSION		1
+#define	EXPORT_NAME_LENGTH	16
+
+static void handleNotFound();
+
+struct exportstate {
+  uint8_t	buf[512];
+  size_t	used;
+  uint32_t	pos, start, end;	// Current position, and range to send
+};
+
+// Add to the output, only the bytes within the requested range are sent
+static void ExportPut(exportstate *x, const uint8_t *p, size_t len) {
+  for (size_t i=0; i<len; i++, x->pos++) {
+    if (x->pos < x->start || x->pos > x->end)
       continue;
+    x->buf[x->used++] = p[i];
+    if (x->used == sizeof(x->buf)) {
+      ws->sendContent((const char *)x->buf, x->used);
+      x->used = 0;
+      yield();
     }
-    // Serial.printf("%s: checking sensor %d {%s}\n", __FUNCTION__, sid, sn);
-    if (strcmp(sn, uri+6) == 0) {	// Prefixed by "/json/"
-      QuerySensor(sid, false);
-      return;
+  }
+}
+
+static void ExportPutU32(exportstate *x, uint32_t v) {
+  uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+  ExportPut(x, b, 4);
+}
+
+static void ExportPutName(exportstate *x, const char *name, size_t len) {
+  uint8_t b[EXPORT_NAME_LENGTH];
+  memset(b, 0, sizeof(b));
+  if (name)
+    strncpy((char *)b, name, len - 1);
+  ExportPut(x, b, len);
+}
+
+static void handleExport() {
+  const char *uri = ws->uri().c_str();
+
+  int sid = -1;
+  for (int i=0; i<MAX_SENSORS; i++) {
+    const char *sn = control->getSensorName(i);
+    if (sn != 0 && strcmp(sn, uri+8) == 0)	// Prefixed by "/export/"
+      sid = i;
+  }
+  if (sid < 0) {
+    handleNotFound();
+    return;
+  }
+
+  int nfields = 0;
+  while (nfields < MAX_FIELDS && control->getFieldName(sid, nfields))
+    nfields++;
+
+  time_t since, until;
+  int limit;
+  uint32_t after;
+  QueryRange(&since, &until, &limit, &after);
+
+  // Count first, so we can announce the length and honour a byte range
+  sampleiter it;
+  uint32_t count = 0;
+  control->startSamples(sid, &it, since, until, limit, after);
+  while (control->nextSample(&it))
+    count++;
+
+  uint16_t reclen = 8 + 4 * nfields;
+  uint32_t total = 12 + EXPORT_NAME_LENGTH + EXPORT_NAME_LENGTH * nfields + count * reclen;
+
+  exportstate x;
+  x.used = x.pos = 0;
+  x.start = 0;
+  x.end = total - 1;
+
+  bool partial = false;
+  String range = ws->header("Range");
+  if (strncmp(range.c_str(), "bytes=", 6) == 0) {
+    const char *spec = range.c_str() + 6;
+    unsigned int s = 0, e = total - 1, n;
+    int found = 0;
+    if (spec[0] == '-') {
+      // Suffix range : the last n bytes
+      if (sscanf(spec + 1, "%u", &n) == 1 && n > 0) {
+        s = (n < total) ? total - n : 0;
+        found = 1;
+      } else {
+        ws->send(416, "text/plain", "Range not satisfiable");
+        return;
+      }
+    } else
+      found = sscanf(spec, "%u-%u", &s, &e);
+    if (found >= 1) {
+      if (s >= total || e < s) {
+        ws->send(416, "text/plain", "Range not satisfiable");
+        return;
+      }
+      if (e >= total)
+        e = total - 1;
+      x.start = s;
+      x.end = e;
+      partial = true;
     }
   }
 
-  ws->sendContent("}\n");
-  ws->chunkedResponseFinalize();
+  char line[64];
+  ws->sendHeader("Accept-Ranges", "bytes");
+  if (partial) {
+    snprintf(line, sizeof(line), "bytes %u-%u/%u", x.start, x.end, total);
+    ws->sendHeader("Content-Range", line);
+  }
+  ws->setContentLength(x.end - x.start + 1);
+  ws->send(partial ? 206 : 200, "application/octet-stream", "");
+
+  uint8_t hdr[8] = { 'M', 'S', 'R', '1', EXPORT_VERSION, (uint8_t)nfields, (uint8_t)reclen, (uint8_t)(reclen >> 8) };
+  ExportPut(&x, hdr, sizeof(hdr));
+  ExportPutU32(&x, count);
+  ExportPutName(&x, control->getSensorName(sid), EXPORT_NAME_LENGTH);
+  for (int f=0; f<nfields; f++) {
+    uint8_t tp = control->getFieldType(sid, f);
+    ExportPut(&x, &tp, 1);
+    ExportPutName(&x, control->getFieldName(sid, f), EXPORT_NAME_LENGTH - 1);
+  }
+
+  control->startSamples(sid, &it, since, until, limit, after);
+  while (x.pos <= x.end && control->nextSample(&it)) {
+    // Skip records entirely before the range without formatting them
+    if (x.pos + reclen <= x.start) {
+      x.pos += reclen;
+      continue;
+    }
+    ExportPutU32(&x, it.seq);
+    ExportPutU32(&x, (uint32_t)it.ts);
+    for (int f=0; f<nfields; f++)
+      ExportPutU32(&x, it.data[f].i);
+  }
+
+  if (x.used)
+    ws->sendContent((const char *)x.buf, x.used);
 }
 
 static void handleWildcard() {
@@ -467,6 +661,10 @@ void ws_begin() {
   ws = new ESP8266WebServer(80);
   
   ws->onNotFound(handleNotFound);
+
+  // We need this header for resuming binary exports
+  static const char *headers[] = { "Range" };
+  ws->collectHeaders(headers, 1);
   ws->on("/config", handleConfig);
   ws->on("/sensors", listSensors);
   ws->on("/status", handleStatus);
@@ -489,6 +687,9 @@ void ws_begin() {
     sprintf(s, "/json/%s", sn);
     ws->on(s, handleJsonQuery);
 
+    sprintf(s, "/export/%s", sn);
+    ws->on(s, handleExport);
+
     sprintf(s, "/%s", sn);
     ws->on(s, handleHtmlQuery);
   }
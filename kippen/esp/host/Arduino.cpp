@@ -0,0 +1,104 @@
+/*
+ * Linux host build : the Arduino calls, on top of the fake GPIO/ADC and the fake clock.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "Host.h"
+
+HardwareSerial	Serial;
+EspClass	ESP;
+TwoWire		Wire;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+int digitalRead(uint8_t pin) {
+  return HostGpioRead(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  HostGpioSet(pin, val);
+}
+
+uint16_t analogRead(uint8_t pin) {
+  return HostAdcRead(pin);
+}
+
+void delay(uint32_t ms) {
+  vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+unsigned long millis() {
+  return HostNow() / 1000;
+}
+
+void initArduino() {
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return esp_get_free_heap_size();
+}
+
+/*
+ * Serial output goes through the log, with its own tag
+ */
+static const char *serial_tag = "Serial";
+
+size_t HardwareSerial::print(const char *s) {
+  esp_log_write(ESP_LOG_INFO, serial_tag, "%s", s);
+  return strlen(s);
+}
+
+size_t HardwareSerial::print(char c) {
+  esp_log_write(ESP_LOG_INFO, serial_tag, "%c", c);
+  return 1;
+}
+
+size_t HardwareSerial::print(int n) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d", n);
+  return print(buf);
+}
+
+size_t HardwareSerial::print(double d) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.2f", d);
+  return print(buf);
+}
+
+size_t HardwareSerial::println(const char *s) {
+  return print(s) + print('\n');
+}
+
+size_t HardwareSerial::println(int n) {
+  return print(n) + print('\n');
+}
+
+size_t HardwareSerial::printf(const char *format, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  return print(buf);
+}
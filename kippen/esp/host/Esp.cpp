@@ -0,0 +1,369 @@
+/*
+ * Linux host build : stand-ins for the ESP-IDF calls the kippen code makes.
+ *
+ * The wall clock (gettimeofday, time) is the fake clock plus what SNTP set it to, so
+ * localtime() and mktime() work on simulated dates, with the TZ rules of the C library.
+ * GPIO, ADC and PWM go to hooks that the simulator installs.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Host.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_clk.h"
+#include "esp_sleep.h"
+#include "esp_wifi.h"
+#include "esp_littlefs.h"
+#include "xtensa/hal.h"
+#include "driver/gpio.h"
+#include "driver/mcpwm.h"
+#include "apps/sntp/sntp.h"
+#include "mdns.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <mutex>
+
+static const char *host_tag = "Host";
+
+/*
+ * Wall clock
+ */
+static time_t		wall_start = 1609459200;	// 2021-01-01 00:00:00 UTC, unless the simulator says otherwise
+static int64_t		wall_offset = 0;		// us, 0 until SNTP ran
+
+void HostSetWallClock(time_t t) {
+  wall_start = t;
+}
+
+extern "C" int gettimeofday(struct timeval *tv, void *tz) noexcept {
+  int64_t us = HostNow() + wall_offset;
+  tv->tv_sec = us / 1000000;
+  tv->tv_usec = us % 1000000;
+  return 0;
+}
+
+extern "C" time_t time(time_t *t) noexcept {
+  time_t now = (HostNow() + wall_offset) / 1000000;
+  if (t)
+    *t = now;
+  return now;
+}
+
+void sntp_setoperatingmode(uint8_t mode) {
+}
+
+void sntp_setservername(uint8_t idx, char *server) {
+}
+
+// The first sync sets the simulated date, a reconnect keeps the clock running
+void sntp_init() {
+  if (wall_offset == 0) {
+    wall_offset = (int64_t)wall_start * 1000000 - HostNow();
+    ESP_LOGI(host_tag, "SNTP : clock set");
+  }
+}
+
+void sntp_stop() {
+}
+
+int64_t esp_timer_get_time() {
+  return HostNow();
+}
+
+/*
+ * "Cycles" are host nanoseconds, so the profiler measures host loop cost
+ */
+int esp_clk_cpu_freq() {
+  return 1000000000;
+}
+
+uint32_t xthal_get_ccount() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Logging
+ */
+static std::mutex	log_m;
+static esp_log_level_t	log_default = ESP_LOG_INFO;
+static const int	max_tags = 32;
+static struct {
+  const char		*tag;
+  esp_log_level_t	level;
+}			log_tags[max_tags];
+static int		nlog_tags = 0;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+  std::lock_guard<std::mutex> lk(log_m);
+
+  if (strcmp(tag, "*") == 0) {
+    log_default = level;
+    return;
+  }
+  for (int i=0; i<nlog_tags; i++)
+    if (strcmp(log_tags[i].tag, tag) == 0) {
+      log_tags[i].level = level;
+      return;
+    }
+  if (nlog_tags < max_tags) {
+    log_tags[nlog_tags].tag = strdup(tag);
+    log_tags[nlog_tags++].level = level;
+  }
+}
+
+static esp_log_level_t LogLevel(const char *tag) {
+  for (int i=0; i<nlog_tags; i++)
+    if (strcmp(log_tags[i].tag, tag) == 0)
+      return log_tags[i].level;
+  return log_default;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+  std::lock_guard<std::mutex> lk(log_m);
+  if (level > LogLevel(tag))
+    return;
+
+  va_list ap;
+  va_start(ap, format);
+  vprintf(format, ap);
+  va_end(ap);
+}
+
+uint32_t esp_log_timestamp() {
+  return HostNow() / 1000;
+}
+
+/*
+ * System
+ */
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:			return "ESP_OK";
+  case ESP_FAIL:		return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:		return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:	return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:	return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_NOT_FOUND:	return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_TIMEOUT:		return "ESP_ERR_TIMEOUT";
+  default:			return "UNKNOWN ERROR";
+  }
+}
+
+void esp_chip_info(esp_chip_info_t *info) {
+  info->model = 0;
+  info->features = CHIP_FEATURE_WIFI_BGN;
+  info->cores = 1;
+  info->revision = 0;
+}
+
+const char *esp_get_idf_version() {
+  return "host";
+}
+
+// Reproducible runs : the same jitter every time
+uint32_t esp_random() {
+  static uint32_t x = 2463534242u;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+void esp_restart() {
+  ESP_LOGE(host_tag, "esp_restart() : the simulation ends here");
+  fflush(stdout);
+  exit(3);
+}
+
+/*
+ * Heap : what the process allocated, and a nominal ESP32 heap for getFreeHeap()
+ */
+size_t HostHeapUsed() {
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+static const size_t	heap_size = 300 * 1024;
+static const size_t	heap_boot = HostHeapUsed();
+
+uint32_t esp_get_free_heap_size() {
+  size_t used = HostHeapUsed() - heap_boot;
+  return (used < heap_size) ? heap_size - used : 0;
+}
+
+/*
+ * GPIO and ADC
+ */
+static const int	npins = 40;
+static int		gpio_level[npins];
+static HostInputHook	gpio_hook = 0;
+
+static const int	nchannels = 128;
+static int		adc_value[nchannels];
+static HostInputHook	adc_hook = 0;
+
+void HostGpioSetHook(HostInputHook hook) {
+  gpio_hook = hook;
+}
+
+void HostGpioSet(int pin, int level) {
+  if (pin >= 0 && pin < npins)
+    gpio_level[pin] = level;
+}
+
+int HostGpioRead(int pin) {
+  int v;
+  if (gpio_hook && gpio_hook(pin, &v))
+    return v;
+  return (pin >= 0 && pin < npins) ? gpio_level[pin] : 0;
+}
+
+void HostAdcSetHook(HostInputHook hook) {
+  adc_hook = hook;
+}
+
+void HostAdcSet(int channel, int value) {
+  if (channel >= 0 && channel < nchannels)
+    adc_value[channel] = value;
+}
+
+int HostAdcRead(int channel) {
+  int v;
+  if (adc_hook && adc_hook(channel, &v))
+    return v;
+  return (channel >= 0 && channel < nchannels) ? adc_value[channel] : 0;
+}
+
+int gpio_get_level(gpio_num_t pin) {
+  return HostGpioRead(pin);
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level) {
+  HostGpioSet(pin, level);
+  return ESP_OK;
+}
+
+// Wakeups are the loop task's business, it sleeps by moving the clock
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t pin) {
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup() {
+  return ESP_OK;
+}
+
+/*
+ * Motor PWM : only the duty cycle of each operator matters
+ */
+static HostPwmHook	pwm_hook = 0;
+static float		pwm_duty[2];
+
+void HostPwmSetHook(HostPwmHook hook) {
+  pwm_hook = hook;
+}
+
+static void PwmChange(mcpwm_operator_t op, float duty) {
+  if (pwm_duty[op] == duty)
+    return;
+  pwm_duty[op] = duty;
+  if (pwm_hook)
+    pwm_hook(op, duty);
+}
+
+esp_err_t mcpwm_gpio_init(mcpwm_unit_t unit, mcpwm_io_signals_t signal, int pin) {
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_init(mcpwm_unit_t unit, mcpwm_timer_t timer, const mcpwm_config_t *config) {
+  PwmChange(MCPWM_OPR_A, config->cmpr_a);
+  PwmChange(MCPWM_OPR_B, config->cmpr_b);
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_set_duty(mcpwm_unit_t unit, mcpwm_timer_t timer, mcpwm_operator_t op, float duty) {
+  PwmChange(op, duty);
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_set_duty_type(mcpwm_unit_t unit, mcpwm_timer_t timer, mcpwm_operator_t op,
+  mcpwm_duty_type_t type) {
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_set_signal_low(mcpwm_unit_t unit, mcpwm_timer_t timer, mcpwm_operator_t op) {
+  PwmChange(op, 0);
+  return ESP_OK;
+}
+
+esp_err_t mcpwm_set_signal_high(mcpwm_unit_t unit, mcpwm_timer_t timer, mcpwm_operator_t op) {
+  PwmChange(op, 100);
+  return ESP_OK;
+}
+
+/*
+ * Network odds and ends
+ */
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type) {
+  return ESP_OK;
+}
+
+char *ip4addr_ntoa(const ip4_addr_t *addr) {
+  static char buf[16];
+  snprintf(buf, sizeof(buf), IPSTR, IP2STR(addr));
+  return buf;
+}
+
+esp_err_t mdns_query_ptr(const char *service, const char *proto, uint32_t timeout, size_t max,
+  mdns_result_t **results) {
+  *results = 0;
+  return ESP_OK;
+}
+
+esp_err_t mdns_query_a(const char *host, uint32_t timeout, ip4_addr_t *addr) {
+  return ESP_ERR_NOT_FOUND;
+}
+
+void mdns_query_results_free(mdns_result_t *results) {
+}
+
+/*
+ * The file system is a directory below the current one
+ */
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t *conf) {
+  if (mkdir(conf->base_path, 0755) < 0 && errno != EEXIST) {
+    ESP_LOGE(host_tag, "Cannot create %s : %s", conf->base_path, strerror(errno));
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,318 @@
+/*
+ * Linux host build : FreeRTOS tasks, notifications and semaphores on top of threads,
+ * and the fake clock that moves when the loop task blocks.
+ *
+ * The loop task (the thread that runs setup() and loop()) never really waits : a
+ * vTaskDelay() or a ulTaskNotifyTake() with a timeout makes the clock jump ahead instead,
+ * then the idle hooks run, as they would after a light sleep. A pending notification
+ * returns right away, like on the ESP32. That's what makes a simulated year take seconds.
+ *
+ * Other tasks (e.g. the PublishQueue sender, the MQTT event tasks) are real threads.
+ * Their timeouts are on the fake clock too, they wake up when it has moved far enough.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Host.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_freertos_hooks.h"
+#include "esp_log.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+
+struct host_task {
+  const char			*name;
+  std::mutex			m;
+  std::condition_variable	cv;
+  uint32_t			notify;
+  int64_t			wake_at;	// Fake clock deadline while waiting, 0 if none
+
+  host_task(const char *name) : name(name), notify(0), wake_at(0) {}
+};
+
+struct host_sem {
+  std::mutex			m;
+  std::condition_variable	cv;
+  UBaseType_t			count, max;
+
+  host_sem(UBaseType_t max, UBaseType_t count) : count(count), max(max) {}
+};
+
+static const char *host_tag = "Host";
+
+static std::atomic<int64_t>	clock_us(0);
+static std::atomic<int64_t>	limit_us(0);
+static std::atomic<uint64_t>	wakeups(0);
+
+static host_task		*loop_task = 0;
+static thread_local host_task	*current = 0;
+
+// Tasks waiting for the fake clock, so the loop task knows whom to wake up
+static std::mutex		waiters_m;
+static std::list<host_task *>	waiters;
+static std::atomic<int64_t>	next_wake(INT64_MAX);
+
+static const int		max_hooks = 4;
+static esp_freertos_idle_cb_t	idle_hooks[max_hooks];
+static int			nhooks = 0;
+
+static host_task *Self() {
+  if (current == 0)
+    current = new host_task("main");
+  return current;
+}
+
+void HostSetLoopTask() {
+  loop_task = Self();
+}
+
+int64_t HostNow() {
+  return clock_us;
+}
+
+void HostSetLimit(int64_t us) {
+  limit_us = us;
+}
+
+uint64_t HostGetWakeups() {
+  return wakeups;
+}
+
+static void Register(host_task *t, int64_t deadline) {
+  std::lock_guard<std::mutex> lk(waiters_m);
+  t->wake_at = deadline;
+  waiters.push_back(t);
+  if (deadline < next_wake)
+    next_wake = deadline;
+}
+
+static void Unregister(host_task *t) {
+  std::lock_guard<std::mutex> lk(waiters_m);
+  waiters.remove(t);
+  t->wake_at = 0;
+
+  int64_t next = INT64_MAX;
+  for (host_task *w : waiters)
+    if (w->wake_at < next)
+      next = w->wake_at;
+  next_wake = next;
+}
+
+static void WakeWaiters(int64_t now) {
+  std::lock_guard<std::mutex> lk(waiters_m);
+  for (host_task *w : waiters)
+    if (w->wake_at <= now) {
+      std::lock_guard<std::mutex> tl(w->m);
+      w->cv.notify_all();
+    }
+}
+
+/*
+ * The loop task "sleeps" : move the clock, but not beyond the simulator's next event.
+ */
+static void Advance(int64_t us) {
+  int64_t now = clock_us, target = now + us, limit = limit_us;
+  if (limit && target > limit)
+    target = (limit > now) ? limit : now;
+
+  clock_us = target;
+  wakeups++;
+  if (target >= next_wake)
+    WakeWaiters(target);
+
+  for (int i=0; i<nhooks; i++)
+    idle_hooks[i]();
+}
+
+esp_err_t esp_register_freertos_idle_hook(esp_freertos_idle_cb_t cb) {
+  if (nhooks >= max_hooks)
+    return ESP_ERR_NO_MEM;
+  idle_hooks[nhooks++] = cb;
+  return ESP_OK;
+}
+
+/*
+ * Tasks
+ */
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+  UBaseType_t prio, TaskHandle_t *handle) {
+  host_task *t = new host_task(name);
+
+  std::thread([=]() {
+    current = t;
+    fn(arg);
+  }).detach();
+
+  if (handle)
+    *handle = t;
+  return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+  UBaseType_t prio, TaskHandle_t *handle, BaseType_t core) {
+  return xTaskCreate(fn, name, stack, arg, prio, handle);
+}
+
+// A task can end itself, threads can't be killed from outside
+void vTaskDelete(TaskHandle_t task) {
+  if (task == 0 || task == current)
+    pthread_exit(0);
+  ESP_LOGD(host_tag, "vTaskDelete(%s) ignored", task->name);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return Self();
+}
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)(clock_us / (1000 * portTICK_PERIOD_MS));
+}
+
+void vTaskDelay(TickType_t ticks) {
+  host_task *t = Self();
+
+  if (t == loop_task) {
+    Advance((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+    return;
+  }
+
+  int64_t deadline = clock_us + (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+  Register(t, deadline);
+  {
+    std::unique_lock<std::mutex> lk(t->m);
+    t->cv.wait(lk, [&]() { return clock_us >= deadline; });
+  }
+  Unregister(t);
+}
+
+static uint32_t Consume(host_task *t, BaseType_t clear) {
+  uint32_t n = t->notify;
+  if (n)
+    t->notify = clear ? 0 : n - 1;
+  return n;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+  host_task *t = Self();
+  int64_t deadline = 0;
+
+  if (ticks != 0 && ticks != portMAX_DELAY) {
+    if (t == loop_task) {
+      {
+        std::lock_guard<std::mutex> lk(t->m);
+	if (t->notify)
+	  return Consume(t, clear);
+      }
+      Advance((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+
+      std::lock_guard<std::mutex> lk(t->m);
+      return Consume(t, clear);
+    }
+
+    deadline = clock_us + (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+    Register(t, deadline);
+  }
+
+  uint32_t n;
+  {
+    std::unique_lock<std::mutex> lk(t->m);
+    if (ticks != 0)
+      t->cv.wait(lk, [&]() { return t->notify != 0 || (deadline && clock_us >= deadline); });
+    n = Consume(t, clear);
+  }
+
+  if (deadline)
+    Unregister(t);
+  return n;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  std::lock_guard<std::mutex> lk(task->m);
+  task->notify++;
+  task->cv.notify_all();
+  return pdPASS;
+}
+
+/*
+ * Semaphores : timeouts are in real time, they're only used to keep tasks apart
+ */
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return new host_sem(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new host_sem(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+  return new host_sem(max, initial);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  delete sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  std::unique_lock<std::mutex> lk(sem->m);
+  auto avail = [&]() { return sem->count > 0; };
+
+  if (ticks == portMAX_DELAY)
+    sem->cv.wait(lk, avail);
+  else if (! sem->cv.wait_for(lk, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), avail))
+    return pdFALSE;
+
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  std::lock_guard<std::mutex> lk(sem->m);
+  if (sem->count >= sem->max)
+    return pdFALSE;
+  sem->count++;
+  sem->cv.notify_one();
+  return pdTRUE;
+}
+
+/*
+ * Critical sections
+ */
+void vPortCPUInitializeMutex(portMUX_TYPE *mux) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&mux->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+  pthread_mutex_lock(&mux->mutex);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+  pthread_mutex_unlock(&mux->mutex);
+}
@@ -0,0 +1,307 @@
+/*
+ * Linux host build : FTP server download throughput and heap, with several clients at once.
+ *
+ * Runs the controller's FTP server on a local port, and lets 1 .. n clients RETR the same
+ * file in active mode (PASV isn't supported), as when log files are pulled off a controller
+ * by several people at the same time. A client that doesn't find a free transfer buffer
+ * gets a 451, that's expected beyond TRANSMIT_BUFFER_COUNT clients. Every file that does
+ * arrive must be complete and intact.
+ *
+ * Throughput is that of the data connections, the logins aren't counted.
+ * The heap column is the peak of what the process allocated during the run, above what
+ * it used before. The transfer buffers are static, each download adds a reader task.
+ *
+ * Usage : ftp-bench [-c clients] [-s file size in KiB] [-p port]	(3 clients, 1024 KiB, 2121)
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Host.h"
+#include "ftpserv.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static char		path[64];
+static size_t		file_size;
+static in_port_t	port = 2121;
+
+typedef chrono::steady_clock::time_point	Time;
+
+static atomic<bool>	sampling(false);
+static atomic<size_t>	heap_peak(0);
+
+static uint8_t Pattern(size_t i) {
+  return (uint8_t)((i * 7) ^ (i >> 11));
+}
+
+/*
+ * Read the server's reply, the last line of a reply has a space after the code
+ */
+static int Reply(int s, char *buf, int len) {
+  int n = 0;
+
+  while (n < len - 1) {
+    int r = recv(s, buf + n, len - 1 - n, 0);
+    if (r <= 0)
+      return -1;
+    n += r;
+    buf[n] = 0;
+
+    char *line = buf, *eol;
+    while ((eol = strstr(line, "\r\n")) != 0) {
+      if (eol - line >= 4 && line[3] == ' ')
+        return atoi(line);
+      line = eol + 2;
+    }
+  }
+  return -1;
+}
+
+static int Command(int s, const char *cmd, char *buf, int len) {
+  snprintf(buf, len, "%s\r\n", cmd);
+  if (send(s, buf, strlen(buf), MSG_NOSIGNAL) < 0)
+    return -1;
+  return Reply(s, buf, len);
+}
+
+static int Connect(in_port_t port) {
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  if (s >= 0 && connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    close(s);
+    s = -1;
+  }
+  return s;
+}
+
+enum { RETR_OK, RETR_REFUSED, RETR_FAILED };
+
+/*
+ * One client : log in, offer a data port, RETR the file and check what arrives.
+ * The data phase runs from the data connection until the server closes it.
+ */
+static int Download(Time *start, Time *end) {
+  char buf[512];
+  int s = Connect(port), result = RETR_FAILED;
+  if (s < 0)
+    return RETR_FAILED;
+
+  int ls = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sa;
+  socklen_t sl = sizeof(sa);
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  while (Reply(s, buf, sizeof(buf)) == 220
+      && Command(s, "USER " CONFIG_FTP_USER, buf, sizeof(buf)) == 331
+      && Command(s, "PASS bench", buf, sizeof(buf)) == 230
+      && Command(s, "TYPE I", buf, sizeof(buf)) == 200
+      && bind(ls, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(ls, 1) == 0
+      && getsockname(ls, (struct sockaddr *)&sa, &sl) == 0) {
+    char cmd[128];
+    int p = ntohs(sa.sin_port);
+    snprintf(cmd, sizeof(cmd), "PORT 127,0,0,1,%d,%d", p >> 8, p & 0xFF);
+    if (Command(s, cmd, buf, sizeof(buf)) != 200)
+      break;
+
+    snprintf(cmd, sizeof(cmd), "RETR %s", path);
+    if (Command(s, cmd, buf, sizeof(buf)) != 150)
+      break;
+
+    // Without a transfer buffer, the server answers without connecting
+    struct pollfd pfd[2] = { { ls, POLLIN, 0 }, { s, POLLIN, 0 } };
+    if (poll(pfd, 2, -1) < 0)
+      break;
+    if (! (pfd[0].revents & POLLIN)) {
+      if (Reply(s, buf, sizeof(buf)) == 451)
+        result = RETR_REFUSED;
+      break;
+    }
+
+    int ds = accept(ls, 0, 0);
+    if (ds < 0)
+      break;
+    *start = chrono::steady_clock::now();
+
+    size_t got = 0;
+    bool intact = true;
+    uint8_t data[8192];
+    int r;
+    while ((r = recv(ds, data, sizeof(data), 0)) > 0) {
+      for (int i=0; i<r; i++)
+        if (data[i] != Pattern(got + i))
+	  intact = false;
+      got += r;
+    }
+    close(ds);
+    *end = chrono::steady_clock::now();
+
+    if (Reply(s, buf, sizeof(buf)) == 226 && intact && got == file_size)
+      result = RETR_OK;
+    break;
+  }
+
+  close(ls);
+  Command(s, "QUIT", buf, sizeof(buf));
+  close(s);
+  return result;
+}
+
+static void Sampler() {
+  while (sampling) {
+    size_t h = HostHeapUsed();
+    if (h > heap_peak)
+      heap_peak = h;
+    usleep(200);
+  }
+}
+
+static void Usage(const char *prog) {
+  fprintf(stderr, "Usage : %s [-c clients] [-s file size in KiB] [-p port]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  int maxclients = 3, kib = 1024, opt;
+
+  while ((opt = getopt(argc, argv, "c:s:p:")) != -1)
+    switch (opt) {
+    case 'c':
+      maxclients = atoi(optarg);
+      break;
+    case 's':
+      kib = atoi(optarg);
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    default:
+      Usage(argv[0]);
+    }
+  if (maxclients < 1 || kib < 1)
+    Usage(argv[0]);
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+
+  // The file to download
+  file_size = (size_t)kib * 1024;
+  strcpy(path, "/tmp/ftp-bench.XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror(path);
+    return 2;
+  }
+  vector<uint8_t> content(file_size);
+  for (size_t i=0; i<file_size; i++)
+    content[i] = Pattern(i);
+  if (write(fd, content.data(), file_size) != (ssize_t)file_size) {
+    perror(path);
+    return 2;
+  }
+  close(fd);
+
+  g_cfg.MaxUsers = maxclients;
+  g_cfg.Port = port;
+  xTaskCreate(ftpmain, "FTP server task", 6000, 0, 2 | portPRIVILEGE_BIT, 0);
+
+  int s = -1;
+  for (int i=0; i<100 && (s = Connect(port)) < 0; i++)
+    usleep(10000);
+  if (s < 0) {
+    fprintf(stderr, "No FTP server on port %d\n", port);
+    unlink(path);
+    return 2;
+  }
+  close(s);
+
+  printf("FTP : %d KiB file, %d transfer buffers of %d bytes, reader task stack %d bytes\n",
+    kib, TRANSMIT_BUFFER_COUNT, TRANSMIT_BUFFER_SIZE, FTP_READER_STACK);
+  printf("%7s %6s %8s %12s %12s %s\n", "clients", "done", "refused", "MB/s", "heap KiB", "");
+
+  int failed = 0;
+  for (int n=1; n<=maxclients; n++) {
+    vector<int> results(n);
+    vector<Time> start(n), end(n);
+    vector<thread> clients;
+
+    // Let the previous sessions end, they free their command buffer on the way out
+    usleep(100000);
+    size_t heap_idle = HostHeapUsed();
+    heap_peak = heap_idle;
+    sampling = true;
+    thread sampler(Sampler);
+
+    for (int i=0; i<n; i++)
+      clients.push_back(thread([&, i]() { results[i] = Download(&start[i], &end[i]); }));
+    for (thread &t : clients)
+      t.join();
+
+    sampling = false;
+    sampler.join();
+
+    // Throughput over the time that any download was busy sending data
+    int done = 0, refused = 0, bad = 0;
+    Time t0 = Time::max(), t1 = Time::min();
+    for (int i=0; i<n; i++)
+      if (results[i] == RETR_OK) {
+        done++;
+	t0 = min(t0, start[i]);
+	t1 = max(t1, end[i]);
+      } else if (results[i] == RETR_REFUSED)
+        refused++;
+      else
+        bad++;
+    double secs = done ? chrono::duration<double>(t1 - t0).count() : 1;
+
+    // Refusals are only fine when there's no buffer to spare
+    bool ok = (bad == 0 && done >= (n < TRANSMIT_BUFFER_COUNT ? n : TRANSMIT_BUFFER_COUNT));
+    printf("%7d %6d %8d %12.1f %12.1f %s\n", n, done, refused,
+      done * file_size / secs / 1048576, (heap_peak - heap_idle) / 1024.0,
+      ok ? "ok" : "FAILED");
+    if (! ok)
+      failed++;
+  }
+
+  unlink(path);
+  fflush(stdout);
+  _exit(failed ? 1 : 0);
+}
@@ -0,0 +1,323 @@
+/*
+ * Linux host build : esp-mqtt clients and a loopback broker in the same process.
+ *
+ * Each client gets a task that calls its event handler, as esp-mqtt does, so the handler
+ * runs concurrently with the loop task, like on the ESP32. The broker is QoS 0 with clean
+ * sessions : subscriptions are lost when a client disconnects, and nothing is retained.
+ * Started clients reconnect when the broker comes back, unless they disabled auto-reconnect.
+ * The simulator can publish, listen to what the clients publish, and stop the broker.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Host.h"
+#include "mqtt_client.h"
+#include "esp_log.h"
+
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct mqtt_event_item {
+  esp_mqtt_event_id_t	id;
+  string		topic, data;
+  int			msg_id;
+  bool			quit;
+};
+
+struct esp_mqtt_client {
+  esp_mqtt_client_config_t	config;
+  vector<string>		filters;
+  bool				started, connected;
+  int				msg_id;
+
+  mutex				m;
+  condition_variable		cv;
+  deque<mqtt_event_item>	events;
+  thread			task;
+};
+
+struct listener {
+  string		filter;
+  HostBrokerListener	fn;
+  void			*arg;
+};
+
+static const char		*broker_tag = "Broker";
+
+static mutex			broker_m;
+static bool			broker_up = true;
+static list<esp_mqtt_client *>	clients;
+static list<listener>		listeners;
+static host_broker_stats	stats;
+
+/*
+ * MQTT topic filter : "+" matches one level, "#" all that follows.
+ */
+static bool TopicMatch(const char *f, const char *t) {
+  while (*f) {
+    if (*f == '#')
+      return true;
+    if (*f == '+') {
+      while (*t && *t != '/')
+        t++;
+      f++;
+      continue;
+    }
+    if (*f != *t)
+      return false;
+    f++;
+    t++;
+  }
+  return *t == 0;
+}
+
+static void Post(esp_mqtt_client *c, esp_mqtt_event_id_t id, const char *topic = "",
+  const char *data = "", int len = 0, int msg_id = 0) {
+  lock_guard<mutex> lk(c->m);
+  mqtt_event_item e;
+  e.id = id;
+  e.topic = topic;
+  e.data.assign(data, len);
+  e.msg_id = msg_id;
+  e.quit = false;
+  c->events.push_back(e);
+  c->cv.notify_one();
+}
+
+static void EventTask(esp_mqtt_client *c) {
+  while (1) {
+    mqtt_event_item e;
+    {
+      unique_lock<mutex> lk(c->m);
+      c->cv.wait(lk, [c]() { return ! c->events.empty(); });
+      e = c->events.front();
+      c->events.pop_front();
+    }
+    if (e.quit)
+      return;
+
+    esp_mqtt_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.event_id = e.id;
+    ev.client = c;
+    ev.user_context = c->config.user_context;
+    ev.topic = (char *)e.topic.data();
+    ev.topic_len = e.topic.size();
+    ev.data = (char *)e.data.data();
+    ev.data_len = ev.total_data_len = e.data.size();
+    ev.msg_id = e.msg_id;
+
+    if (c->config.event_handle)
+      c->config.event_handle(&ev);
+  }
+}
+
+/*
+ * Hand a message to the subscribed clients, return the listeners to call.
+ * Caller holds broker_m.
+ */
+static list<listener> Route(const char *topic, const char *data, int len) {
+  for (esp_mqtt_client *c : clients) {
+    if (! c->connected)
+      continue;
+    for (const string &f : c->filters)
+      if (TopicMatch(f.c_str(), topic)) {
+	Post(c, MQTT_EVENT_DATA, topic, data, len);
+	stats.delivered++;
+	break;
+      }
+  }
+
+  list<listener> r;
+  for (const listener &l : listeners)
+    if (TopicMatch(l.filter.c_str(), topic))
+      r.push_back(l);
+  return r;
+}
+
+static void Notify(const list<listener> &ls, const char *topic, const char *data, int len) {
+  string payload(data, len);
+  for (const listener &l : ls)
+    l.fn(topic, payload.c_str(), l.arg);
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+  esp_mqtt_client *c = new esp_mqtt_client;
+  c->config = *config;
+  c->started = c->connected = false;
+  c->msg_id = 0;
+  c->task = thread(EventTask, c);
+
+  lock_guard<mutex> lk(broker_m);
+  clients.push_back(c);
+  return c;
+}
+
+/*
+ * Connecting is asynchronous, the outcome arrives as an event.
+ * Caller holds broker_m.
+ */
+static void Connect(esp_mqtt_client *c) {
+  c->filters.clear();
+  Post(c, MQTT_EVENT_BEFORE_CONNECT);
+  if (broker_up) {
+    c->connected = true;
+    stats.connects++;
+    Post(c, MQTT_EVENT_CONNECTED);
+  } else {
+    stats.refused++;
+    Post(c, MQTT_EVENT_ERROR);
+    Post(c, MQTT_EVENT_DISCONNECTED);
+  }
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t c) {
+  lock_guard<mutex> lk(broker_m);
+  c->started = true;
+  Connect(c);
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t c) {
+  lock_guard<mutex> lk(broker_m);
+  c->started = c->connected = false;
+  return ESP_OK;
+}
+
+// Waits for the event task to finish, don't call this from the event handler
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t c) {
+  {
+    lock_guard<mutex> lk(broker_m);
+    clients.remove(c);
+  }
+  {
+    lock_guard<mutex> lk(c->m);
+    mqtt_event_item e;
+    e.quit = true;
+    c->events.push_back(e);
+    c->cv.notify_one();
+  }
+  c->task.join();
+  delete c;
+  return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t c, const char *topic, int qos) {
+  lock_guard<mutex> lk(broker_m);
+  if (! c->connected)
+    return -1;
+
+  c->filters.push_back(topic);
+  int id = ++c->msg_id;
+  Post(c, MQTT_EVENT_SUBSCRIBED, "", "", 0, id);
+  return id;
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t c, const char *topic) {
+  lock_guard<mutex> lk(broker_m);
+  if (! c->connected)
+    return -1;
+
+  for (vector<string>::iterator it = c->filters.begin(); it != c->filters.end(); it++)
+    if (*it == topic) {
+      c->filters.erase(it);
+      break;
+    }
+  int id = ++c->msg_id;
+  Post(c, MQTT_EVENT_UNSUBSCRIBED, "", "", 0, id);
+  return id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t c, const char *topic, const char *data,
+  int len, int qos, int retain) {
+  if (len == 0)
+    len = strlen(data);
+
+  list<listener> ls;
+  int id;
+  {
+    lock_guard<mutex> lk(broker_m);
+    if (! c->connected) {
+      stats.rejected++;
+      return -1;
+    }
+    stats.published++;
+    ls = Route(topic, data, len);
+
+    id = qos ? ++c->msg_id : 0;
+    if (qos)
+      Post(c, MQTT_EVENT_PUBLISHED, "", "", 0, id);
+  }
+
+  Notify(ls, topic, data, len);
+  return id;
+}
+
+/*
+ * The simulator's side
+ */
+void HostBrokerUp(bool up) {
+  lock_guard<mutex> lk(broker_m);
+  if (up == broker_up)
+    return;
+  broker_up = up;
+  ESP_LOGI(broker_tag, "Broker %s", up ? "up" : "down");
+
+  for (esp_mqtt_client *c : clients)
+    if (! up && c->connected) {
+      c->connected = false;
+      Post(c, MQTT_EVENT_DISCONNECTED);
+    } else if (up && c->started && ! c->connected && ! c->config.disable_auto_reconnect)
+      Connect(c);
+}
+
+void HostBrokerPublish(const char *topic, const char *payload) {
+  list<listener> ls;
+  int len = strlen(payload);
+  {
+    lock_guard<mutex> lk(broker_m);
+    if (! broker_up)
+      return;
+    ls = Route(topic, payload, len);
+  }
+  Notify(ls, topic, payload, len);
+}
+
+void HostBrokerListen(const char *filter, HostBrokerListener fn, void *arg) {
+  lock_guard<mutex> lk(broker_m);
+  listener l;
+  l.filter = filter;
+  l.fn = fn;
+  l.arg = arg;
+  listeners.push_back(l);
+}
+
+void HostBrokerStats(host_broker_stats *s) {
+  lock_guard<mutex> lk(broker_m);
+  *s = stats;
+}
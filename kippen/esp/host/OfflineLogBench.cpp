@@ -0,0 +1,182 @@
+/*
+ * Linux host build : OfflineLog append and replay throughput, with files for segments.
+ *
+ * For a few message sizes, fill the log to capacity (as a long outage would), then replay
+ * it the way jobOfflog does, into a PublishQueue with a client on the loopback broker.
+ * Replay runs on the fake clock, so its simulated rate is what the replay_batch and
+ * replay_interval settings allow; the CPU time is what the host spent, all tasks included.
+ * Every record must come back, in order.
+ *
+ * Usage : offlog-bench [-n segments] [-s segment size]	(8 segments of 4096 bytes)
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Host.h"
+#include "OfflineLog.h"
+#include "PublishQueue.h"
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <mutex>
+
+OfflineLog	*offlog = 0;
+
+static const char	*topic = "/bench/reply";
+static const int	replay_poll = 200;		// ms, as jobOfflog
+
+static std::mutex	received_m;
+static int		received = 0, received_last = 0, disorder = 0;
+
+static void Received(const char *topic, const char *payload, void *arg) {
+  std::lock_guard<std::mutex> lk(received_m);
+  int n;
+
+  if (sscanf(payload, "record %d", &n) != 1)
+    return;
+  if (n != received_last + 1)
+    disorder++;
+  received_last = n;
+  received++;
+}
+
+static int ReceivedCount() {
+  std::lock_guard<std::mutex> lk(received_m);
+  return received;
+}
+
+static double CpuTime() {
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void Usage(const char *prog) {
+  fprintf(stderr, "Usage : %s [-n segments] [-s segment size]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  int nsegments = 8, segsize = 4096, opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1)
+    switch (opt) {
+    case 'n':
+      nsegments = atoi(optarg);
+      break;
+    case 's':
+      segsize = atoi(optarg);
+      break;
+    default:
+      Usage(argv[0]);
+    }
+  if (nsegments < 1 || segsize < 64)
+    Usage(argv[0]);
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  HostSetLoopTask();
+
+  char dir[] = "/tmp/offlog-bench.XXXXXX";
+  if (mkdtemp(dir) == 0) {
+    perror(dir);
+    return 2;
+  }
+
+  // A PublishQueue with a connected client, as after a reconnect
+  esp_mqtt_client_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.uri = "mqtt://loopback";
+  esp_mqtt_client_handle_t client = esp_mqtt_client_init(&config);
+  esp_mqtt_client_start(client);
+  HostBrokerListen(topic, Received, 0);
+
+  PublishQueue *pq = new PublishQueue();
+  pq->setClient(client);
+  pq->Connected(true);
+
+  printf("OfflineLog : %d segments of %d bytes, in %s\n", nsegments, segsize, dir);
+  printf("%6s %8s %10s %12s %12s %12s %s\n",
+    "size", "records", "append us", "replay s", "records/s", "cpu us", "");
+
+  int failed = 0;
+  for (int size : { 32, 64, 128, 250 }) {
+    char sub[64], msg[256];
+    sprintf(sub, "%s/%d", dir, size);
+    mkdir(sub, 0755);
+    offlog = new OfflineLog(sub, nsegments, segsize);
+
+    // Fill without dropping : a new segment starts when the record doesn't fit
+    int n = nsegments * (segsize / (size + 3));
+    {
+      std::lock_guard<std::mutex> lk(received_m);
+      received = received_last = disorder = 0;
+    }
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int i=1; i<=n; i++) {
+      int len = snprintf(msg, sizeof(msg), "record %d ", i);
+      memset(msg + len, 'x', size - len);
+      msg[size] = 0;
+      if (! offlog->Append(msg)) {
+        printf("Append %d failed\n", i);
+	failed++;
+	break;
+      }
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    double append = std::chrono::duration<double, std::micro>(t1 - t0).count() / n;
+
+    // Replay as jobOfflog does, give the PublishQueue task a moment (real time) per step
+    int64_t start = HostNow();
+    double cpu = CpuTime();
+    for (int i=0; i<600000 && offlog->Pending(); i++) {
+      offlog->Replay(pq, topic);
+      vTaskDelay(pdMS_TO_TICKS(replay_poll));
+      usleep(50);
+    }
+    double replay = (HostNow() - start) / 1e6;
+    cpu = CpuTime() - cpu;
+
+    // The last batch may still be on its way
+    for (int i=0; i<1000 && (ReceivedCount() < n || pq->getQueued()); i++) {
+      vTaskDelay(pdMS_TO_TICKS(replay_poll));
+      usleep(1000);
+    }
+
+    std::lock_guard<std::mutex> lk(received_m);
+    bool ok = (received == n && disorder == 0 && offlog->getDropped() == 0);
+    printf("%6d %8d %10.1f %12.1f %12.1f %12.1f %s\n", size, n, append, replay, n / replay,
+      1e6 * cpu / n, ok ? "ok" : "LOST OR OUT OF ORDER");
+    if (! ok)
+      failed++;
+
+    delete offlog;
+    offlog = 0;
+    rmdir(sub);
+  }
+
+  rmdir(dir);
+  fflush(stdout);
+  _exit(failed ? 1 : 0);
+}
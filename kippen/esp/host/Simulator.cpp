@@ -0,0 +1,446 @@
+/*
+ * Linux host build : run the kippen controller through a simulated year.
+ *
+ * The controller code is the one from ../main, on top of the stand-ins in this directory.
+ * The fake clock jumps ahead whenever loop() blocks, so a year of sunrises and sunsets
+ * takes seconds. Meanwhile this :
+ * - moves a model of the coop door when the motor runs, and reports the end stops,
+ * - feeds the temperature sensor a daily and a yearly cycle,
+ * - takes the MQTT broker and Wi-Fi down now and then,
+ * - asks for the time once a day, and makes a numbered report every hour,
+ *   which must all arrive in order, including those made while offline.
+ * At the end, it prints the controller's own loop profile and power report, and what it
+ * measured : real time spent, loop iterations, heap, door runs and message counts.
+ *
+ * Usage : kippen-sim [-d days] [-s yyyy-mm-dd] [-n] [-v]
+ *   -d	number of days to simulate (365)
+ *   -s	start date, at midnight UTC (2021-01-01)
+ *   -n	no broker and Wi-Fi outages
+ *   -v	show the controller's log
+ * Exit status is 1 if a check failed.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Host.h"
+#include "Kippen.h"
+#include "Hatch.h"
+#include "Sunset.h"
+#include "OfflineLog.h"
+
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+extern void setup();
+extern void loop();
+
+/*
+ * The door : it takes door_travel seconds from one end to the other
+ */
+static vector<int>	schedule_times;			// CONFIG_HATCH_SCHEDULE, seconds since midnight
+static const int64_t	door_travel = 20000000;		// us
+
+static int64_t		door_pos = 0;			// 0 is down, door_travel is up
+static int		door_dir = 0;			// -1 down, +1 up
+static int64_t		door_last = 0;
+static float		pwm_duty[2];
+
+static int		door_up_runs = 0, door_down_runs = 0;
+static int		door_short_runs = 0;		// Motor stopped before reaching the end stop
+static int64_t		door_motor_us = 0, door_run_start = 0;
+static int		door_late_max = 0;		// Seconds between schedule and motor start
+
+static void DoorMove() {
+  int64_t now = HostNow();
+  door_pos += door_dir * (now - door_last);
+  if (door_pos < 0)
+    door_pos = 0;
+  if (door_pos > door_travel)
+    door_pos = door_travel;
+  door_last = now;
+}
+
+static void ParseSchedule(const char *s) {
+  int hr, mn, state, n;
+  while (sscanf(s, "%d:%d,%d%n", &hr, &mn, &state, &n) == 3) {
+    schedule_times.push_back(hr * 3600 + mn * 60);
+    s += n;
+    if (*s == ',')
+      s++;
+  }
+}
+
+// Seconds between now and the nearest scheduled transition
+static int DoorLateness() {
+  time_t now = time(0);
+  struct tm *tmp = localtime(&now);
+  int sec = tmp->tm_hour * 3600 + tmp->tm_min * 60 + tmp->tm_sec;
+  int best = 86400;
+
+  for (int t : schedule_times)
+    if (abs(sec - t) < best)
+      best = abs(sec - t);
+  return best;
+}
+
+// Operator A (FORWARD) lowers the door, operator B (BACKWARD) raises it
+static void DoorPwm(int op, float duty) {
+  DoorMove();
+  pwm_duty[op] = duty;
+
+  int dir = (pwm_duty[1] > 0) ? +1 : (pwm_duty[0] > 0) ? -1 : 0;
+  if (dir == door_dir)
+    return;
+
+  if (door_dir != 0) {
+    door_motor_us += HostNow() - door_run_start;
+    if (door_pos != 0 && door_pos != door_travel)
+      door_short_runs++;
+  }
+  if (dir != 0) {
+    door_run_start = HostNow();
+    if (dir > 0)
+      door_up_runs++;
+    else
+      door_down_runs++;
+    int late = DoorLateness();
+    if (late > door_late_max)
+      door_late_max = late;
+  }
+  door_dir = dir;
+}
+
+// The end-stop sensors pull their pin low
+static bool DoorSensors(int pin, int *value) {
+  if (pin != CONFIG_SENSOR_DOWN_PIN && pin != CONFIG_SENSOR_UP_PIN)
+    return false;
+
+  DoorMove();
+  if (pin == CONFIG_SENSOR_DOWN_PIN)
+    *value = (door_pos == 0) ? 0 : 1;
+  else
+    *value = (door_pos == door_travel) ? 0 : 1;
+  return true;
+}
+
+/*
+ * The MCP9808 (channel 0x18) reads centi-degrees : colder in January, warmer in July,
+ * coldest at dawn. Only this channel is ours.
+ */
+static bool Weather(int channel, int *value) {
+  if (channel != 0x18)
+    return false;
+
+  time_t now = time(0);
+  struct tm *tmp = localtime(&now);
+  double year = 2 * M_PI * (tmp->tm_yday - 196) / 365.0;
+  double day = 2 * M_PI * (tmp->tm_hour * 60 + tmp->tm_min - 15 * 60) / 1440.0;
+  *value = (int)(100 * (11.0 + 8.0 * cos(year) + 4.0 * cos(day)));
+  return true;
+}
+
+/*
+ * What comes back on the reply topic
+ */
+static mutex		reply_m;
+static int		time_replies = 0, temperature_replies = 0;
+static int		hourly_received = 0, hourly_last = 0, hourly_disorder = 0;
+static bool		collecting = false;
+static vector<string>	collected;
+
+static void Reply(const char *topic, const char *payload, void *arg) {
+  lock_guard<mutex> lk(reply_m);
+  int n;
+
+  if (sscanf(payload, "Simulator : report %d", &n) == 1) {
+    if (n <= hourly_last)
+      hourly_disorder++;
+    hourly_last = n;
+    hourly_received++;
+  } else if (strncmp(payload, "Temperature ", 12) == 0)
+    temperature_replies++;
+  else if (payload[0] == '2' && payload[4] == '-')		// Reply to /kippen/system/time
+    time_replies++;
+  else if (collecting)
+    collected.push_back(payload);
+}
+
+/*
+ * Simulator events, in fake clock time
+ */
+static multimap<int64_t, function<void()>>	events;
+
+static void At(int64_t us, function<void()> fn) {
+  events.insert(make_pair(us, fn));
+}
+
+static void Every(int64_t first, int64_t period, function<void()> fn) {
+  At(first, [=]() {
+    fn();
+    Every(first + period, period, fn);
+  });
+}
+
+static const int64_t	minute = 60 * 1000000LL, hour = 60 * minute, day = 24 * hour;
+
+// Old segments would be replayed, and counted as ours
+static void CleanOfflineLog() {
+  DIR *d = opendir(CONFIG_FS_BASEDIR);
+  if (d == 0)
+    return;
+
+  struct dirent *de;
+  while ((de = readdir(d)) != 0)
+    if (strncmp(de->d_name, "offline.", 8) == 0) {
+      string fn = string(CONFIG_FS_BASEDIR) + "/" + de->d_name;
+      unlink(fn.c_str());
+    }
+  closedir(d);
+}
+
+static void Usage(const char *prog) {
+  fprintf(stderr, "Usage : %s [-d days] [-s yyyy-mm-dd] [-n] [-v]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  int days = 365;
+  bool outages = true, verbose = false;
+  time_t start = 1609459200;		// 2021-01-01 00:00:00 UTC
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:s:nv")) != -1)
+    switch (opt) {
+    case 'd':
+      days = atoi(optarg);
+      if (days < 1)
+        Usage(argv[0]);
+      break;
+    case 's': {
+      struct tm t;
+      memset(&t, 0, sizeof(t));
+      if (sscanf(optarg, "%d-%d-%d", &t.tm_year, &t.tm_mon, &t.tm_mday) != 3)
+        Usage(argv[0]);
+      t.tm_year -= 1900;
+      t.tm_mon -= 1;
+      start = timegm(&t);
+      break;
+    }
+    case 'n':
+      outages = false;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      Usage(argv[0]);
+    }
+
+  // The controller logs at INFO, its sensor readings even at ERROR, and so are outages
+  if (! verbose) {
+    esp_log_level_set("*", ESP_LOG_WARN);
+    esp_log_level_set("Temperature", ESP_LOG_NONE);
+    esp_log_level_set("kippen", ESP_LOG_NONE);
+    esp_log_level_set("PublishQueue", ESP_LOG_NONE);
+  }
+
+  CleanOfflineLog();
+  HostSetLoopTask();
+  HostSetWallClock(start);
+  ParseSchedule(CONFIG_HATCH_SCHEDULE);
+  HostGpioSetHook(DoorSensors);
+  HostAdcSetHook(Weather);
+  HostPwmSetHook(DoorPwm);
+  HostBrokerListen("/kippen/reply", Reply, 0);
+
+  chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+  size_t heap_boot = HostHeapUsed();
+
+  setup();
+  size_t heap_setup = HostHeapUsed(), heap_peak = heap_setup;
+
+  // The clock got set during setup(), convert from wall clock time
+  int64_t us0 = HostNow() - (time(0) - start) * 1000000LL, end = us0 + days * day;
+
+  // Every hour, a report that must make it (queued in flash while offline)
+  int hourly_sent = 0, hourly_refused = 0;
+  Every(us0 + hour, hour, [&]() {
+    char msg[48];
+    sprintf(msg, "Simulator : report %d", ++hourly_sent);
+    if (! kippen->Report(msg))
+      hourly_refused++;
+  });
+
+  // Daily, around noon : ask the time, and note sunrise and sunset
+  int time_requests = 0, rise_min = 2400, rise_max = 0, set_min = 2400, set_max = 0;
+  Every(us0 + 11 * hour, day, [&]() {
+    HostBrokerPublish("/kippen/system/time", "");
+    time_requests++;
+
+    char buf[48];
+    int rh, rm, sh, sm;
+    sunset->getSchedule(buf, sizeof(buf));
+    if (sscanf(buf, "sunrise %d:%d sunset %d:%d", &rh, &rm, &sh, &sm) == 4) {
+      rise_min = min(rise_min, rh * 100 + rm);
+      rise_max = max(rise_max, rh * 100 + rm);
+      set_min = min(set_min, sh * 100 + sm);
+      set_max = max(set_max, sh * 100 + sm);
+    }
+  });
+
+  // The heap, every ten minutes
+  Every(us0 + 10 * minute, 10 * minute, [&]() {
+    heap_peak = max(heap_peak, HostHeapUsed());
+  });
+
+  // A night without broker every month, a Wi-Fi dropout every six weeks
+  int broker_outages = 0, wifi_outages = 0;
+  if (outages) {
+    Every(us0 + 10 * day + 2 * hour, 30 * day, [&]() {
+      HostBrokerUp(false);
+      broker_outages++;
+      At(HostNow() + 6 * hour, []() { HostBrokerUp(true); });
+    });
+    Every(us0 + 20 * day + 14 * hour, 45 * day, [&]() {
+      HostWifi(false);
+      HostBrokerUp(false);		// The MQTT connection goes with it
+      wifi_outages++;
+      At(HostNow() + 20 * minute, []() {
+        HostBrokerUp(true);
+        HostWifi(true);
+      });
+    });
+  }
+
+  /*
+   * Run loop() until the end, never letting the clock jump past the next event
+   */
+  uint64_t iterations = 0;
+  chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+  while (HostNow() < end) {
+    while (! events.empty() && events.begin()->first <= HostNow()) {
+      function<void()> fn = events.begin()->second;
+      events.erase(events.begin());
+      fn();
+    }
+
+    int64_t next = events.empty() ? end : min(events.begin()->first, end);
+    HostSetLimit(next);
+    loop();
+    iterations++;
+  }
+
+  chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+  uint64_t wakeups = HostGetWakeups();
+
+  /*
+   * Ask for the controller's own statistics, and wait (real time) until everything is in
+   */
+  HostSetLimit(0);
+  {
+    lock_guard<mutex> lk(reply_m);
+    collecting = true;
+  }
+  HostBrokerPublish("/kippen/system/stats", "");
+  HostBrokerPublish("/kippen/system/power", "");
+
+  int pq_dropped = 0, ol_dropped = 0;
+  for (int i=0; i<5000; i++) {
+    loop();
+    usleep(1000);
+
+    pq_dropped = kippen->pubq->getDropped();
+    ol_dropped = offlog ? offlog->getDropped() : 0;
+
+    lock_guard<mutex> lk(reply_m);
+    bool power_in = ! collected.empty() && strncmp(collected.back().c_str(), "Power", 5) == 0;
+    if (power_in && hourly_received + hourly_refused + pq_dropped + ol_dropped >= hourly_sent)
+      break;
+  }
+
+  lock_guard<mutex> lk(reply_m);
+  double real = chrono::duration<double>(t2 - t1).count();
+  double boot = chrono::duration<double>(t1 - t0).count();
+  size_t heap_end = HostHeapUsed();
+  host_broker_stats bs;
+  HostBrokerStats(&bs);
+
+  printf("Kippen controller, %d days from %s", days, asctime(gmtime(&start)));
+  for (const string &s : collected)
+    printf("  %s\n", s.c_str());
+  printf("\n");
+
+  printf("Time    : %.2f s for %d days (%.1f days/s), setup %.2f s\n",
+    real, days, days / real, boot);
+  printf("Loop    : %llu iterations, %llu wakeups, %.2f us each\n",
+    (unsigned long long)iterations, (unsigned long long)wakeups, 1e6 * real / iterations);
+  printf("Heap    : %zu bytes at boot, %zu after setup, peak %zu, %zu at the end\n",
+    heap_boot, heap_setup, heap_peak, heap_end);
+  printf("Sun     : sunrise %02d:%02d .. %02d:%02d, sunset %02d:%02d .. %02d:%02d\n",
+    rise_min / 100, rise_min % 100, rise_max / 100, rise_max % 100,
+    set_min / 100, set_min % 100, set_max / 100, set_max % 100);
+  printf("Hatch   : %d up, %d down, %d short, motor %.1f min, started at most %d s late\n",
+    door_up_runs, door_down_runs, door_short_runs, door_motor_us / 6e7, door_late_max);
+  printf("Outages : %d broker, %d Wi-Fi\n", broker_outages, wifi_outages);
+  printf("Broker  : %u connects, %u refused, %u published, %u rejected, %u delivered\n",
+    bs.connects, bs.refused, bs.published, bs.rejected, bs.delivered);
+  printf("Replies : %d/%d time, %d temperature, %d/%d hourly (%d out of order), %d refused, dropped %d queue %d flash\n",
+    time_replies, time_requests, temperature_replies, hourly_received, hourly_sent,
+    hourly_disorder, hourly_refused, pq_dropped, ol_dropped);
+
+  /*
+   * Checks : the door ran every day, on time, and no report that the controller took
+   * got lost or reordered
+   */
+  int failed = 0;
+  if (door_up_runs < days - 1 || door_down_runs < days - 1) {
+    printf("FAIL : the door didn't run every day\n");
+    failed++;
+  }
+  if (door_short_runs > 0 || door_late_max > 1) {
+    printf("FAIL : door runs stopped short, or started late\n");
+    failed++;
+  }
+  if (hourly_received + hourly_refused + pq_dropped + ol_dropped != hourly_sent || hourly_disorder) {
+    printf("FAIL : hourly reports lost or out of order\n");
+    failed++;
+  }
+  if (collected.empty()) {
+    printf("FAIL : no statistics received\n");
+    failed++;
+  }
+
+  // The controller's tasks don't end, skip the destructors
+  fflush(stdout);
+  _exit(failed ? 1 : 0);
+}
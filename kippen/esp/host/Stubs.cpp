@@ -0,0 +1,195 @@
+/*
+ * Linux host build : stand-ins for the modules that only talk to the network stack.
+ *
+ * Network keeps its interface : modules register for connect and disconnect events,
+ * which HostWifi() delivers. Secure, Ota, WebServer, PcpClient and the FTP server do nothing.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Host.h"
+#include "Network.h"
+#include "Secure.h"
+#include "Ota.h"
+#include "WebServer.h"
+#include "PcpClient.h"
+
+static const char *Cause2String(int c) {
+  return (c == 200) ? "BEACON_TIMEOUT" : "OTHER";
+}
+
+module_registration::module_registration() {
+  module = 0;
+  NetworkConnected = 0;
+  NetworkDisconnected = 0;
+  result = ESP_OK;
+}
+
+module_registration::module_registration(const char *name,
+    esp_err_t nc(void *, system_event_t *), esp_err_t nd(void *, system_event_t *)) {
+  module = (char *)name;
+  NetworkConnected = nc;
+  NetworkDisconnected = nd;
+  result = ESP_OK;
+}
+
+Network::Network(const char *name, esp_err_t (*nc)(void *, system_event_t *),
+    esp_err_t (*nd)(void *, system_event_t *)) : wifi_backoff("wifi") {
+  status = NS_NONE;
+  reason = 0;
+  last_connect = 0;
+  last_mqtt_message_received = 0;
+  mqtt_message = 0;
+  mqtt_failures = 0;
+
+  RegisterModule(name, nc, nd);
+}
+
+Network::~Network() {
+}
+
+void Network::RegisterModule(const char *name,
+    esp_err_t nc(void *, system_event_t *), esp_err_t nd(void *, system_event_t *)) {
+  modules.push_back(module_registration(name, nc, nd));
+}
+
+void Network::SetupWifi() {
+  status = NS_SETUP_DONE;
+}
+
+void Network::WaitForWifi() {
+  HostWifi(true);
+}
+
+void Network::loop(time_t now) {
+}
+
+bool Network::isConnected() {
+  return status == NS_RUNNING;
+}
+
+bool Network::NetworkIsNatted() {
+  return true;
+}
+
+void Network::NetworkConnected(void *ctx, system_event_t *event) {
+  status = NS_RUNNING;
+  last_connect = time(0);
+  wifi_backoff.Success();
+
+  for (module_registration &m : modules)
+    if (m.NetworkConnected)
+      m.result = m.NetworkConnected(ctx, event);
+}
+
+void Network::NetworkDisconnected(void *ctx, system_event_t *event) {
+  status = NS_FAILED;
+  wifi_backoff.Failure(event->event_info.disconnected.reason);
+
+  for (module_registration &m : modules)
+    if (m.NetworkDisconnected)
+      m.result = m.NetworkDisconnected(ctx, event);
+}
+
+void Network::mqttConnected() {
+  mqtt_failures = 0;
+}
+
+void Network::mqttDisconnected() {
+  mqtt_failures++;
+}
+
+void Network::mqttSubscribed() {
+}
+
+void Network::mqttUnsubscribed() {
+}
+
+void Network::gotMqttMessage() {
+  last_mqtt_message_received = time(0);
+  mqtt_message++;
+}
+
+void Network::FormatConnectStats(char *buf, int len) {
+  snprintf(buf, len, "Network : host build, %s, %u MQTT messages received",
+    isConnected() ? "connected" : "not connected", mqtt_message);
+}
+
+void Network::FormatBackoff(char *buf, int len) {
+  wifi_backoff.Format(buf, len, Cause2String);
+}
+
+/*
+ * Wi-Fi comes and goes as the simulator says
+ */
+void HostWifi(bool up) {
+  extern Network *network;
+  system_event_t event;
+
+  memset(&event, 0, sizeof(event));
+  if (up) {
+    if (network->isConnected())
+      return;
+    event.event_id = SYSTEM_EVENT_STA_GOT_IP;
+    event.event_info.got_ip.ip_info.ip.addr = 0x6400a8c0;		// 192.168.0.100
+    event.event_info.got_ip.ip_info.gw.addr = 0x0100a8c0;
+    event.event_info.got_ip.ip_info.netmask.addr = 0x00ffffff;
+    network->NetworkConnected(0, &event);
+  } else {
+    if (! network->isConnected())
+      return;
+    event.event_id = SYSTEM_EVENT_STA_DISCONNECTED;
+    event.event_info.disconnected.reason = 200;		// Beacon timeout
+    network->NetworkDisconnected(0, &event);
+  }
+}
+
+Secure::Secure() {
+  tlsTask = 0;
+  clients = 0;
+}
+
+Secure::~Secure() {
+}
+
+void Secure::loop(time_t now) {
+}
+
+Ota::Ota() {
+}
+
+WebServer::WebServer() {
+  server = 0;
+}
+
+WebServer::~WebServer() {
+}
+
+PcpClient::PcpClient() {
+  sock = -1;
+  task = 0;
+  router_name = 0;
+}
+
+PcpClient::~PcpClient() {
+}
+
+void ftp_init() {
+}
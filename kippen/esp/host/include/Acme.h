@@ -0,0 +1,14 @@
+/*
+ * Host build : no ACME client, CONFIG_ACME_ENABLED is off.
+ */
+#ifndef	_HOST_ACME_H_
+#define	_HOST_ACME_H_
+
+#include <time.h>
+
+class Acme {
+public:
+  void loop(time_t now) {}
+};
+
+#endif	/* _HOST_ACME_H_ */
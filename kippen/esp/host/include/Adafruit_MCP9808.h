@@ -0,0 +1,22 @@
+/*
+ * Host build : the MCP9808 answers on 0x18, and reads ADC channel 0x18 in 1/100 °C.
+ */
+#ifndef	_HOST_ADAFRUIT_MCP9808_H_
+#define	_HOST_ADAFRUIT_MCP9808_H_
+
+#include "Host.h"
+
+class Adafruit_MCP9808 {
+public:
+  Adafruit_MCP9808() : addr(0) {}
+  bool begin(int a) { addr = a; return a == 0x18; }
+  void setResolution(int r) {}
+  void wake() {}
+  void shutdown() {}
+  float readTempC() { return HostAdcRead(addr) / 100.0; }
+
+private:
+  int	addr;
+};
+
+#endif	/* _HOST_ADAFRUIT_MCP9808_H_ */
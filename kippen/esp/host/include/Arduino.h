@@ -0,0 +1,93 @@
+/*
+ * Host build : the part of the ESP32 Arduino core that the kippen code uses.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_HOST_ARDUINO_H_
+#define	_HOST_ARDUINO_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "lwip/ip_addr.h"
+#include <netinet/in.h>			// The Arduino core pulls in the lwip sockets
+
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define	LOW		0
+#define	HIGH		1
+#define	INPUT		0x01
+#define	OUTPUT		0x02
+#define	INPUT_PULLUP	0x05
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+uint16_t analogRead(uint8_t pin);
+
+void delay(uint32_t ms);
+unsigned long millis();
+void initArduino();
+
+class String : public std::string {
+public:
+  String() {}
+  String(const char *s) : std::string(s ? s : "") {}
+  String(const std::string &s) : std::string(s) {}
+  unsigned int length() const { return size(); }
+};
+
+// Output only shows up at log level info and above
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) {}
+  size_t print(const char *s);
+  size_t print(char c);
+  size_t print(int n);
+  size_t print(double d);
+  size_t println(const char *s = "");
+  size_t println(int n);
+  size_t printf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+  uint32_t getFreeHeap();
+  void restart() { esp_restart(); }
+};
+extern EspClass ESP;
+
+#endif	/* _HOST_ARDUINO_H_ */
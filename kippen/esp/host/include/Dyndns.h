@@ -0,0 +1,12 @@
+/*
+ * Host build : no DynDNS client, CONFIG_DYNDNS_ENABLED is off.
+ */
+#ifndef	_HOST_DYNDNS_H_
+#define	_HOST_DYNDNS_H_
+
+class Dyndns {
+public:
+  bool update() { return false; }
+};
+
+#endif	/* _HOST_DYNDNS_H_ */
@@ -0,0 +1,81 @@
+/*
+ * Linux host build : the knobs that the simulator turns behind the stand-ins
+ * for ESP-IDF, FreeRTOS, Arduino and esp-mqtt.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_HOST_H_
+#define	_HOST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Fake clock, in us since boot. It only moves when the loop task blocks (vTaskDelay,
+ * ulTaskNotifyTake, delay) : the wait is skipped and the clock jumps ahead instead.
+ * Other tasks run in real time, their waits end when the clock has caught up.
+ */
+void		HostSetLoopTask();		// The calling thread is the one that runs loop()
+int64_t		HostNow();
+void		HostSetLimit(int64_t us);	// Don't jump beyond this (the next simulator event), 0 : no limit
+void		HostSetWallClock(time_t t);	// What SNTP sets the clock to
+uint64_t	HostGetWakeups();		// Number of times the loop task blocked
+
+size_t		HostHeapUsed();			// Bytes allocated by the whole process
+
+/*
+ * Fake GPIO and ADC. A hook gets asked first, it returns false to fall back on the stored value.
+ * I²C sensors read the ADC channel equal to their address.
+ */
+typedef bool (*HostInputHook)(int pin, int *value);
+void		HostGpioSetHook(HostInputHook hook);
+void		HostGpioSet(int pin, int level);
+int		HostGpioRead(int pin);
+
+void		HostAdcSetHook(HostInputHook hook);
+void		HostAdcSet(int channel, int value);
+int		HostAdcRead(int channel);
+
+// Called whenever a PWM operator changes : duty in %, 0 when driven low
+typedef void (*HostPwmHook)(int op, float duty);
+void		HostPwmSetHook(HostPwmHook hook);
+
+/*
+ * Loopback MQTT broker : esp-mqtt clients in this process connect to it.
+ * The simulator can publish, listen, and take the broker down.
+ */
+typedef void (*HostBrokerListener)(const char *topic, const char *payload, void *arg);
+void		HostBrokerUp(bool up);
+void		HostBrokerPublish(const char *topic, const char *payload);
+void		HostBrokerListen(const char *filter, HostBrokerListener fn, void *arg);
+
+struct host_broker_stats {
+  uint32_t	connects, refused;		// Client connection attempts
+  uint32_t	published, rejected;		// Publish calls by clients, while connected or not
+  uint32_t	delivered;			// Messages handed to subscribers
+};
+void		HostBrokerStats(host_broker_stats *stats);
+
+// Wi-Fi goes down or comes back, the Network stand-in tells the registered modules
+void		HostWifi(bool up);
+
+#endif	/* _HOST_H_ */
@@ -0,0 +1,13 @@
+/*
+ * Host build : I²C, the sensors on it read the fake ADC (see Host.h).
+ */
+#ifndef	_HOST_WIRE_H_
+#define	_HOST_WIRE_H_
+
+class TwoWire {
+public:
+  bool begin(int sda = -1, int scl = -1) { return true; }
+};
+extern TwoWire Wire;
+
+#endif	/* _HOST_WIRE_H_ */
@@ -0,0 +1,16 @@
+/*
+ * Host build : SNTP sets the fake clock to the simulated date, see HostSetWallClock().
+ */
+#ifndef	_HOST_SNTP_H_
+#define	_HOST_SNTP_H_
+
+#include <stdint.h>
+
+#define	SNTP_OPMODE_POLL	0
+
+void sntp_setoperatingmode(uint8_t mode);
+void sntp_setservername(uint8_t idx, char *server);
+void sntp_init();
+void sntp_stop();
+
+#endif	/* _HOST_SNTP_H_ */
@@ -0,0 +1,33 @@
+/*
+ * Host build : motor control PWM, changes go to the PWM hook (see Host.h).
+ */
+#ifndef	_HOST_DRIVER_MCPWM_H_
+#define	_HOST_DRIVER_MCPWM_H_
+
+#include "esp_err.h"
+#include <stdint.h>
+
+typedef enum { MCPWM_UNIT_0, MCPWM_UNIT_1 } mcpwm_unit_t;
+typedef enum { MCPWM_TIMER_0, MCPWM_TIMER_1, MCPWM_TIMER_2 } mcpwm_timer_t;
+typedef enum { MCPWM_OPR_A, MCPWM_OPR_B } mcpwm_operator_t;
+typedef enum { MCPWM0A, MCPWM0B, MCPWM1A, MCPWM1B, MCPWM2A, MCPWM2B } mcpwm_io_signals_t;
+typedef enum { MCPWM_UP_COUNTER = 1, MCPWM_DOWN_COUNTER, MCPWM_UP_DOWN_COUNTER } mcpwm_counter_type_t;
+typedef enum { MCPWM_DUTY_MODE_0, MCPWM_DUTY_MODE_1 } mcpwm_duty_type_t;
+
+typedef struct {
+  uint32_t		frequency;
+  float			cmpr_a;
+  float			cmpr_b;
+  mcpwm_duty_type_t	duty_mode;
+  mcpwm_counter_type_t	counter_mode;
+} mcpwm_config_t;
+
+esp_err_t mcpwm_gpio_init(mcpwm_unit_t unit, mcpwm_io_signals_t signal, int pin);
+esp_err_t mcpwm_init(mcpwm_unit_t unit, mcpwm_timer_t timer, const mcpwm_config_t *config);
+esp_err_t mcpwm_set_duty(mcpwm_unit_t unit, mcpwm_timer_t timer, mcpwm_operator_t op, float duty);
+esp_err_t mcpwm_set_duty_type(mcpwm_unit_t unit, mcpwm_timer_t timer, mcpwm_operator_t op,
+  mcpwm_duty_type_t type);
+esp_err_t mcpwm_set_signal_low(mcpwm_unit_t unit, mcpwm_timer_t timer, mcpwm_operator_t op);
+esp_err_t mcpwm_set_signal_high(mcpwm_unit_t unit, mcpwm_timer_t timer, mcpwm_operator_t op);
+
+#endif	/* _HOST_DRIVER_MCPWM_H_ */
@@ -0,0 +1,4 @@
+/* Host build : no special memory placement */
+#define	IRAM_ATTR
+#define	DRAM_ATTR
+#define	RTC_DATA_ATTR
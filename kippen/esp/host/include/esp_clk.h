@@ -0,0 +1,9 @@
+/*
+ * Host build : the "cycle counter" counts host nanoseconds, see xtensa/hal.h.
+ */
+#ifndef	_HOST_ESP_CLK_H_
+#define	_HOST_ESP_CLK_H_
+
+int esp_clk_cpu_freq();
+
+#endif	/* _HOST_ESP_CLK_H_ */
@@ -0,0 +1,19 @@
+/*
+ * Host build : ESP-IDF error codes.
+ */
+#ifndef	_HOST_ESP_ERR_H_
+#define	_HOST_ESP_ERR_H_
+
+typedef int esp_err_t;
+
+#define	ESP_OK			0
+#define	ESP_FAIL		-1
+#define	ESP_ERR_NO_MEM		0x101
+#define	ESP_ERR_INVALID_ARG	0x102
+#define	ESP_ERR_INVALID_STATE	0x103
+#define	ESP_ERR_NOT_FOUND	0x105
+#define	ESP_ERR_TIMEOUT		0x107
+
+const char *esp_err_to_name(esp_err_t code);
+
+#endif	/* _HOST_ESP_ERR_H_ */
@@ -0,0 +1,50 @@
+/*
+ * Host build : the (legacy) system events that the Network class hands to its modules.
+ */
+#ifndef	_HOST_ESP_EVENT_H_
+#define	_HOST_ESP_EVENT_H_
+
+#include "esp_err.h"
+#include "lwip/ip_addr.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+  SYSTEM_EVENT_STA_START,
+  SYSTEM_EVENT_STA_CONNECTED,
+  SYSTEM_EVENT_STA_DISCONNECTED,
+  SYSTEM_EVENT_STA_GOT_IP,
+  SYSTEM_EVENT_STA_LOST_IP
+} system_event_id_t;
+
+typedef struct {
+  ip4_addr_t	ip, netmask, gw;
+} tcpip_adapter_ip_info_t;
+
+typedef struct {
+  tcpip_adapter_ip_info_t	ip_info;
+  bool				ip_changed;
+} system_event_sta_got_ip_t;
+
+typedef struct {
+  uint8_t	ssid[32];
+  uint8_t	ssid_len;
+  uint8_t	bssid[6];
+  uint8_t	reason;
+} system_event_sta_disconnected_t;
+
+typedef union {
+  system_event_sta_got_ip_t		got_ip;
+  system_event_sta_disconnected_t	disconnected;
+} system_event_info_t;
+
+typedef struct {
+  system_event_id_t	event_id;
+  system_event_info_t	event_info;
+} system_event_t;
+
+typedef union {
+  uint8_t	raw[128];
+} wifi_config_t;
+
+#endif	/* _HOST_ESP_EVENT_H_ */
@@ -0,0 +1,2 @@
+/* Host build */
+#include "esp_event.h"
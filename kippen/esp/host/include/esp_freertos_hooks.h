@@ -0,0 +1,13 @@
+/*
+ * Host build : idle hooks run each time the loop task has blocked.
+ */
+#ifndef	_HOST_ESP_FREERTOS_HOOKS_H_
+#define	_HOST_ESP_FREERTOS_HOOKS_H_
+
+#include "esp_err.h"
+
+typedef bool (*esp_freertos_idle_cb_t)();
+
+esp_err_t esp_register_freertos_idle_hook(esp_freertos_idle_cb_t cb);
+
+#endif	/* _HOST_ESP_FREERTOS_HOOKS_H_ */
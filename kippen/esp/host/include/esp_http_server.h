@@ -0,0 +1,12 @@
+/*
+ * Host build : only the types, there's no web server.
+ */
+#ifndef	_HOST_ESP_HTTP_SERVER_H_
+#define	_HOST_ESP_HTTP_SERVER_H_
+
+#include "esp_err.h"
+
+typedef void	*httpd_handle_t;
+typedef struct httpd_req	httpd_req_t;
+
+#endif	/* _HOST_ESP_HTTP_SERVER_H_ */
@@ -0,0 +1,18 @@
+/*
+ * Host build : the file system is a directory.
+ */
+#ifndef	_HOST_ESP_LITTLEFS_H_
+#define	_HOST_ESP_LITTLEFS_H_
+
+#include "esp_err.h"
+#include <stdbool.h>
+
+typedef struct {
+  const char	*base_path;
+  const char	*partition_label;
+  bool		format_if_mount_failed;
+} esp_vfs_littlefs_conf_t;
+
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t *conf);
+
+#endif	/* _HOST_ESP_LITTLEFS_H_ */
@@ -0,0 +1,32 @@
+/*
+ * Host build : ESP-IDF logging, to stdout, with the fake clock as timestamp.
+ */
+#ifndef	_HOST_ESP_LOG_H_
+#define	_HOST_ESP_LOG_H_
+
+#include <stdint.h>
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+  __attribute__ ((format (printf, 3, 4)));
+uint32_t esp_log_timestamp();
+
+#define	ESP_LOG_LEVEL(level, letter, tag, format, ...) \
+  esp_log_write(level, tag, letter " (%u) %s: " format "\n", esp_log_timestamp(), tag, ##__VA_ARGS__)
+
+#define	ESP_LOGE(tag, format, ...)	ESP_LOG_LEVEL(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define	ESP_LOGW(tag, format, ...)	ESP_LOG_LEVEL(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define	ESP_LOGI(tag, format, ...)	ESP_LOG_LEVEL(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define	ESP_LOGD(tag, format, ...)	ESP_LOG_LEVEL(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define	ESP_LOGV(tag, format, ...)	ESP_LOG_LEVEL(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+#endif	/* _HOST_ESP_LOG_H_ */
@@ -0,0 +1,2 @@
+/* Host build : no OTA */
+#include "esp_err.h"
@@ -0,0 +1,24 @@
+/*
+ * Host build : power management, only needed with CONFIG_PM_ENABLE.
+ */
+#ifndef	_HOST_ESP_PM_H_
+#define	_HOST_ESP_PM_H_
+
+#include "esp_err.h"
+#include <stdbool.h>
+
+typedef enum {
+  ESP_PM_CPU_FREQ_MAX,
+  ESP_PM_APB_FREQ_MAX,
+  ESP_PM_NO_LIGHT_SLEEP
+} esp_pm_lock_type_t;
+
+typedef struct esp_pm_lock	*esp_pm_lock_handle_t;
+
+typedef struct {
+  int	max_freq_mhz;
+  int	min_freq_mhz;
+  bool	light_sleep_enable;
+} esp_pm_config_esp32_t;
+
+#endif	/* _HOST_ESP_PM_H_ */
@@ -0,0 +1,11 @@
+/*
+ * Host build : light sleep is what the loop task does when it blocks.
+ */
+#ifndef	_HOST_ESP_SLEEP_H_
+#define	_HOST_ESP_SLEEP_H_
+
+#include "esp_err.h"
+
+esp_err_t esp_sleep_enable_gpio_wakeup();
+
+#endif	/* _HOST_ESP_SLEEP_H_ */
@@ -0,0 +1,29 @@
+/*
+ * Host build : ESP-IDF system calls.
+ */
+#ifndef	_HOST_ESP_SYSTEM_H_
+#define	_HOST_ESP_SYSTEM_H_
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stdint.h>
+
+#define	CHIP_FEATURE_EMB_FLASH	(1 << 0)
+#define	CHIP_FEATURE_WIFI_BGN	(1 << 1)
+#define	CHIP_FEATURE_BLE	(1 << 4)
+#define	CHIP_FEATURE_BT		(1 << 5)
+
+typedef struct {
+  int		model;
+  uint32_t	features;
+  uint8_t	cores;
+  uint8_t	revision;
+} esp_chip_info_t;
+
+void esp_chip_info(esp_chip_info_t *info);
+const char *esp_get_idf_version();
+uint32_t esp_random();
+uint32_t esp_get_free_heap_size();
+void esp_restart() __attribute__ ((noreturn));
+
+#endif	/* _HOST_ESP_SYSTEM_H_ */
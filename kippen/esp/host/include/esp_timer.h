@@ -0,0 +1,11 @@
+/*
+ * Host build : time since boot comes from the fake clock.
+ */
+#ifndef	_HOST_ESP_TIMER_H_
+#define	_HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
+
+#endif	/* _HOST_ESP_TIMER_H_ */
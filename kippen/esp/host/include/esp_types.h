@@ -0,0 +1,3 @@
+/* Host build */
+#include <stdint.h>
+#include <stdbool.h>
@@ -0,0 +1,17 @@
+/*
+ * Host build : Wi-Fi, see HostWifi() for connects and disconnects.
+ */
+#ifndef	_HOST_ESP_WIFI_H_
+#define	_HOST_ESP_WIFI_H_
+
+#include "esp_event.h"
+
+typedef enum {
+  WIFI_PS_NONE,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type);
+
+#endif	/* _HOST_ESP_WIFI_H_ */
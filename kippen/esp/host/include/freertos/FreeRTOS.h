@@ -0,0 +1,44 @@
+/*
+ * Host build : FreeRTOS types and port macros, tasks are threads (see Freertos.cpp).
+ */
+#ifndef	_HOST_FREERTOS_H_
+#define	_HOST_FREERTOS_H_
+
+#include "sdkconfig.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef int		BaseType_t;
+typedef unsigned int	UBaseType_t;
+typedef uint32_t	TickType_t;
+
+#define	pdFALSE			0
+#define	pdTRUE			1
+#define	pdFAIL			pdFALSE
+#define	pdPASS			pdTRUE
+
+#define	configTICK_RATE_HZ	1000
+#define	portTICK_PERIOD_MS	(1000 / configTICK_RATE_HZ)
+#define	portTICK_RATE_MS	portTICK_PERIOD_MS
+#define	portMAX_DELAY		((TickType_t)0xffffffffUL)
+#define	pdMS_TO_TICKS(ms)	((TickType_t)(ms) * configTICK_RATE_HZ / 1000)
+#define	portPRIVILEGE_BIT	((UBaseType_t)0)
+
+// Critical sections are only there to keep tasks apart, a (recursive, like on the ESP32) mutex does that
+typedef struct {
+  pthread_mutex_t	mutex;
+} portMUX_TYPE;
+
+#define	portMUX_INITIALIZER_UNLOCKED	{ PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP }
+
+void vPortCPUInitializeMutex(portMUX_TYPE *mux);
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+
+#define	portENTER_CRITICAL(mux)		vPortEnterCritical(mux)
+#define	portEXIT_CRITICAL(mux)		vPortExitCritical(mux)
+#define	portENTER_CRITICAL_ISR(mux)	vPortEnterCritical(mux)
+#define	portEXIT_CRITICAL_ISR(mux)	vPortExitCritical(mux)
+
+#endif	/* _HOST_FREERTOS_H_ */
@@ -0,0 +1,27 @@
+/*
+ * Host build : FreeRTOS tasks and direct to task notifications.
+ */
+#ifndef	_HOST_FREERTOS_TASK_H_
+#define	_HOST_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+#include <sched.h>
+
+typedef struct host_task	*TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+  UBaseType_t prio, TaskHandle_t *handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+  UBaseType_t prio, TaskHandle_t *handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+TickType_t xTaskGetTickCount();
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+#define	taskYIELD()		sched_yield()
+
+#endif	/* _HOST_FREERTOS_TASK_H_ */
@@ -0,0 +1,12 @@
+/*
+ * Host build : ARP table size, for the Secure class layout.
+ */
+#ifndef	_HOST_LWIP_ETHARP_H_
+#define	_HOST_LWIP_ETHARP_H_
+
+#include "lwip/ip_addr.h"
+#include <netinet/in.h>
+
+#define	ARP_TABLE_SIZE		10
+
+#endif	/* _HOST_LWIP_ETHARP_H_ */
@@ -0,0 +1,36 @@
+/*
+ * Host build : the lwIP address types used by the event and mDNS structures.
+ */
+#ifndef	_HOST_LWIP_IP_ADDR_H_
+#define	_HOST_LWIP_IP_ADDR_H_
+
+#include <stdint.h>
+
+typedef struct ip4_addr {
+  uint32_t	addr;				// Network byte order
+} ip4_addr_t;
+
+typedef struct ip6_addr {
+  uint32_t	addr[4];
+} ip6_addr_t;
+
+#define	IPADDR_TYPE_V4		0
+#define	IPADDR_TYPE_V6		6
+
+typedef struct {
+  union {
+    ip6_addr_t	ip6;
+    ip4_addr_t	ip4;
+  } u_addr;
+  uint8_t	type;
+} ip_addr_t;
+
+#define	IPSTR			"%d.%d.%d.%d"
+#define	IP2STR(ipaddr)		(int)((ipaddr)->addr & 0xff), (int)(((ipaddr)->addr >> 8) & 0xff), \
+				(int)(((ipaddr)->addr >> 16) & 0xff), (int)(((ipaddr)->addr >> 24) & 0xff)
+#define	IPV6STR			"%08x:%08x:%08x:%08x"
+#define	IPV62STR(ipaddr)	(ipaddr).addr[0], (ipaddr).addr[1], (ipaddr).addr[2], (ipaddr).addr[3]
+
+char *ip4addr_ntoa(const ip4_addr_t *addr);
+
+#endif	/* _HOST_LWIP_IP_ADDR_H_ */
@@ -0,0 +1,16 @@
+/*
+ * Host build : there's no TLS server, only the mbedTLS types that the Secure class
+ * keeps as members. MBEDTLS_SSL_CACHE_C and the ticket options are left undefined.
+ */
+#ifndef	_HOST_MBEDTLS_SSL_H_
+#define	_HOST_MBEDTLS_SSL_H_
+
+typedef struct { int fd; }		mbedtls_net_context;
+typedef struct { void *p; }		mbedtls_ssl_context;
+typedef struct { void *p; }		mbedtls_ssl_config;
+typedef struct { void *p; }		mbedtls_entropy_context;
+typedef struct { void *p; }		mbedtls_ctr_drbg_context;
+typedef struct { void *p; }		mbedtls_x509_crt;
+typedef struct { void *p; }		mbedtls_pk_context;
+
+#endif	/* _HOST_MBEDTLS_SSL_H_ */
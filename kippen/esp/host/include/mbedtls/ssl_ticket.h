@@ -0,0 +1,2 @@
+/* Host build : see mbedtls/ssl.h */
+#include "mbedtls/ssl.h"
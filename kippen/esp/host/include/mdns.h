@@ -0,0 +1,42 @@
+/*
+ * Host build : mDNS queries never find anything.
+ */
+#ifndef	_HOST_MDNS_H_
+#define	_HOST_MDNS_H_
+
+#include "esp_err.h"
+#include "lwip/ip_addr.h"
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum { TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_IF_AP, TCPIP_ADAPTER_IF_ETH } tcpip_adapter_if_t;
+typedef enum { MDNS_IP_PROTOCOL_V4, MDNS_IP_PROTOCOL_V6 } mdns_ip_protocol_t;
+
+typedef struct {
+  const char	*key;
+  const char	*value;
+} mdns_txt_item_t;
+
+typedef struct mdns_ip_addr_s {
+  ip_addr_t			addr;
+  struct mdns_ip_addr_s		*next;
+} mdns_ip_addr_t;
+
+typedef struct mdns_result_s {
+  struct mdns_result_s		*next;
+  tcpip_adapter_if_t		tcpip_if;
+  mdns_ip_protocol_t		ip_protocol;
+  char				*instance_name;
+  char				*hostname;
+  uint16_t			port;
+  mdns_txt_item_t		*txt;
+  size_t			txt_count;
+  mdns_ip_addr_t		*addr;
+} mdns_result_t;
+
+esp_err_t mdns_query_ptr(const char *service, const char *proto, uint32_t timeout, size_t max,
+  mdns_result_t **results);
+esp_err_t mdns_query_a(const char *host, uint32_t timeout, ip4_addr_t *addr);
+void mdns_query_results_free(mdns_result_t *results);
+
+#endif	/* _HOST_MDNS_H_ */
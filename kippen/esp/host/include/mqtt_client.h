@@ -0,0 +1,64 @@
+/*
+ * Host build : the esp-mqtt client API (as in ESP-IDF v3.3), on top of the loopback broker
+ * in MqttBroker.cpp. Events are delivered from a separate task per client, like the real one.
+ */
+#ifndef	_HOST_MQTT_CLIENT_H_
+#define	_HOST_MQTT_CLIENT_H_
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct esp_mqtt_client	*esp_mqtt_client_handle_t;
+
+typedef enum {
+  MQTT_EVENT_ERROR = 0,
+  MQTT_EVENT_CONNECTED,
+  MQTT_EVENT_DISCONNECTED,
+  MQTT_EVENT_SUBSCRIBED,
+  MQTT_EVENT_UNSUBSCRIBED,
+  MQTT_EVENT_PUBLISHED,
+  MQTT_EVENT_DATA,
+  MQTT_EVENT_BEFORE_CONNECT
+} esp_mqtt_event_id_t;
+
+typedef struct {
+  esp_mqtt_event_id_t		event_id;
+  esp_mqtt_client_handle_t	client;
+  void				*user_context;
+  char				*data;
+  int				data_len;
+  int				total_data_len;
+  int				current_data_offset;
+  char				*topic;
+  int				topic_len;
+  int				msg_id;
+  int				session_present;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t	*esp_mqtt_event_handle_t;
+typedef esp_err_t (*mqtt_event_callback_t)(esp_mqtt_event_handle_t event);
+
+typedef struct {
+  mqtt_event_callback_t	event_handle;
+  const char		*host;
+  const char		*uri;
+  uint32_t		port;
+  const char		*client_id;
+  const char		*username;
+  const char		*password;
+  int			keepalive;
+  bool			disable_auto_reconnect;
+  void			*user_context;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos);
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data,
+  int len, int qos, int retain);
+
+#endif	/* _HOST_MQTT_CLIENT_H_ */
@@ -0,0 +1,42 @@
+/*
+ * Configuration for the Linux host build, in place of the one generated by menuconfig.
+ * The pin numbers are those of the PCB, they select the fake sensors and motor.
+ */
+#ifndef	_HOST_SDKCONFIG_H_
+#define	_HOST_SDKCONFIG_H_
+
+#define	CONFIG_TIMEZONE			"CET-1CEST,M3.5.0/2,M10.5.0/3"
+
+#define	CONFIG_USE_LITTLEFS		1
+#ifndef	CONFIG_FS_BASEDIR
+#define	CONFIG_FS_BASEDIR		"fs"		// Relative to the current directory
+#endif
+
+#define	CONFIG_WEBSERVER_PORT		80
+#define	CONFIG_FTP_USER			"kippen"
+#define	CONFIG_JSON_SERVERPORT		0		// No TLS server, so no ACME either
+
+#define	CONFIG_I2C_SDA_PIN		26
+#define	CONFIG_I2C_SCL_PIN		27
+
+#define	CONFIG_SENSOR_DOWN_PIN		32
+#define	CONFIG_SENSOR_UP_PIN		33
+
+#define	CONFIG_L298_CHANNEL_A_SPEED_PIN	17
+#define	CONFIG_L298_CHANNEL_A_DIR1_PIN	16
+#define	CONFIG_L298_CHANNEL_A_DIR2_PIN	23
+#define	CONFIG_L298_CHANNEL_B_SPEED_PIN	-1
+#define	CONFIG_L298_CHANNEL_B_DIR1_PIN	-1
+#define	CONFIG_L298_CHANNEL_B_DIR2_PIN	-1
+
+#define	CONFIG_HATCH_SCHEDULE		"07:00,1,21:30,-1"
+#define	CONFIG_HATCH_MAXTIME		60
+
+#define	CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ	240
+
+/*
+ * No CONFIG_PM_ENABLE : the profiler then reads the cycle counter,
+ * which the host build maps onto the real clock, so it measures host loop cost.
+ */
+
+#endif	/* _HOST_SDKCONFIG_H_ */
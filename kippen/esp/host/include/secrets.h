@@ -0,0 +1,7 @@
+/*
+ * Host build : everything stays on this machine, MQTT goes to the loopback broker.
+ */
+#define	NTP_SERVER_0	"pool.ntp.org"
+#define	NTP_SERVER_1	"1.pool.ntp.org"
+
+#define	MQTT_URI	"mqtt://loopback"
@@ -0,0 +1,12 @@
+/*
+ * Host build : the cycle counter runs on the real clock, in nanoseconds, so the
+ * profiler measures what the code costs on this machine.
+ */
+#ifndef	_HOST_XTENSA_HAL_H_
+#define	_HOST_XTENSA_HAL_H_
+
+#include <stdint.h>
+
+uint32_t xthal_get_ccount();
+
+#endif	/* _HOST_XTENSA_HAL_H_ */
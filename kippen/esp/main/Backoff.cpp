@@ -0,0 +1,175 @@
+/*
+ * Reconnection backoff : wait longer after each consecutive failure, with random jitter
+ * so a group of nodes doesn't retry in lockstep, and keep statistics per cause.
+ *
+ * The delay after n consecutive failures is picked at random between half and all of
+ * base * 2^(n-1), capped. More failures reported while already waiting only get counted,
+ * they don't push the next attempt further away.
+ *
+ * Whoever starts a connection attempt calls Attempt(), whether it came from Due() or not,
+ * so the success rate covers all of them.
+ *
+ * Failures typically get reported from an event handler task, and Due() is polled from
+ * the main loop, so the state is protected by a spinlock.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Backoff.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <stdio.h>
+#include <string.h>
+
+Backoff::Backoff(const char *name, int base, int cap) {
+  this->name = name;
+  this->base = base;
+  this->cap = cap;
+
+  state = BO_IDLE;
+  failures = 0;
+  next = 0;
+  attempts = successes = 0;
+  ncauses = 0;
+  other = 0;
+  memset(causes, 0, sizeof(causes));
+  vPortCPUInitializeMutex(&mux);
+}
+
+Backoff::~Backoff() {
+}
+
+int64_t Backoff::Now() {
+  return esp_timer_get_time() / 1000;
+}
+
+void Backoff::Failure(int cause) {
+  int delay = 0;
+
+  portENTER_CRITICAL(&mux);
+  int i;
+  for (i=0; i<ncauses; i++)
+    if (causes[i].cause == cause)
+      break;
+  if (i == ncauses && ncauses < max_causes)
+    causes[ncauses++].cause = cause;
+  if (i < ncauses)
+    causes[i].count++;
+  else
+    other++;
+
+  if (state != BO_WAITING) {
+    failures++;
+
+    int d = base;
+    for (int n=1; n<failures && d < cap; n++)
+      d *= 2;
+    if (d > cap)
+      d = cap;
+
+    delay = d / 2 + esp_random() % (d / 2 + 1);
+    next = Now() + delay;
+    state = BO_WAITING;
+  }
+  portEXIT_CRITICAL(&mux);
+
+  if (delay)
+    ESP_LOGI(backoff_tag, "%s : failure %d (cause %d), next attempt in %d ms",
+      name, failures, cause, delay);
+}
+
+void Backoff::Success() {
+  portENTER_CRITICAL(&mux);
+  if (state == BO_TRYING)
+    successes++;
+  state = BO_IDLE;
+  failures = 0;
+  portEXIT_CRITICAL(&mux);
+}
+
+void Backoff::Attempt() {
+  portENTER_CRITICAL(&mux);
+  state = BO_TRYING;
+  attempts++;
+  portEXIT_CRITICAL(&mux);
+}
+
+bool Backoff::Due() {
+  bool due = false;
+
+  portENTER_CRITICAL(&mux);
+  if (state == BO_WAITING && Now() >= next) {
+    state = BO_IDLE;
+    due = true;
+  }
+  portEXIT_CRITICAL(&mux);
+
+  return due;
+}
+
+/*
+ * Something changed (e.g. the network came back), so don't wait for the delay to pass.
+ * The consecutive failure count is kept, an attempt in progress is left alone.
+ */
+void Backoff::Retry() {
+  portENTER_CRITICAL(&mux);
+  if (state != BO_TRYING) {
+    state = BO_WAITING;
+    next = Now();
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+bool Backoff::isWaiting() {
+  return state == BO_WAITING;
+}
+
+int Backoff::getFailures() {
+  return failures;
+}
+
+/*
+ * One line : attempts, success rate, current state, and failures per cause.
+ */
+int Backoff::Format(char *buf, int len, const char *(*cause2string)(int)) {
+  portENTER_CRITICAL(&mux);
+  uint32_t a = attempts, s = successes, o = other;
+  int f = failures, nc = ncauses;
+  int64_t wait = (state == BO_WAITING) ? next - Now() : -1;
+  struct { int cause; uint32_t count; } c[max_causes];
+  for (int i=0; i<nc; i++) {
+    c[i].cause = causes[i].cause;
+    c[i].count = causes[i].count;
+  }
+  portEXIT_CRITICAL(&mux);
+
+  int n = snprintf(buf, len, "%s : %u attempts, %u ok (%u%%), %d failing",
+    name, (unsigned)a, (unsigned)s, a ? (unsigned)(s * 100 / a) : 0, f);
+  if (wait >= 0 && n < len)
+    n += snprintf(buf + n, len - n, ", retry in %d s", (int)(wait / 1000));
+
+  for (int i=0; i<nc && n < len; i++)
+    n += snprintf(buf + n, len - n, "%s %s %u", i ? "," : ", causes",
+      cause2string ? cause2string(c[i].cause) : "?", (unsigned)c[i].count);
+  if (o && n < len)
+    n += snprintf(buf + n, len - n, ", other %u", (unsigned)o);
+  return n;
+}
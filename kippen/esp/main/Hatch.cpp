@@ -33,11 +33,12 @@ Hatch::Hatch() {
   _position = 0;	// Don't know
   maxtime = starttime = 0;
   initialized = false;
+  next_ts = 0;
+  next_ix = -1;
 
   motor = 0;
 }
 
-#if 0
 Hatch::Hatch(char *desc) {
   items = NULL;
   nitems = 0;
@@ -46,6 +47,8 @@ Hatch::Hatch(char *desc) {
   maxtime = starttime = 0;
   motor = 0;
   initialized = false;
+  next_ts = 0;
+  next_ix = -1;
   setSchedule(desc);
 }
 
@@ -105,7 +108,7 @@ bool Hatch::RunTooLong(time_t ts) {
 }
 
 int Hatch::loop(time_t now) {
-  char *msg;
+  const char *msg;
   initialPosition();
 
   // Stop if running for too long
@@ -146,36 +149,74 @@ int Hatch::loop(time_t now) {
     return _moving;
   }
 
-  // Don't activate the hatch after a couple of seconds
-  if (sec > 2)
+  /*
+   * We're not moving. Only look at the schedule when the next transition is due,
+   * so a slow iteration doesn't make us miss it, and an idle loop costs next to nothing.
+   */
+  if (next_ts == 0)
+    ComputeNextTransition(now);
+  if (next_ts == 0 || now < next_ts)
     return _moving;
 
-  // sprintf(reply, "Loop %02d:%02d", hr, mn); Serial.print(reply);
-  // Serial.print(" "); Serial.print(nitems);
-  // for (int i=0; i<10; i++) Serial.print('');
+  int ix = next_ix;
+  time_t late = now - next_ts;
+  ComputeNextTransition(now + 1);
 
-  // We're not moving. Check against the schedule
-  for (int i=0; i<nitems; i++) {
-    if (items[i].hour == hr && items[i].minute == mn) {
-      switch (items[i].state) {
-      case -1:
-	// Serial.print(__LINE__); Serial.print(" Down()");
-        Down(hr, mn, sec);
-	SetStartTime(hr, mn, sec);
-	return _moving;
-      case +1:
-	// Serial.print(__LINE__); Serial.print(" Up()");
-        Up(hr, mn, sec);
-	SetStartTime(hr, mn, sec);
-        return _moving;
-      default:
-        ; // No action
-      }
-      return _moving;
-    }
+  // Don't act on a stale transition, e.g. when the clock just got set
+  if (late > 60)
+    return _moving;
+
+  switch (items[ix].state) {
+  case -1:
+    Down(now);
+    SetStartTime(now);
+    break;
+  case +1:
+    Up(now);
+    SetStartTime(now);
+    break;
+  default:
+    ; // No action
   }
   return _moving;
 }
+
+/*
+ * Find the first schedule entry at or after ts, and remember when it is due.
+ * The items are sorted on time of day, so this is a binary search.
+ * Computed as a time_t (via mktime) so DST changes are handled by the C library.
+ */
+void Hatch::ComputeNextTransition(time_t ts) {
+  next_ts = 0;
+  next_ix = -1;
+
+  if (ts < 1000 || nitems == 0)		// No valid time yet
+    return;
+
+  struct tm t = *localtime(&ts);
+  // If this minute has already started, its entries are in the past
+  int ix = ItemFrom(items, nitems, t.tm_hour * 60 + t.tm_min + (t.tm_sec > 0 ? 1 : 0));
+  if (ix == nitems) {			// Nothing left today, so the first entry tomorrow
+    ix = 0;
+    t.tm_mday++;
+  }
+
+  t.tm_hour = items[ix].hour;
+  t.tm_min = items[ix].minute;
+  t.tm_sec = 0;
+  t.tm_isdst = -1;
+
+  next_ts = mktime(&t);
+  next_ix = ix;
+}
+
+/*
+ * Allow the caller to sleep until this time (0 means nothing is scheduled)
+ */
+time_t Hatch::getNextTransition() {
+  return next_ts;
+}
+
 #if 0
 int Hatch::loop(int hr, int mn, int sec) {
   char *msg;
@@ -284,13 +325,18 @@ void Hatch::setSchedule(const char *desc) {
     items[i].state = val;
   }
 
+  // Sort on time of day, the next transition is recomputed on the next loop()
+  ItemSort(items, nitems);
+  next_ts = 0;
+  next_ix = -1;
+
   // PrintSchedule();
 }
 
 char *Hatch::getSchedule() {
   int len = 0,
       max = 24;	// initial size, good for 2 entries, increases if necessary
-  char *r = (char *)malloc(max), s[10];
+  char *r = (char *)malloc(max), s[24];
 
   r[0] = '\0';
   for (int i=0; i<nitems; i++) {
@@ -329,18 +375,13 @@ int Hatch::moving() {
   return _moving;
 }
 
-void Hatch::Up(time_t ts, char *msg) {
-  int hr, min, sec;
-  hr = hour(ts); min = minute(ts); sec = second(ts);
-  Up(hr, min, sec, msg);
-}
-
-void Hatch::Up(int hr, int mn, int sec, char *msg) {
+void Hatch::Up(time_t ts, const char *msg) {
   char b[40];
-  sprintf(b, "Hatch moving up %02d:%02d:%02d\n", hr, mn, sec);
+  struct tm *tmp = localtime(&ts);
+  sprintf(b, "Hatch moving up %02d:%02d:%02d\n", tmp->tm_hour, tmp->tm_min, tmp->tm_sec);
   Serial.print(b);
 
-  SetStartTime(hr, mn, sec);
+  SetStartTime(ts);
 
   if (_position == 1)
     return;
@@ -351,20 +392,15 @@ void Hatch::Up(int hr, int mn, int sec, char *msg) {
   // ts->changeState(hr, mn, sec, _moving, _position, msg);
 }
 
-void Hatch::Down(time_t ts, char *msg) {
-  int hr, min, sec;
-  hr = hour(ts); min = minute(ts); sec = second(ts);
-  Down(hr, min, sec, msg);
-}
-
-void Hatch::Down(int hr, int mn, int sec, char *msg) {
+void Hatch::Down(time_t ts, const char *msg) {
   char b[40];
-  sprintf(b, "Hatch moving down %02d:%02d:%02d ", hr, mn, sec);
+  struct tm *tmp = localtime(&ts);
+  sprintf(b, "Hatch moving down %02d:%02d:%02d ", tmp->tm_hour, tmp->tm_min, tmp->tm_sec);
   Serial.print(b);
   if (msg) Serial.print(msg);
   Serial.println();
 
-  SetStartTime(hr, mn, sec);
+  SetStartTime(ts);
 
   if (_position == -1) {
     Serial.println("Hatch::Down position already -1");
@@ -379,14 +415,15 @@ void Hatch::Down(int hr, int mn, int sec, char *msg) {
   // ts->changeState(hr, mn, sec, _moving, _position, msg);
 }
 
-void Hatch::Stop(int hr, int mn, int sec, char *msg) {
+void Hatch::Stop(time_t ts, const char *msg) {
   if (_moving == 0)
     return;
 
   char b[40];
+  struct tm *tmp = localtime(&ts);
   Serial.print("Hatch stopped (");
   if (msg) Serial.print(msg);
-  sprintf(b, ") %02d:%02d:%02d\n", hr, mn, sec);
+  sprintf(b, ") %02d:%02d:%02d\n", tmp->tm_hour, tmp->tm_min, tmp->tm_sec);
   Serial.println(b);
 
   motor->run(RELEASE);
@@ -433,8 +470,8 @@ void Hatch::initialPosition() {
 
   // Serial.print("Hatch initial position");
 
-  time_t nowts = now();
 #if 0
+  time_t nowts = now();
   enum lightState sun = sunset->loop(nowts);
 
   switch (sun) {
@@ -453,7 +490,6 @@ void Hatch::initialPosition() {
     break;
   }
 #else
-  #warning "no init based on time"
+  // No init based on time : the schedule moves the hatch at the next transition
 #endif
 }
-#endif
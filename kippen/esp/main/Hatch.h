@@ -31,7 +31,7 @@ public:
   Hatch();
   Hatch(char *);
   ~Hatch();
-  int loop(int, int, int);
+  int loop(time_t);
   void setSchedule(const char *);
   char *getSchedule();		// Caller must free result
   void set(int);
@@ -43,15 +43,17 @@ public:
   int getMaxTime();
 
   // void Up(int hr, int mn, int sec, char *msg = NULL);
-  void Up(time_t, char *msg = NULL);
+  void Up(time_t, const char *msg = NULL);
   // void Down(int hr, int mn, int sec, char *msg = NULL);
-  void Down(time_t, char *msg = NULL);
+  void Down(time_t, const char *msg = NULL);
   // void Stop(int hr, int mn, int sec, char *msg = NULL);
+  void Stop(time_t, const char *msg = NULL);
   void reset();
 
   void IsUp(char *);
   void IsDown(char *);
   int getPosition();
+  time_t getNextTransition();
 
 private:
   int nitems;
@@ -73,5 +75,12 @@ private:
   // after everything is initialized
   void initialPosition();
   bool initialized;
+
+  // Next scheduled transition, recomputed only when the schedule changes or after it fired
+  time_t next_ts;
+  int next_ix;
+  void ComputeNextTransition(time_t);
 };
+
+extern Hatch *hatch;
 #endif
@@ -32,9 +32,15 @@
 #include "Temperature.h"
 #include "SimpleL298.h"
 #include "Sunset.h"
+#include "Hatch.h"
 #include "mdns.h"
 #include "PcpClient.h"
 #include "WebServer.h"
+#include "TopicTrie.h"
+#include "OfflineLog.h"
+#include "Profiler.h"
+#include "Scheduler.h"
+#include "PowerManager.h"
 
 #include <esp_littlefs.h>
 
@@ -50,14 +56,23 @@ Secure		*security = 0;
 Acme		*acme = 0;
 Dyndns		*dyndns = 0;
 Temperature	*temperature = 0;
-SimpleL298	*simple = 0;
 Sunset		*sunset = 0;
+Hatch		*hatch = 0;
 PcpClient	*pcp = 0;
 WebServer	*ws = 0;
+TopicTrie	*topics = 0;
+OfflineLog	*offlog = 0;
+Profiler	*profiler = 0;
+Scheduler	*scheduler = 0;
+PowerManager	*power = 0;
 
 time_t		dyndns_last = 0;
 bool		ftp_started = false;
 
+// Jobs that get woken up from elsewhere
+static int	job_offlog = -1;
+static int	job_mqtt = -1;
+
 // Initial function
 void setup(void) {
   Serial.begin(115200);
@@ -66,6 +81,9 @@ void setup(void) {
 
   kippen = new Kippen();
 
+  // Light sleep between jobs, in this task so the idle hook runs on our core
+  power->Configure();
+
   ESP_LOGI(kippen_tag, "Controller (c) 2017, 2018, 2019, 2020 by Danny Backx");
 
   extern const char *build;
@@ -117,6 +135,9 @@ void setup(void) {
       ESP_LOGE(kippen_tag, "Failed to register LittleFS %s (%d)", esp_err_to_name(err), err);
     } else {
       ESP_LOGI(kippen_tag, "Registered LittleFS %s", CONFIG_FS_BASEDIR);
+
+      // Keep reports made while MQTT is down
+      offlog = new OfflineLog(CONFIG_FS_BASEDIR);
     }
 #else
     ESP_LOGE(kippen_tag, "No filesystem defined");
@@ -245,12 +266,17 @@ void setup(void) {
 
   network->WaitForWifi();
 
-  simple = new SimpleL298(CONFIG_L298_CHANNEL_A_DIR1_PIN,	// 16
-  			CONFIG_L298_CHANNEL_A_DIR2_PIN,		// 23
-			CONFIG_L298_CHANNEL_A_SPEED_PIN);	// 17
+  // The hatch drives the motor on L298 channel A
+  hatch = new Hatch();
+  hatch->setMotor(CONFIG_L298_CHANNEL_A_DIR1_PIN,	// 16
+  		CONFIG_L298_CHANNEL_A_DIR2_PIN,		// 23
+		CONFIG_L298_CHANNEL_A_SPEED_PIN);	// 17
+  hatch->setMaxTime(CONFIG_HATCH_MAXTIME);
+  hatch->setSchedule(CONFIG_HATCH_SCHEDULE);
 
   ws = new WebServer();
-  // sunset = new Sunset();
+  sunset = new Sunset();
+  sunset->query("50.9", "4.67");	// Calculated locally, no network needed
   pcp = new PcpClient();
 }
 
@@ -259,55 +285,137 @@ void loop() {
     kippen->loop();
 }
 
+/*
+ * Run the modules that are due, then block until the next one is.
+ * The scheduler profiles each job, see /kippen/system/stats.
+ */
 void Kippen::loop()
 {
-  struct timeval tv;
-  gettimeofday(&tv, 0);
-  kippen->nowts = tv.tv_sec;
+  nowts = getCurrentTime();
+  scheduler->RunOnce(nowts);
+}
+
+// Record boot time, start the FTP server once the clock is set
+int Kippen::jobClock(void *arg, time_t now) {
+  Kippen *k = (Kippen *)arg;
 
-  // Record boot time
-  if (kippen->boot_time == 0 && kippen->nowts > 1000) {
-    kippen->boot_time = kippen->nowts;
+  if (k->boot_time == 0 && now > 1000) {
+    k->boot_time = now;
 
     char msg[80], ts[24];
-    struct tm *tmp = localtime(&kippen->boot_time);
+    struct tm *tmp = localtime(&k->boot_time);
     strftime(ts, sizeof(ts), "%Y-%m-%d %T", tmp);
     sprintf(msg, "Kippen controller boot at %s", ts);
     ESP_LOGI(kippen_tag, "%s", msg);
 
-    if (!kippen->Report(msg)) {
+    if (!k->Report(msg)) {
       ESP_LOGE(kippen_tag, "Could not report boot time");
     }
   }
 
-  if (kippen->nowts > 1000 && ! ftp_started) {
+  if (now > 1000 && ! ftp_started) {
     extern void ftp_init();
     ftp_init();
     ftp_started = true;
   }
 
-  if (network) network->loop(kippen->nowts);
-  if (security) security->loop(kippen->nowts);
+  // Nothing left to do after that
+  return (k->boot_time != 0 && ftp_started) ? 0 : -1;
+}
+
+int Kippen::jobNetwork(void *arg, time_t now) {
+  if (network) network->loop(now);
+  return -1;
+}
+
+/*
+ * Reconnect to the broker once the backoff delay has passed.
+ * This is the only place that (re)creates the MQTT client, so it's always done from the loop task.
+ */
+int Kippen::jobMqtt(void *arg, time_t now) {
+  Kippen *k = (Kippen *)arg;
+
+  if (network && network->isConnected() && k->mqtt_backoff->Due())
+    k->mqttReconnect();
+  return -1;
+}
+
+int Kippen::jobSecurity(void *arg, time_t now) {
+  if (security) security->loop(now);
+  return -1;
+}
 
-  // Weekly DynDNS update (1w = 86400s)
-  if (dyndns && (kippen->nowts > 1000000L)) {
-    if ((dyndns_last == 0) || (((kippen->nowts - dyndns_last) / 1000000) > 86)) {
+// Weekly DynDNS update (1w = 86400s)
+int Kippen::jobDyndns(void *arg, time_t now) {
+  if (dyndns && (now > 1000000L)) {
+    if ((dyndns_last == 0) || (((now - dyndns_last) / 1000000) > 86)) {
       if (dyndns->update()) {
         ESP_LOGI(kippen_tag, "DynDNS update succeeded");
-	dyndns_last = kippen->nowts;
+	dyndns_last = now;
       } else
 	ESP_LOGE(kippen_tag, "DynDNS update failed");
     }
   }
+  return -1;
+}
 
-  // ACME : only run if not NATted
-  if (acme && ! network->NetworkIsNatted()) {
-    acme->loop(kippen->nowts);
-  }
+// ACME : only run if not NATted
+int Kippen::jobAcme(void *arg, time_t now) {
+  if (acme && ! network->NetworkIsNatted())
+    acme->loop(now);
+  return -1;
+}
 
-  // Temperature
+int Kippen::jobTemperature(void *arg, time_t now) {
   if (temperature)
-    temperature->loop(kippen->nowts);
+    temperature->loop(now);
+  return -1;
+}
+
+// Run again a minute after the next sunrise or sunset, so loop() sees it has passed
+int Kippen::jobSunset(void *arg, time_t now) {
+  if (sunset == 0)
+    return -1;
+
+  sunset->loop(now);
+  time_t next = sunset->getNextEvent(now);
+  if (next == 0 || next - now > 3600)
+    return 3600000;
+  return (next - now + 60) * 1000;
+}
+
+/*
+ * While the motor runs, watch the end-stop sensors closely. Otherwise sleep until
+ * the next scheduled transition, but look again every minute as the clock may get set.
+ * An end-stop sensor that triggers while we sleep wakes us up too.
+ */
+int Kippen::jobHatch(void *arg, time_t now) {
+  if (hatch == 0)
+    return -1;
+
+  bool moving = (hatch->loop(now) != 0);
+  power->MotorRunning(moving);
+  if (moving)
+    return hatch_poll;
+  power->ArmSensors();
+
+  time_t next = hatch->getNextTransition();
+  if (next == 0 || next <= now)
+    return -1;
+  if (next - now > 60)
+    return 60000;
+  return (next - now) * 1000;
+}
+
+// Send what was logged while offline, a few messages at a time
+int Kippen::jobOfflog(void *arg, time_t now) {
+  Kippen *k = (Kippen *)arg;
+
+  if (offlog == 0 || ! k->mqttConnected || ! offlog->Pending())
+    return 0;			// Woken up by the next MQTT connect
+
+  offlog->Replay(k->pubq, k->reply_topic);
+  return offlog_poll;
 }
 
 extern "C" {
@@ -330,15 +438,24 @@ extern "C" {
   }
 }
 
-bool Kippen::Report(const char *msg) {
-  if (mqttConnected) {
-    ESP_LOGD(kippen_tag, "MQTT report msg %s", msg);
+/*
+ * Queue a message for the reply topic, the PublishQueue task sends it when MQTT is up.
+ * Without MQTT, it goes to the OfflineLog first, jobOfflog replays that later.
+ * Pass a key for state messages : while MQTT is up, a newer one replaces a pending message
+ * with the same key. While it's down they're logged like the others, so the readings made
+ * during an outage still arrive.
+ */
+bool Kippen::Report(const char *msg, const char *key) {
+  ESP_LOGD(kippen_tag, "MQTT report msg %s", msg);
 
-    esp_mqtt_client_publish(mqtt, reply_topic, msg, 0, 0, 0);
+  // While offline, or while still replaying, go through flash to keep the order
+  if (offlog && (! mqttConnected || (key == 0 && offlog->Pending())) && offlog->Append(msg))
+    return true;
+
+  if (pubq->Publish(reply_topic, msg, 0, key))
     return true;
-  }
 
-  ESP_LOGE(kippen_tag, "Report: mqtt not connected yet (msg %s)", msg);
+  ESP_LOGE(kippen_tag, "Report: could not queue msg %s", msg);
   return false;
 }
 
@@ -355,25 +472,15 @@ esp_err_t KippenNetworkConnected(void *ctx, system_event_t *event) {
   delay(1000);
   ESP_LOGI(kippen_tag, "SNTP configured");
 
-#ifdef	DO_MQTT
-  ESP_LOGI(kippen_tag, "Initializing MQTT");
-  memset(&kippen->mqtt_config, 0, sizeof(kippen->mqtt_config));
-  kippen->mqtt_config.uri = MQTT_URI;
-  kippen->mqtt_config.event_handle = mqtt_event_handler;
-
-  // Note Tuan's MQTT component starts a separate task for event handling
-  kippen->mqtt = esp_mqtt_client_init(&kippen->mqtt_config);
-  esp_err_t err = esp_mqtt_client_start(kippen->mqtt);
+  // Only wake up the radio for DTIM beacons
+  power->NetworkUp();
 
-  if (err == ESP_OK)
-    ESP_LOGI(kippen_tag, "MQTT Client Start ok");
-  else
-    ESP_LOGE(kippen_tag, "MQTT Client Start failure : %d", err);
+#ifdef	DO_MQTT
+  // jobMqtt owns the client, have it connect without waiting for the backoff
+  kippen->mqtt_backoff->Retry();
+  scheduler->Wake(job_mqtt);
 #endif
 
-  if (sunset)
-    sunset->query("50.9", "4.67");
-
   return ESP_OK;
 }
 
@@ -391,13 +498,18 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
   case MQTT_EVENT_CONNECTED:
     ESP_LOGI(kippen_tag, "mqtt connected");
     network->mqttConnected();
+    kippen->mqtt_backoff->Success();
     kippen->mqttConnected = true;
+    kippen->pubq->Connected(true);
+    scheduler->Wake(job_offlog);
     kippen->mqttSubscribe();
     break;
   case MQTT_EVENT_DISCONNECTED:
     ESP_LOGE(kippen_tag, "mqtt disconnected");
     network->mqttDisconnected();
+    kippen->mqtt_backoff->Failure(0);		// No reason given
     kippen->mqttConnected = false;
+    kippen->pubq->Connected(false);
     break;
   case MQTT_EVENT_SUBSCRIBED:
     ESP_LOGD(kippen_tag, "mqtt subscribed");
@@ -441,16 +553,37 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
   return ESP_OK;
 }
 
+/*
+ * Start a fresh MQTT client. Its own reconnect (fixed interval) is disabled : jobMqtt
+ * calls this again when mqtt_backoff says so, with a random delay that grows with each
+ * failure, so a broker restart doesn't get all clients back at the same moment.
+ * Only call this from jobMqtt.
+ */
 void Kippen::mqttReconnect() {
   ESP_LOGI(kippen_tag, "Initializing MQTT");
+
+  pubq->setClient(0);
+  if (mqtt)
+    esp_mqtt_client_destroy(mqtt);
+
   memset(&mqtt_config, 0, sizeof(mqtt_config));
   mqtt_config.uri = MQTT_URI;
   mqtt_config.event_handle = mqtt_event_handler;
+  mqtt_config.disable_auto_reconnect = true;
+
+  // Note Tuan's MQTT component starts a separate task for event handling
+  mqtt = esp_mqtt_client_init(&mqtt_config);
+  pubq->setClient(mqtt);
 
-  esp_err_t err = esp_mqtt_client_start(mqtt);
+  mqtt_backoff->Attempt();
+  esp_err_t err = mqtt ? esp_mqtt_client_start(mqtt) : ESP_FAIL;
 
-  ESP_LOGD(kippen_tag, "MQTT Client Start : %d %s", (int)err,
-    (err == ESP_OK) ? "ok" : (err == ESP_FAIL) ? "fail" : "?");
+  if (err == ESP_OK)
+    ESP_LOGI(kippen_tag, "MQTT Client Start ok");
+  else {
+    ESP_LOGE(kippen_tag, "MQTT Client Start failure : %d", err);
+    mqtt_backoff->Failure(err);
+  }
 }
 
 /*
@@ -474,6 +607,35 @@ Kippen::Kippen() {
   mqttSubscribed = false;
   nowts = boot_time = 0;
   sntp_up = false;
+
+  // Reports get queued from the start, they go out once MQTT is connected
+  pubq = new PublishQueue();
+  mqtt_backoff = new Backoff("mqtt", 2000, 300000);
+
+  // Before anything runs from loop(). Jobs check whether their module exists yet.
+  profiler = new Profiler();
+  scheduler = new Scheduler();
+  scheduler->Register("clock", jobClock, this, 1000);
+  power = new PowerManager();
+  power->setSensorJob(scheduler->Register("hatch", jobHatch, this, 1000));
+  scheduler->Register("network", jobNetwork, this, 1000);
+  job_mqtt = scheduler->Register("mqtt", jobMqtt, this, 1000);
+  scheduler->Register("security", jobSecurity, this, 5000);
+  scheduler->Register("acme", jobAcme, this, 5000);
+  scheduler->Register("dyndns", jobDyndns, this, 60000);
+  scheduler->Register("temperature", jobTemperature, this, 60000);
+  scheduler->Register("sunset", jobSunset, this, 60000);
+  job_offlog = scheduler->Register("offlog", jobOfflog, this, 0);
+
+  // Create this early, so other modules can register their topics
+  topics = new TopicTrie();
+  topics->Register("/kippen/system/reboot", mqttSystemReboot, this);
+  topics->Register("/kippen/system/time", mqttSystemTime, this);
+  topics->Register("/kippen/system/stats", mqttSystemStats, this);
+  topics->Register("/kippen/system/power", mqttSystemPower, this);
+  topics->Register("/kippen/mdns/query", mqttMdnsQuery, this);
+  topics->Register("/kippen/network/connect", mqttNetworkConnect, this);
+  topics->Register("/kippen/network/backoff", mqttNetworkBackoff, this);
 }
 
 char *Kippen::HandleQueryAuthenticated(const char *query, const char *caller) {
@@ -486,7 +648,8 @@ static const char * ip_protocol_str[] = {"V4", "V6", "MAX"};
 static void mdns_print_results(mdns_result_t * results){
     mdns_result_t * r = results;
     mdns_ip_addr_t * a = NULL;
-    int i = 1, t;
+    int i = 1;
+    size_t t;
     while(r){
         printf("%d: Interface: %s, Type: %s\n", i++, if_str[r->tcpip_if], ip_protocol_str[r->ip_protocol]);
         if(r->instance_name){
@@ -496,7 +659,7 @@ static void mdns_print_results(mdns_result_t * results){
             printf("  SRV : %s.local:%u\n", r->hostname, r->port);
         }
         if(r->txt_count){
-            printf("  TXT : [%u] ", r->txt_count);
+            printf("  TXT : [%u] ", (unsigned)r->txt_count);
             for(t=0; t<r->txt_count; t++){
                 printf("%s=%s; ", r->txt[t].key, r->txt[t].value?r->txt[t].value:"NULL");
             }
@@ -555,71 +718,99 @@ static void query_mdns_host(const char * host_name)
     ESP_LOGI(kippen_tag, "Query A: %s.local resolved to: " IPSTR, host_name, IP2STR(&addr));
 }
 
-const char *mqtt_kippen_schedule	= "/kippen/schedule";
-const char *mqtt_kippen_system		= "/kippen/system";
-const char *mqtt_kippen_reboot		=	"/reboot";
-const char *mqtt_kippen_boot		=	"/boot";
-const char *mqtt_kippen_time		=	"/time";
-const char *mqtt_kippen_state		= "/kippen/state";
-const char *mqtt_kippen_sunset		=	"/sunset";
-const char *mqtt_kippen_temperature	=	"/temperature";
-const char *mqtt_kippen_hatch		=	"/hatch";
-const char *mqtt_kippen_mdns		= "/kippen/mdns";
-const char *mqtt_kippen_mdns_query	=	"/query";
-
+/*
+ * Topics are dispatched by the TopicTrie, modules register their own topics with it.
+ */
 void Kippen::HandleMqtt(char *topic, char *payload) {
   ESP_LOGI(kippen_tag, "HandleMQTT(%s,%s)", topic, payload);
-  if (strcasecmp(topic, mqtt_kippen_schedule) == 0) {
-    // exact match, just query
-  } else if (strncasecmp(topic, mqtt_kippen_schedule, strlen(mqtt_kippen_schedule)) == 0) {
-    // something with this as a prefix
-  } else if (strcasecmp(topic, mqtt_kippen_system) == 0) {
-    // exact match, just query
-  } else if (strncasecmp(topic, mqtt_kippen_system, strlen(mqtt_kippen_system)) == 0) {
-    // something with this as a prefix
-    const char *cmd = topic + strlen(mqtt_kippen_system);
-
-    if (strcasecmp(cmd, mqtt_kippen_boot) == 0) {
-    } else if (strcasecmp(cmd, mqtt_kippen_reboot) == 0) {
-      ESP_LOGE(kippen_tag, "Rebooting");
-      delay(100);
-      esp_restart();
-    } else if (strcasecmp(cmd, mqtt_kippen_time) == 0) {
-      time_t now = getCurrentTime();
-      struct tm *tmp = localtime(&now);
-      char ts[20];
-      strftime(ts, sizeof(ts), "%Y-%m-%d %T", tmp);
-      esp_mqtt_client_publish(mqtt, reply_topic, ts, 0, 0, 0);
-      ESP_LOGI(kippen_tag, "HandleMQTT reply {%s,%s}", reply_topic, ts);
-    } else {
-    }
-  } else if (strncasecmp(topic, mqtt_kippen_state, strlen(mqtt_kippen_state)) == 0) {
-    const char *cmd = topic + strlen(mqtt_kippen_state);
 
-    if (strcasecmp(cmd, mqtt_kippen_sunset) == 0) {
-    } else if (strcasecmp(cmd, mqtt_kippen_hatch) == 0) {
-    } else if (strcasecmp(cmd, mqtt_kippen_temperature) == 0) {
-    } else {
-    }
-  } else if (strncasecmp(topic, mqtt_kippen_mdns, strlen(mqtt_kippen_mdns)) == 0) {
-    const char *cmd = topic + strlen(mqtt_kippen_mdns);
-
-    if (strcasecmp(cmd, mqtt_kippen_mdns_query) == 0) {
-        query_mdns_host("esp32");
-        query_mdns_service("_arduino", "_tcp");
-        query_mdns_service("_http", "_tcp");
-        query_mdns_service("_printer", "_tcp");
-        query_mdns_service("_ipp", "_tcp");
-        query_mdns_service("_afpovertcp", "_tcp");
-        query_mdns_service("_smb", "_tcp");
-        query_mdns_service("_ftp", "_tcp");
-        query_mdns_service("_nfs", "_tcp");
-    // } else if (strcasecmp(cmd, mqtt_kippen_hatch) == 0) {
-    } else {
-    }
+  if (topics->Dispatch(topic, payload) == 0)
+    ESP_LOGD(kippen_tag, "HandleMQTT : no handler for %s", topic);
+}
+
+void Kippen::mqttSystemReboot(const char *topic, const char *payload, void *arg) {
+  ESP_LOGE(kippen_tag, "Rebooting");
+  delay(100);
+  esp_restart();
+}
+
+void Kippen::mqttSystemTime(const char *topic, const char *payload, void *arg) {
+  Kippen *k = (Kippen *)arg;
+
+  time_t now = k->getCurrentTime();
+  struct tm *tmp = localtime(&now);
+  char ts[20];
+  strftime(ts, sizeof(ts), "%Y-%m-%d %T", tmp);
+  k->Report(ts);
+  ESP_LOGI(kippen_tag, "HandleMQTT reply {%s,%s}", k->reply_topic, ts);
+}
+
+/*
+ * Report the loop profile, one message per module.
+ * Payload "reset" clears the statistics after reporting them.
+ */
+void Kippen::mqttSystemStats(const char *topic, const char *payload, void *arg) {
+  Kippen *k = (Kippen *)arg;
+  char line[96];
+
+  for (int i=0; i<profiler->getCount(); i++) {
+    profiler->Format(i, line, sizeof(line));
+    k->Report(line);
   }
+
+  if (strcmp(payload, "reset") == 0) {
+    profiler->Reset();
+    ESP_LOGI(kippen_tag, "Profiler statistics cleared");
+  }
+}
+
+void Kippen::mqttSystemPower(const char *topic, const char *payload, void *arg) {
+  Kippen *k = (Kippen *)arg;
+  char line[160];
+
+  power->Format(line, sizeof(line), k->getCurrentTime());
+  k->Report(line);
 }
 
+void Kippen::mqttNetworkConnect(const char *topic, const char *payload, void *arg) {
+  Kippen *k = (Kippen *)arg;
+  char line[160];
+
+  network->FormatConnectStats(line, sizeof(line));
+  k->Report(line);
+}
+
+static const char *MqttCause2String(int c) {
+  return (c == 0) ? "DISCONNECTED" : esp_err_to_name(c);
+}
+
+// Reconnect statistics, one line each for Wi-Fi and MQTT
+void Kippen::mqttNetworkBackoff(const char *topic, const char *payload, void *arg) {
+  Kippen *k = (Kippen *)arg;
+  char line[200];
+
+  network->FormatBackoff(line, sizeof(line));
+  k->Report(line);
+  k->mqtt_backoff->Format(line, sizeof(line), MqttCause2String);
+  k->Report(line);
+}
+
+void Kippen::mqttMdnsQuery(const char *topic, const char *payload, void *arg) {
+  query_mdns_host("esp32");
+  query_mdns_service("_arduino", "_tcp");
+  query_mdns_service("_http", "_tcp");
+  query_mdns_service("_printer", "_tcp");
+  query_mdns_service("_ipp", "_tcp");
+  query_mdns_service("_afpovertcp", "_tcp");
+  query_mdns_service("_smb", "_tcp");
+  query_mdns_service("_ftp", "_tcp");
+  query_mdns_service("_nfs", "_tcp");
+}
+
+/*
+ * All modules should get the time from here (or from the time_t passed to their loop()),
+ * so there's only one place where the clock is read.
+ */
 time_t Kippen::getCurrentTime() {
   struct timeval tv;
   gettimeofday(&tv, 0);
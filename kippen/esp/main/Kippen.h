@@ -29,6 +29,8 @@
 
 #include <apps/sntp/sntp.h>
 #include "mqtt_client.h"
+#include "PublishQueue.h"
+#include "Backoff.h"
 
 extern String			ips, gws;
 
@@ -53,8 +55,32 @@ private:
   friend esp_err_t KippenNetworkConnected(void *ctx, system_event_t *event);
   friend esp_err_t KippenNetworkDisconnected(void *ctx, system_event_t *event);
 
+  // MQTT topic handlers, registered with the TopicTrie
+  static void mqttSystemReboot(const char *topic, const char *payload, void *arg);
+  static void mqttSystemTime(const char *topic, const char *payload, void *arg);
+  static void mqttSystemStats(const char *topic, const char *payload, void *arg);
+  static void mqttSystemPower(const char *topic, const char *payload, void *arg);
+  static void mqttMdnsQuery(const char *topic, const char *payload, void *arg);
+  static void mqttNetworkConnect(const char *topic, const char *payload, void *arg);
+  static void mqttNetworkBackoff(const char *topic, const char *payload, void *arg);
+
+  // Jobs run from loop() by the Scheduler
+  static int jobClock(void *arg, time_t now);
+  static int jobHatch(void *arg, time_t now);
+  static int jobNetwork(void *arg, time_t now);
+  static int jobMqtt(void *arg, time_t now);
+  static int jobSecurity(void *arg, time_t now);
+  static int jobAcme(void *arg, time_t now);
+  static int jobDyndns(void *arg, time_t now);
+  static int jobTemperature(void *arg, time_t now);
+  static int jobSunset(void *arg, time_t now);
+  static int jobOfflog(void *arg, time_t now);
+
+  static const int hatch_poll = 50;	// ms between end-stop sensor checks while moving
+  static const int offlog_poll = 200;	// ms between replay batches
+
 public:
-  bool Report(const char *msg);
+  bool Report(const char *msg, const char *key = 0);
   char *HandleQueryAuthenticated(const char *query, const char *caller);
 
   Kippen();
@@ -67,6 +93,10 @@ public:
 
   boolean mqttConnected;
   time_t 	getCurrentTime();
+
+  // Public to be able to use from the MQTT event handler
+  PublishQueue		*pubq;
+  Backoff		*mqtt_backoff;
 };
 
 extern Kippen *kippen;
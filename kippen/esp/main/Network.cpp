@@ -37,21 +37,57 @@
 #include <esp_event_legacy.h>
 #include "esp_wpa2.h"
 #include "mdns.h"
+#include <stddef.h>
+#include <esp_attr.h>
+#include <esp_clk.h>
+#include <esp_timer.h>
+#include <lwip/netif.h>
+#include <lwip/dhcp.h>
 
-Network::Network() {
+/*
+ * Reconnect cache, kept in RTC memory so it survives a reboot (but not a power cycle).
+ * With the BSSID and channel of the last good access point, association needs no full scan.
+ * The lease is reused as a static address while it's certainly still valid (until half of
+ * the lease time has passed), so we don't have to wait for DHCP either.
+ */
+struct wifi_cache {
+  uint32_t			magic;
+  int				ix;			// Entry in mywifi[]
+  uint8_t			bssid[6];
+  uint8_t			channel;
+  tcpip_adapter_ip_info_t	ip_info;
+  tcpip_adapter_dns_info_t	dns;
+  uint64_t			lease_until;		// RTC time (us), 0 if no lease
+  uint32_t			sum;
+};
+
+static RTC_NOINIT_ATTR struct wifi_cache wcache;
+static const uint32_t wcache_magic = 0x57434831;
+
+static uint32_t CacheSum(const struct wifi_cache *c) {
+  const uint8_t *p = (const uint8_t *)c;
+  uint32_t sum = 0;
+  for (int i=0; i<(int)offsetof(struct wifi_cache, sum); i++)
+    sum = sum * 31 + p[i];
+  return sum;
+}
+
+Network::Network() : wifi_backoff("wifi") {
   reconnect_interval = 30;
 
+  fast = static_ip = false;
+  connect_start = 0;
+  memset(connect_hist, 0, sizeof(connect_hist));
+
   status = NS_NONE;
 
   last_mqtt_message_received = 0;
-
-  restart_time = 0;
+  mqtt_failures = 0;
 }
 
 Network::Network(const char *name,
     esp_err_t (*nc)(void *, system_event_t *),
-    esp_err_t (*nd)(void *, system_event_t *)) {
-  Network();
+    esp_err_t (*nd)(void *, system_event_t *)) : Network() {
   struct module_registration *mr = new module_registration(name, nc, nd);
   RegisterModule(mr);
 }
@@ -165,6 +201,14 @@ static const char *WifiReason2String(int r) {
   }
 }
 
+static const char *Cause2String(int c) {
+  switch (c) {
+  case NC_MQTT:					return "MQTT";
+  case NC_OTHER:				return "OTHER";
+  default:					return WifiReason2String(c);
+  }
+}
+
 esp_err_t wifi_event_handler(void *ctx, system_event_t *event) {
   ESP_LOGE(snetwork_tag, "wifi_event_handler(%d,%s)", event->event_id, EventId2String(event->event_id));
 
@@ -185,6 +229,10 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event) {
       ESP_LOGI(snetwork_tag, "SYSTEM_EVENT_STA_GOT_IP");
       ESP_LOGI(snetwork_tag, "Network connected, ip %s", ip4addr_ntoa(&event->event_info.got_ip.ip_info.ip));
 
+      // DHCP taking over from the cached lease, with the same address : nothing changes
+      if (! network->CacheSave(event))
+        break;
+
       network->setWifiOk(true);
 
   {
@@ -237,7 +285,10 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event) {
 	network->setStatus(NS_FAILED);
 	esp_wifi_stop();
 
-	switch (evp->reason) {
+	if (network->fast) {
+	  // The cached access point is gone, or moved : do a full scan, don't discard the network
+	  network->CacheDrop();
+	} else switch (evp->reason) {
 	case WIFI_REASON_NO_AP_FOUND:	// FIX ME probably more than just this case
 	case WIFI_REASON_AUTH_FAIL:
           network->setReason(evp->reason);
@@ -247,11 +298,8 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event) {
 	  break;
 	}
 
-	// Trigger next try
-	network->setStatus(NS_SETUP_DONE);
-	// esp_wifi_connect();
-	network->SetupWifi();
-        network->WaitForWifi();
+	// Trigger next try, after a delay that grows with each failure
+	network->ScheduleRestartWifi(evp->reason);
       } else {
 	/*
 	 * We were connected but lost the network. So gracefully shut down open connections,
@@ -263,7 +311,9 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event) {
 	if (acme) acme->NetworkDisconnected(ctx, event);
 	if (network) network->NetworkDisconnected(ctx, event);
 
-        network->StopWifi();			// This also schedules a restart
+	// This also schedules a restart
+        network->StopWifi((network->mqtt_failures >= Network::mqtt_escalate) ? NC_MQTT
+	  : event->event_info.disconnected.reason);
       }
       break;
 
@@ -323,8 +373,20 @@ void Network::WaitForWifi(void)
   esp_err_t err;
 
   ESP_LOGI(network_tag, "Waiting for wifi");
+
+  if (connect_start == 0)
+    connect_start = esp_timer_get_time() / 1000;
+  wifi_backoff.Attempt();
+
+  // Start with the network from the reconnect cache
+  int nwifi, first = 0;
+  for (nwifi = 0; mywifi[nwifi].ssid != 0; nwifi++) ;
+  if (CacheValid())
+    first = wcache.ix;
  
-  for (int ix = 0; mywifi[ix].ssid != 0; ix++) {
+  for (int i = 0; i < nwifi; i++) {
+    int ix = (first + i) % nwifi;
+
     if (mywifi[ix].discard) {
       ESP_LOGD(network_tag, "Discarded SSID \"%s\"", mywifi[ix].ssid);
       continue;
@@ -358,6 +420,11 @@ void Network::WaitForWifi(void)
       wifi_config.sta.bssid_set = false;
     }
 
+    // Go straight for the access point that worked last time, the failure doesn't count
+    fast = CacheConfig(ix, &wifi_config);
+    if (fast)
+      mywifi[ix].counter--;
+
     if (mywifi[ix].eap_password && strlen(mywifi[ix].eap_password) > 0) {
       /*
        * Set the Wifi to STAtion mode on the network specified by SSID (and optionally BSSID).
@@ -441,6 +508,8 @@ void Network::WaitForWifi(void)
       }
     }
 
+    CacheStaticIp();
+
     ESP_LOGI(network_tag, "Try wifi ssid [%s]", wifi_config.sta.ssid);
     err = esp_wifi_start();
     if (err != ESP_OK) {
@@ -470,9 +539,12 @@ void Network::WaitForWifi(void)
 void Network::setWifiOk(boolean ok) {
   wifi_ok = ok;
   status = NS_RUNNING;
+  mqtt_failures = 0;
+  if (ok)
+    wifi_backoff.Success();
 }
 
-void Network::StopWifi() {
+void Network::StopWifi(int cause) {
   esp_err_t err;
 
   ESP_LOGI(network_tag, "StopWifi");
@@ -490,7 +562,8 @@ void Network::StopWifi() {
     ESP_LOGE(network_tag, "%s: esp_wifi_deinit failed, reason %d (%s)", __FUNCTION__,
       err, esp_err_to_name(err));
 
-  ScheduleRestartWifi();
+  status = NS_FAILED;
+  ScheduleRestartWifi(cause);
 }
 
 /*
@@ -504,7 +577,7 @@ void Network::disconnected(const char *fn, int line) {
     if (strcmp(fn, "mqtt_event_handler") == 0) {
 #if 1
       ESP_LOGE(network_tag, "Network:disconnected (mqtt) -> ScheduleRestartWifi (%s line %d)", __FUNCTION__, __LINE__);
-      ScheduleRestartWifi();
+      ScheduleRestartWifi(NC_MQTT);
 #else
       status = NS_FAILED;
       last_connect = kippen->getCurrentTime();
@@ -542,7 +615,7 @@ void Network::disconnected(const char *fn, int line) {
   }
 #else
   ESP_LOGE(network_tag, "Network:disconnected -> ScheduleRestartWifi (%s line %d)", __FUNCTION__, __LINE__);
-  ScheduleRestartWifi();
+  ScheduleRestartWifi(NC_OTHER);
 #endif
 }
 
@@ -604,6 +677,7 @@ void Network::NetworkDisconnected(void *ctx, system_event_t *event) {
  */
 void Network::loop(time_t now) {
   LoopRestartWifi(now);
+  CacheLoop();
 }
 
 bool Network::isConnected() {
@@ -639,13 +713,19 @@ void Network::mqttDisconnected() {
     ESP_LOGE(network_tag, "MQTT disconnected");
   mqtt_message++;
 
-  // FIX ME do something
-  ESP_LOGE(network_tag, "Network:mqttDisconnected -> ScheduleRestartWifi (%s line %d)", __FUNCTION__, __LINE__);
-  ScheduleRestartWifi();
+  /*
+   * The MQTT client has its own backoff. Only when it keeps failing while Wi-Fi looks fine,
+   * assume the connection is stale : disconnect, the event handler takes it from there.
+   */
+  if (status == NS_RUNNING && ++mqtt_failures == mqtt_escalate) {
+    ESP_LOGE(network_tag, "Network:mqttDisconnected %d times -> disconnect", mqtt_failures);
+    esp_wifi_disconnect();
+  }
 }
 
 void Network::mqttConnected() {
   ESP_LOGD(network_tag, "MQTT connected");
+  mqtt_failures = 0;
 }
 
 void Network::gotMqttMessage() {
@@ -655,33 +735,16 @@ void Network::gotMqttMessage() {
 }
 
 /*
- * (delayed) Restart handler
+ * (delayed) Restart handler : wait longer after each consecutive failure, see Backoff.
+ * Called from the event handler, the restart itself happens in loop().
  */
-void Network::ScheduleRestartWifi() {
-  if (restart_time != 0) {
-    // ESP_LOGE(network_tag, "%s: restart_time already set : %ld", __FUNCTION__, restart_time);
-    return;
-  }
-
-  time_t now = kippen->getCurrentTime();
-  restart_time = now + 2;
-
-  ESP_LOGI(network_tag, "%s : set restart_time to %ld", __FUNCTION__, restart_time);
+void Network::ScheduleRestartWifi(int cause) {
+  wifi_backoff.Failure(cause);
 }
 
 void Network::LoopRestartWifi(time_t now) {
-#if 0
-  if (restart_time == 0)
-    return;
-  if (restart_time <= now) {
-    ESP_LOGE(network_tag, "LoopRestartWifi -> ScheduleRestartWifi (%s line %d)", __FUNCTION__, __LINE__);
-    ESP_LOGE(network_tag, "LoopRestartWifi restart_time %ld now %ld", restart_time, now);
+  if (wifi_backoff.Due())
     RestartWifi();
-    restart_time = 0;			// FIX ME maybe we should have a 2nd timeout to verify
-  }
-#else
-# warning "LoopRestartWifi empty"
-#endif
 }
 
 void Network::RestartWifi() {
@@ -690,6 +753,10 @@ void Network::RestartWifi() {
   esp_wifi_stop();
   SetupWifi();
   WaitForWifi();
+
+  // Nothing to wait for, so no event will get us going again
+  if (status != NS_CONNECTING)
+    ScheduleRestartWifi(NC_OTHER);
 }
 
 bool Network::NetworkIsNatted() {
@@ -744,3 +811,161 @@ void Network::RegisterModule(const char *name,
 
   RegisterModule(mr);
 }
+
+/*
+ * Reconnect cache
+ */
+bool Network::CacheValid() {
+  if (wcache.magic != wcache_magic || wcache.sum != CacheSum(&wcache))
+    return false;
+
+  // The table may have changed with a new build
+  int nwifi;
+  for (nwifi = 0; mywifi[nwifi].ssid != 0; nwifi++) ;
+  return wcache.ix >= 0 && wcache.ix < nwifi && ! mywifi[wcache.ix].discard;
+}
+
+/*
+ * Set the cached BSSID and channel for this network, unless it's configured to use another one.
+ * Returns whether the cache is used.
+ */
+bool Network::CacheConfig(int ix, wifi_config_t *config) {
+  if (! CacheValid() || wcache.ix != ix)
+    return false;
+  if (config->sta.bssid_set && memcmp(config->sta.bssid, wcache.bssid, 6) != 0)
+    return false;
+
+  memcpy(config->sta.bssid, wcache.bssid, 6);
+  config->sta.bssid_set = true;
+  config->sta.channel = wcache.channel;
+
+  ESP_LOGI(network_tag, "Reconnect cache : BSSID %02x:%02x:%02x:%02x:%02x:%02x channel %d",
+    wcache.bssid[0], wcache.bssid[1], wcache.bssid[2],
+    wcache.bssid[3], wcache.bssid[4], wcache.bssid[5], wcache.channel);
+  return true;
+}
+
+/*
+ * Before starting Wi-Fi : if we still have a valid lease, set it as a static address.
+ * With the DHCP client stopped, tcpip_adapter posts SYSTEM_EVENT_STA_GOT_IP as soon as
+ * we're associated. Otherwise, make sure DHCP runs.
+ */
+void Network::CacheStaticIp() {
+  tcpip_adapter_dhcp_status_t ds;
+
+  static_ip = false;
+
+  if (! fast || wcache.lease_until == 0 || esp_clk_rtc_time() >= wcache.lease_until) {
+    if (tcpip_adapter_dhcpc_get_status(TCPIP_ADAPTER_IF_STA, &ds) == ESP_OK
+     && ds == TCPIP_ADAPTER_DHCP_STOPPED)
+      tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+    return;
+  }
+
+  tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+  if (tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &wcache.ip_info) != ESP_OK) {
+    tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+    return;
+  }
+  tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &wcache.dns);
+
+  static_ip = true;
+  ESP_LOGI(network_tag, "Reconnect cache : using lease %s", ip4addr_ntoa(&wcache.ip_info.ip));
+}
+
+/*
+ * Got an address : remember where we are, and how long the lease is good for.
+ * Returns false if this is DHCP confirming the address we were already running on.
+ */
+bool Network::CacheSave(system_event_t *event) {
+  tcpip_adapter_ip_info_t *ip = &event->event_info.got_ip.ip_info;
+  bool same = (status == NS_RUNNING && CacheValid() && ip->ip.addr == wcache.ip_info.ip.addr);
+
+  if (status != NS_RUNNING)
+    ConnectTime(fast);
+
+  struct wifi_cache c = wcache;
+  if (! CacheValid())
+    memset(&c, 0, sizeof(c));
+
+  wifi_ap_record_t ap;
+  if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+    memcpy(c.bssid, ap.bssid, 6);
+    c.channel = ap.primary;
+  }
+  c.ix = network;
+
+  if (! static_ip) {
+    c.ip_info = *ip;
+    tcpip_adapter_get_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &c.dns);
+
+    // Trust the lease for half of its time, DHCP would renew it by then
+    struct netif *netif = 0;
+    c.lease_until = 0;
+    if (tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, (void **)&netif) == ESP_OK && netif) {
+      struct dhcp *dhcp = netif_dhcp_data(netif);
+      if (dhcp && dhcp->offered_t0_lease)
+        c.lease_until = esp_clk_rtc_time() + (uint64_t)dhcp->offered_t0_lease * 500000ULL;
+    }
+  }
+
+  c.magic = wcache_magic;
+  c.sum = CacheSum(&c);
+  wcache = c;
+
+  return ! same;
+}
+
+void Network::CacheDrop() {
+  ESP_LOGE(network_tag, "Reconnect cache : failed, next attempt does a full scan");
+  wcache.magic = 0;
+  fast = false;
+  if (static_ip) {
+    static_ip = false;
+    tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+  }
+}
+
+/*
+ * Running on the cached lease : hand over to DHCP before the lease could expire.
+ * This restarts open TCP connections once, in sessions that started from the cache.
+ */
+void Network::CacheLoop() {
+  if (! static_ip || esp_clk_rtc_time() < wcache.lease_until)
+    return;
+
+  ESP_LOGI(network_tag, "Reconnect cache : lease getting old, starting DHCP");
+  static_ip = false;
+  tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+}
+
+void Network::ConnectTime(bool fast) {
+  int64_t ms = esp_timer_get_time() / 1000 - connect_start;
+  connect_start = 0;
+
+  int b = 0;
+  for (int64_t lim = 250; ms >= lim && b < connect_buckets - 1; lim *= 2)
+    b++;
+  connect_hist[fast ? 1 : 0][b]++;
+
+  ESP_LOGI(network_tag, "Connected in %d ms (%s)", (int)ms, fast ? "cached" : "scan");
+}
+
+/*
+ * Connect time histograms, buckets are < 250 ms, < 500 ms, ... , the last one is >= 16s.
+ */
+void Network::FormatConnectStats(char *buf, int len) {
+  int n = snprintf(buf, len, "Connect times");
+  for (int f=1; f>=0 && n < len; f--) {
+    n += snprintf(buf + n, len - n, " %s", f ? "cached" : "scan");
+    for (int b=0; b<connect_buckets && n < len; b++)
+      n += snprintf(buf + n, len - n, "%c%u", b ? '/' : ' ', (unsigned)connect_hist[f][b]);
+  }
+}
+
+/*
+ * Reconnect statistics : success rate, current backoff, and why connections failed.
+ */
+void Network::FormatBackoff(char *buf, int len) {
+  wifi_backoff.Format(buf, len, Cause2String);
+}
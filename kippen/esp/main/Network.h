@@ -26,6 +26,7 @@
 #include <Arduino.h>
 #include <esp_event_loop.h>
 #include "WebServer.h"
+#include "Backoff.h"
 
 #include <list>
 using namespace std;
@@ -38,6 +39,12 @@ enum NetworkStatus {
   NS_FAILED		// We got completely disconnected
 };
 
+// Reconnect causes other than the Wi-Fi disconnect reasons
+enum {
+  NC_MQTT = -1,		// Too many MQTT failures in a row
+  NC_OTHER = -2
+};
+
 struct module_registration {
   char *module;
   esp_err_t (*NetworkConnected)(void *, system_event_t *);
@@ -89,6 +96,9 @@ public:
   void setReason(int);
   void DiscardCurrentNetwork();
 
+  void FormatConnectStats(char *buf, int len);
+  void FormatBackoff(char *buf, int len);
+
   void RegisterModule(module_registration);
   void RegisterModule(module_registration *);
   void RegisterModule(const char *,
@@ -109,15 +119,32 @@ private:
   // MQTT
   time_t			last_mqtt_message_received;
   uint				mqtt_message;
+  int				mqtt_failures;		// In a row
+  static const int		mqtt_escalate = 5;	// Then restart Wi-Fi
 
   // Restart
-  time_t			restart_time;
+  Backoff			wifi_backoff;
 
   void LoopRestartWifi(time_t now);
-  void ScheduleRestartWifi();
-  void StopWifi();
+  void ScheduleRestartWifi(int cause);
+  void StopWifi(int cause);
   void RestartWifi();
 
+  // Reconnect cache : access point, channel and lease of the last good connection
+  bool				fast;			// Current attempt uses the cache
+  bool				static_ip;		// Running on the cached lease, not on DHCP
+  int64_t			connect_start;		// ms, start of this connection attempt
+  static const int		connect_buckets = 8;	// 250 ms, doubling
+  uint32_t			connect_hist[2][connect_buckets];	// Full scan, fast
+
+  bool CacheValid();
+  bool CacheConfig(int ix, wifi_config_t *config);
+  void CacheStaticIp();
+  bool CacheSave(system_event_t *event);
+  void CacheDrop();
+  void CacheLoop();
+  void ConnectTime(bool fast);
+
   // Modules interested in network events
   list<module_registration>	modules;
   friend esp_err_t wifi_event_handler(void *ctx, system_event_t *event);
@@ -0,0 +1,250 @@
+/*
+ * Store-and-forward log : reports made while MQTT is down are appended to
+ * a small set of segment files, and replayed in order after reconnect.
+ *
+ * Each segment is a file "offline.<seq>" in the given directory, holding records of
+ * a magic byte, a 16 bit length and the message. Appends go to the newest segment,
+ * a new one is started when it is full, and when there are too many the oldest is
+ * removed. A segment is removed as soon as it has been replayed, so the flash wear
+ * is spread over the whole file system by LittleFS.
+ *
+ * The replay position is only kept in memory : after a reboot, the partially replayed
+ * segment is sent again from its start.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "OfflineLog.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+OfflineLog::OfflineLog(const char *dir, int nsegments, int segsize) {
+  this->dir = strdup(dir);
+  this->nsegments = nsegments;
+  this->segsize = segsize;
+  dropped = 0;
+  replay_ts = 0;
+  lock = xSemaphoreCreateMutex();
+
+  Scan();
+}
+
+OfflineLog::~OfflineLog() {
+  free(dir);
+  vSemaphoreDelete(lock);
+}
+
+void OfflineLog::SegmentName(char *buf, int seq) {
+  sprintf(buf, "%s/offline.%d", dir, seq);
+}
+
+void OfflineLog::Remove(int seq) {
+  char fn[64];
+  SegmentName(fn, seq);
+  unlink(fn);
+}
+
+/*
+ * Number of records in a segment from an offset on, to know what dropping it loses
+ */
+int OfflineLog::Count(int seq, long off) {
+  char fn[64];
+  SegmentName(fn, seq);
+  FILE *f = fopen(fn, "r");
+  if (f == 0)
+    return 0;
+
+  int n = 0;
+  uint8_t hdr[3];
+  if (fseek(f, off, SEEK_SET) == 0)
+    while (fread(hdr, 1, 3, f) == 3 && hdr[0] == magic
+        && fseek(f, hdr[1] | (hdr[2] << 8), SEEK_CUR) == 0)
+      n++;
+  fclose(f);
+  return n;
+}
+
+/*
+ * Find the segments left behind by a previous run.
+ * Appends always start a fresh segment, a record cut short by a reset
+ * then only ends the replay of its own segment.
+ */
+void OfflineLog::Scan() {
+  first = 1;
+  last = 0;
+  rdoff = 0;
+  wrsize = segsize;
+
+  DIR *d = opendir(dir);
+  if (d == 0) {
+    ESP_LOGE(offlog_tag, "Cannot open %s", dir);
+    return;
+  }
+
+  int lo = -1, hi = -1;
+  struct dirent *de;
+  while ((de = readdir(d)) != 0) {
+    int seq;
+    if (sscanf(de->d_name, "offline.%d", &seq) != 1 || seq <= 0)
+      continue;
+    if (lo < 0 || seq < lo)
+      lo = seq;
+    if (seq > hi)
+      hi = seq;
+  }
+  closedir(d);
+
+  if (lo > 0) {
+    first = lo;
+    last = hi;
+    ESP_LOGI(offlog_tag, "Found segments %d .. %d to replay", first, last);
+  }
+}
+
+bool OfflineLog::Pending() {
+  return first <= last;
+}
+
+int OfflineLog::getDropped() {
+  return dropped;
+}
+
+/*
+ * Add a message to the log, returns false if it can't be stored.
+ */
+bool OfflineLog::Append(const char *msg) {
+  int len = strlen(msg);
+  if (len >= maxmsg || len + 3 > segsize)
+    return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  if (wrsize + len + 3 > segsize) {
+    if (first > last)
+      first = last + 1;
+    last++;
+    wrsize = 0;
+
+    // Keep a fixed number of segments : lose the oldest
+    if (last - first + 1 > nsegments) {
+      int n = Count(first, rdoff);
+      ESP_LOGE(offlog_tag, "Log full, dropping segment %d (%d records)", first, n);
+      Remove(first);
+      first++;
+      rdoff = 0;
+      dropped += n;
+    }
+  }
+
+  char fn[64];
+  SegmentName(fn, last);
+  FILE *f = fopen(fn, "a");
+  if (f == 0) {
+    xSemaphoreGive(lock);
+    ESP_LOGE(offlog_tag, "Cannot append to %s", fn);
+    return false;
+  }
+
+  uint8_t hdr[3];
+  hdr[0] = magic;
+  hdr[1] = len & 0xFF;
+  hdr[2] = (len >> 8) & 0xFF;
+  bool ok = (fwrite(hdr, 1, 3, f) == 3) && (fwrite(msg, 1, len, f) == (size_t)len);
+  if (fclose(f) != 0)
+    ok = false;
+
+  // A short write still takes up room in the file
+  wrsize += len + 3;
+  xSemaphoreGive(lock);
+
+  if (! ok)
+    ESP_LOGE(offlog_tag, "Write to %s failed", fn);
+  return ok;
+}
+
+/*
+ * Hand a few records to the PublishQueue, at most every replay_interval ms,
+ * and only if it's not backed up. Returns the number of records passed on.
+ */
+int OfflineLog::Replay(PublishQueue *pq, const char *topic) {
+  if (! Pending())
+    return 0;
+
+  int64_t now = esp_timer_get_time() / 1000;
+  if (now - replay_ts < replay_interval)
+    return 0;
+  replay_ts = now;
+
+  if (pq->getQueued() >= replay_backlog)
+    return 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  char fn[64];
+  SegmentName(fn, first);
+  FILE *f = fopen(fn, "r");
+  if (f != 0 && fseek(f, rdoff, SEEK_SET) != 0) {
+    fclose(f);
+    f = 0;
+  }
+
+  int n = 0;
+  bool eof = (f == 0);
+  while (! eof && n < replay_batch) {
+    uint8_t hdr[3];
+    char buf[maxmsg];
+
+    if (fread(hdr, 1, 3, f) != 3 || hdr[0] != magic) {
+      eof = true;
+      break;
+    }
+    int len = hdr[1] | (hdr[2] << 8);
+    if (len >= maxmsg || fread(buf, 1, len, f) != (size_t)len) {
+      eof = true;
+      break;
+    }
+    buf[len] = 0;
+
+    if (! pq->Publish(topic, buf))
+      break;
+    rdoff += len + 3;
+    n++;
+  }
+  if (f)
+    fclose(f);
+
+  // Appends hold the lock too, so at the end of the newest segment we've read all of it
+  if (eof) {
+    ESP_LOGD(offlog_tag, "Replayed segment %d", first);
+    Remove(first);
+    first++;
+    rdoff = 0;
+    if (first > last)
+      wrsize = segsize;
+  }
+
+  xSemaphoreGive(lock);
+  return n;
+}
@@ -0,0 +1,69 @@
+/*
+ * Store-and-forward log : reports made while MQTT is down are appended to
+ * a small set of segment files, and replayed in order after reconnect.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_OFFLINE_LOG_H_
+#define	_OFFLINE_LOG_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "PublishQueue.h"
+
+class OfflineLog {
+public:
+  OfflineLog(const char *dir, int nsegments = 8, int segsize = 4096);
+  ~OfflineLog();
+
+  bool Append(const char *msg);
+  bool Pending();
+  int Replay(PublishQueue *pq, const char *topic);
+
+  int getDropped();
+
+private:
+  char		*dir;
+  int		nsegments, segsize;
+  int		first, last;		// Sequence numbers of the oldest and newest segment
+  int		wrsize;			// Bytes in the newest segment
+  long		rdoff;			// Replay position in the oldest segment
+  int		dropped;		// Records lost because the log was full
+  int64_t	replay_ts;
+  SemaphoreHandle_t lock;
+
+  static const int maxmsg = 256;
+  static const uint8_t magic = 0xA5;
+  static const int replay_batch = 4;	// Records per call to Replay
+  static const int replay_interval = 200;	// ms between two batches
+  static const int replay_backlog = 8;	// Don't fill the PublishQueue beyond this
+
+  void Scan();
+  void SegmentName(char *buf, int seq);
+  void Remove(int seq);
+  int Count(int seq, long off);
+
+  const char	*offlog_tag = "OfflineLog";
+};
+
+extern OfflineLog *offlog;
+
+#endif	/* _OFFLINE_LOG_H_ */
@@ -0,0 +1,231 @@
+/*
+ * Power manager : let the controller light sleep until the next thing it has to do,
+ * and keep track of how much of the time it could.
+ *
+ * The deadlines are gathered by the Scheduler : every job (hatch schedule, sunrise and
+ * sunset, temperature, ...) returns when it wants to run next, and the loop task blocks
+ * until the earliest one. With CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE,
+ * ESP-IDF then goes into light sleep by itself until that deadline, and Wi-Fi wakes up
+ * for the DTIM beacons so the connection is kept.
+ *
+ * Light sleep stops the MCPWM clock, so it's blocked while the hatch motor runs.
+ * When idle, a GPIO wakeup is armed on the end-stop sensors that aren't active, and the
+ * idle hook wakes up the hatch job when one triggers.
+ *
+ * Residency is the time really spent in light sleep. The CPU cycle counter stops while
+ * sleeping and esp_timer doesn't, so the idle hook adds up the difference between the two
+ * since its previous call. The time the loop task was blocked is reported next to it :
+ * the gap between both is what other tasks (Wi-Fi, MQTT, web server) kept awake.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "PowerManager.h"
+#include "Scheduler.h"
+#include "Hatch.h"
+#include "Sunset.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_sleep.h>
+#include <esp_wifi.h>
+#include <esp_freertos_hooks.h>
+#include <esp_clk.h>
+#include <xtensa/hal.h>
+#include <driver/gpio.h>
+#include <stdio.h>
+
+static const int sensor_pins[2] = { CONFIG_SENSOR_DOWN_PIN, CONFIG_SENSOR_UP_PIN };
+static volatile bool sensor_armed[2] = { false, false };
+
+int64_t PowerManager::idle_last_us = 0;
+uint32_t PowerManager::idle_last_ccount = 0;
+volatile int64_t PowerManager::sleep_us = 0;
+
+PowerManager::PowerManager() {
+  sensor_job = -1;
+  motor = false;
+  motor_since = motor_ms = 0;
+#ifdef CONFIG_PM_ENABLE
+  motor_lock = 0;
+#endif
+}
+
+PowerManager::~PowerManager() {
+#ifdef CONFIG_PM_ENABLE
+  if (motor_lock)
+    esp_pm_lock_delete(motor_lock);
+#endif
+}
+
+/*
+ * Let the CPU clock down when idle, and with tickless idle also go into light sleep.
+ * Wi-Fi needs at least 80 MHz. Call from the loop task, the idle hook goes on its core.
+ */
+void PowerManager::Configure() {
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pm;
+  pm.max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+  pm.min_freq_mhz = 80;
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  pm.light_sleep_enable = true;
+#else
+  pm.light_sleep_enable = false;
+#endif
+  esp_err_t err = esp_pm_configure(&pm);
+  if (err != ESP_OK)
+    ESP_LOGE(power_tag, "Power management setup failed : %s", esp_err_to_name(err));
+
+  if ((err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "motor", &motor_lock)) != ESP_OK) {
+    ESP_LOGE(power_tag, "Cannot create lock : %s", esp_err_to_name(err));
+    motor_lock = 0;
+  }
+#endif
+
+  esp_sleep_enable_gpio_wakeup();
+  esp_register_freertos_idle_hook(IdleHook);
+}
+
+void PowerManager::NetworkUp() {
+  esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+}
+
+void PowerManager::setSensorJob(int job) {
+  sensor_job = job;
+}
+
+/*
+ * A level wakeup on a sensor that is already active would keep waking us up,
+ * so only arm the ones that aren't. The hatch job calls this every time it runs.
+ */
+void PowerManager::ArmSensors() {
+  for (int i=0; i<2; i++) {
+    gpio_num_t pin = (gpio_num_t)sensor_pins[i];
+    if (sensor_pins[i] < 0)
+      continue;
+
+    bool arm = ! motor && gpio_get_level(pin) != 0;
+    if (arm == sensor_armed[i])
+      continue;
+
+    if (arm)
+      gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+    else
+      gpio_wakeup_disable(pin);
+    sensor_armed[i] = arm;
+  }
+}
+
+/*
+ * Runs in the idle task, also right after a light sleep.
+ * Disarm a sensor that became active and let the hatch job have a look.
+ */
+bool PowerManager::IdleHook() {
+  bool hit = false;
+
+  MeasureSleep();
+
+  for (int i=0; i<2; i++)
+    if (sensor_armed[i] && gpio_get_level((gpio_num_t)sensor_pins[i]) == 0) {
+      gpio_wakeup_disable((gpio_num_t)sensor_pins[i]);
+      sensor_armed[i] = false;
+      hit = true;
+    }
+
+  if (hit && power && scheduler)
+    scheduler->Wake(power->sensor_job);
+  return true;
+}
+
+/*
+ * Time since the previous call that the CPU didn't count cycles for, was spent asleep.
+ * The cycles are converted at the current frequency, which is the minimum when idle :
+ * time spent running faster (e.g. other tasks at full speed) counts as awake, so this
+ * errs on the low side. The cycle counter wraps after some 18 s at 240 MHz, but the idle
+ * task gets to run much more often than that.
+ */
+void PowerManager::MeasureSleep() {
+  int64_t now = esp_timer_get_time();
+  uint32_t cc = xthal_get_ccount();
+
+  if (idle_last_us != 0) {
+    int mhz = esp_clk_cpu_freq() / 1000000;
+    int64_t awake = (int64_t)(uint32_t)(cc - idle_last_ccount) / (mhz ? mhz : 1);
+    int64_t gap = now - idle_last_us;
+    if (gap > awake)
+      sleep_us += gap - awake;
+  }
+  idle_last_us = now;
+  idle_last_ccount = cc;
+}
+
+void PowerManager::MotorRunning(bool running) {
+  if (running == motor)
+    return;
+  motor = running;
+
+  int64_t now = esp_timer_get_time() / 1000;
+  if (running) {
+    motor_since = now;
+    ArmSensors();			// Disarms : we poll them while moving
+#ifdef CONFIG_PM_ENABLE
+    if (motor_lock)
+      esp_pm_lock_acquire(motor_lock);
+#endif
+  } else {
+    motor_ms += now - motor_since;
+#ifdef CONFIG_PM_ENABLE
+    if (motor_lock)
+      esp_pm_lock_release(motor_lock);
+#endif
+  }
+}
+
+static void FormatTime(char *buf, int len, time_t t) {
+  if (t == 0) {
+    snprintf(buf, len, "-");
+    return;
+  }
+  struct tm tm;
+  localtime_r(&t, &tm);
+  strftime(buf, len, "%H:%M", &tm);
+}
+
+/*
+ * One line summary : light sleep residency since boot, the time the loop task allowed it,
+ * and the next deadlines we know of.
+ */
+int PowerManager::Format(char *buf, int len, time_t now) {
+  int64_t up = esp_timer_get_time() / 1000;
+  int64_t slept = sleep_us / 1000;
+  int64_t idle = scheduler ? scheduler->getIdleTime() : 0;
+  int64_t mot = motor_ms + (motor ? up - motor_since : 0);
+
+  char nh[8], ns[8];
+  FormatTime(nh, sizeof(nh), hatch ? hatch->getNextTransition() : 0);
+  FormatTime(ns, sizeof(ns), sunset ? sunset->getNextEvent(now) : 0);
+
+  int sleep_pm = up ? (int)(slept * 1000 / up) : 0;
+  int idle_pm = up ? (int)(idle * 1000 / up) : 0;
+
+  return snprintf(buf, len,
+    "Power : up %d s, light sleep %d.%d%%, loop blocked %d.%d%%, motor %d s, next hatch %s sun %s, wakeup in %d ms",
+    (int)(up / 1000), sleep_pm / 10, sleep_pm % 10, idle_pm / 10, idle_pm % 10,
+    (int)(mot / 1000), nh, ns, scheduler ? scheduler->getSleepTime() : -1);
+}
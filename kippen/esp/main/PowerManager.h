@@ -0,0 +1,67 @@
+/*
+ * Power manager : let the controller light sleep until the next thing it has to do,
+ * and keep track of how much of the time it could.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_POWER_MANAGER_H_
+#define	_POWER_MANAGER_H_
+
+#include <freertos/FreeRTOS.h>
+#include <esp_pm.h>
+#include <time.h>
+
+class PowerManager {
+public:
+  PowerManager();
+  ~PowerManager();
+
+  void Configure();			// Frequency scaling and light sleep, call once from setup()
+  void NetworkUp();			// Wi-Fi wakes up for DTIM beacons only
+  void setSensorJob(int job);		// Scheduler job to wake when an end-stop sensor triggers
+  void ArmSensors();			// Wake up on the sensors that aren't active now
+  void MotorRunning(bool running);	// No light sleep while the motor PWM must run
+
+  int Format(char *buf, int len, time_t now);
+
+private:
+  int		sensor_job;
+  bool		motor;
+  int64_t	motor_since, motor_ms;	// Time with light sleep blocked by the motor
+
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_lock_handle_t	motor_lock;
+#endif
+
+  // Light sleep measurement, updated from the idle hook
+  static int64_t	idle_last_us;
+  static uint32_t	idle_last_ccount;
+  static volatile int64_t sleep_us;
+
+  static bool IdleHook();
+  static void MeasureSleep();
+
+  const char	*power_tag = "PowerManager";
+};
+
+extern PowerManager *power;
+
+#endif	/* _POWER_MANAGER_H_ */
@@ -0,0 +1,129 @@
+/*
+ * Loop profiler : time spans in the main loop per module, with the CPU cycle counter,
+ * and keep a log2 histogram of their duration so we can see who eats the loop budget.
+ *
+ * Spans are converted to microseconds when they end, so the 32 bit cycle counter only
+ * has to survive one span (about 17s at 240 MHz). With power management enabled, the
+ * CPU frequency varies, and the microsecond timer is used instead. The p99 is read from the histogram,
+ * so it's the upper bound of the bucket it falls in, capped by the real maximum.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Profiler.h"
+#include <esp_log.h>
+#include <esp_clk.h>
+#include <stdio.h>
+#include <string.h>
+
+Profiler::Profiler() {
+  nmodules = 0;
+  memset(modules, 0, sizeof(modules));
+#ifdef CONFIG_PM_ENABLE
+  mhz = 1;
+#else
+  mhz = esp_clk_cpu_freq() / 1000000;
+  if (mhz == 0)
+    mhz = 1;
+#endif
+  vPortCPUInitializeMutex(&mux);
+}
+
+Profiler::~Profiler() {
+}
+
+int Profiler::Register(const char *name) {
+  if (nmodules >= max_modules) {
+    ESP_LOGE(profiler_tag, "No room for module %s", name);
+    return -1;
+  }
+  modules[nmodules].name = name;
+  return nmodules++;
+}
+
+int Profiler::getCount() {
+  return nmodules;
+}
+
+void Profiler::End(int id, uint32_t start) {
+  if (id < 0 || id >= nmodules)
+    return;
+
+  uint32_t us = (Stamp() - start) / mhz;
+
+  int b = 0;
+  for (uint32_t v = us; v > 1 && b < nbuckets - 1; v >>= 1)
+    b++;
+
+  module *m = &modules[id];
+  portENTER_CRITICAL(&mux);
+  m->count++;
+  m->total += us;
+  if (us > m->max)
+    m->max = us;
+  m->hist[b]++;
+  portEXIT_CRITICAL(&mux);
+}
+
+void Profiler::Reset() {
+  portENTER_CRITICAL(&mux);
+  for (int i=0; i<nmodules; i++) {
+    modules[i].count = 0;
+    modules[i].total = 0;
+    modules[i].max = 0;
+    memset(modules[i].hist, 0, sizeof(modules[i].hist));
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+// Upper bound (in us) of the bucket that holds the pct'th percentile
+uint32_t Profiler::Percentile(const module *m, int pct) {
+  if (m->count == 0)
+    return 0;
+
+  uint64_t need = ((uint64_t)m->count * pct + 99) / 100;
+  uint64_t seen = 0;
+  for (int b=0; b<nbuckets; b++) {
+    seen += m->hist[b];
+    if (seen >= need) {
+      uint32_t ub = (b == nbuckets - 1) ? m->max : (2UL << b) - 1;
+      return (ub < m->max) ? ub : m->max;
+    }
+  }
+  return m->max;
+}
+
+/*
+ * Format the statistics of one module, works on a copy so the loop isn't held up.
+ * Returns the length, like snprintf.
+ */
+int Profiler::Format(int id, char *buf, int len) {
+  if (id < 0 || id >= nmodules)
+    return 0;
+
+  module m;
+  portENTER_CRITICAL(&mux);
+  m = modules[id];
+  portEXIT_CRITICAL(&mux);
+
+  uint32_t avg = m.count ? (uint32_t)(m.total / m.count) : 0;
+  return snprintf(buf, len, "%s n %u avg %u p99 %u max %u us",
+    m.name, (unsigned)m.count, (unsigned)avg, (unsigned)Percentile(&m, 99), (unsigned)m.max);
+}
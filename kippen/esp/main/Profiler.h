@@ -0,0 +1,79 @@
+/*
+ * Loop profiler : time spans in the main loop per module, with the CPU cycle counter,
+ * and keep a log2 histogram of their duration so we can see who eats the loop budget.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_PROFILER_H_
+#define	_PROFILER_H_
+
+#include <freertos/FreeRTOS.h>
+#include <xtensa/hal.h>
+#include <esp_timer.h>
+
+class Profiler {
+public:
+  Profiler();
+  ~Profiler();
+
+  // Name must be a constant string, returns an id for Begin/End or -1
+  int Register(const char *name);
+
+  // Spans must begin and end in the same task, the cycle counter is per core
+  uint32_t Begin() { return Stamp(); }
+  void End(int id, uint32_t start);
+
+  void Reset();
+  int getCount();
+  int Format(int id, char *buf, int len);	// One line for module id
+
+  static const int max_modules = 12;
+  static const int nbuckets = 24;	// Bucket i counts spans of [2^i, 2^(i+1)) us
+
+private:
+  struct module {
+    const char	*name;
+    uint32_t	count;
+    uint64_t	total;			// us
+    uint32_t	max;			// us
+    uint32_t	hist[nbuckets];
+  };
+
+  module	modules[max_modules];
+  int		nmodules;
+  uint32_t	mhz;
+  portMUX_TYPE	mux;
+
+  static uint32_t Percentile(const module *m, int pct);
+
+#ifdef CONFIG_PM_ENABLE
+  // The CPU clock changes under power management, so cycles can't be converted to time
+  static uint32_t Stamp() { return (uint32_t)esp_timer_get_time(); }
+#else
+  static uint32_t Stamp() { return xthal_get_ccount(); }
+#endif
+
+  const char	*profiler_tag = "Profiler";
+};
+
+extern Profiler *profiler;
+
+#endif	/* _PROFILER_H_ */
@@ -0,0 +1,246 @@
+/*
+ * Outbound MQTT queue : Report() calls only queue a message, a separate task
+ * publishes them in small batches when the broker connection is up.
+ *
+ * Messages with a key replace a pending message with the same topic and key, so
+ * a burst of state updates only leaves the last one. While disconnected, messages
+ * stay queued up to a fixed number of entries and bytes; when full, the oldest
+ * QoS 0 message goes first.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "PublishQueue.h"
+#include <esp_log.h>
+#include <string.h>
+#include <stdlib.h>
+
+PublishQueue::PublishQueue(int max_entries, int max_bytes) {
+  this->max_entries = max_entries;
+  this->max_bytes = max_bytes;
+  bytes = dropped = 0;
+  client = 0;
+  connected = false;
+
+  lock = xSemaphoreCreateMutex();
+  client_lock = xSemaphoreCreateMutex();
+  xTaskCreate(Task, "publish", 3072, this, 5, &task);
+}
+
+PublishQueue::~PublishQueue() {
+  vTaskDelete(task);
+  for (list<entry>::iterator it = queue.begin(); it != queue.end(); it++)
+    free(it->msg);
+  queue.clear();
+  vSemaphoreDelete(lock);
+  vSemaphoreDelete(client_lock);
+}
+
+/*
+ * Returns when no publish on the previous client is in progress, so it can be destroyed.
+ */
+void PublishQueue::setClient(esp_mqtt_client_handle_t client) {
+  xSemaphoreTake(client_lock, portMAX_DELAY);
+  this->client = client;
+  xSemaphoreGive(client_lock);
+}
+
+/*
+ * Called from the MQTT event handler, a reconnect wakes up the sender.
+ */
+void PublishQueue::Connected(bool connected) {
+  this->connected = connected;
+  if (connected)
+    xTaskNotifyGive(task);
+}
+
+int PublishQueue::getQueued() {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int n = queue.size();
+  xSemaphoreGive(lock);
+  return n;
+}
+
+int PublishQueue::getDropped() {
+  return dropped;
+}
+
+/*
+ * Queue a message, never blocks on the network.
+ * Returns false only if the message could not be queued at all.
+ */
+bool PublishQueue::Publish(const char *topic, const char *msg, int qos, const char *key) {
+  int len = strlen(msg);
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  // Coalesce : a newer state message replaces the pending one, in place
+  if (key) {
+    for (list<entry>::iterator it = queue.begin(); it != queue.end(); it++)
+      if (it->key && it->topic == topic && strcmp(it->key, key) == 0) {
+	char *p = (char *)realloc(it->msg, len + 1);
+	if (p == 0)
+	  break;
+	strcpy(p, msg);
+	bytes += len - it->len;
+	it->msg = p;
+	it->len = len;
+	if (qos > it->qos)
+	  it->qos = qos;
+	xSemaphoreGive(lock);
+
+	ESP_LOGD(pq_tag, "Coalesced %s message", key);
+	if (connected)
+	  xTaskNotifyGive(task);
+	return true;
+      }
+  }
+
+  if (! MakeRoom(len)) {
+    dropped++;
+    xSemaphoreGive(lock);
+    ESP_LOGE(pq_tag, "Queue full, dropping message (%s)", msg);
+    return false;
+  }
+
+  entry e;
+  e.topic = topic;
+  e.key = key;
+  e.msg = strdup(msg);
+  e.len = len;
+  e.qos = qos;
+  e.tries = 0;
+
+  if (e.msg == 0) {
+    dropped++;
+    xSemaphoreGive(lock);
+    return false;
+  }
+
+  queue.push_back(e);
+  bytes += len;
+  xSemaphoreGive(lock);
+
+  if (connected)
+    xTaskNotifyGive(task);
+  return true;
+}
+
+/*
+ * Make sure there's room for a message of len bytes.
+ * Sacrifice the oldest QoS 0 message first, then the oldest of any kind.
+ * Caller holds the lock.
+ */
+bool PublishQueue::MakeRoom(int len) {
+  if (len > max_bytes)
+    return false;
+
+  while ((int)queue.size() >= max_entries || bytes + len > max_bytes) {
+    list<entry>::iterator victim = queue.begin();
+    for (list<entry>::iterator it = queue.begin(); it != queue.end(); it++)
+      if (it->qos == 0) {
+        victim = it;
+	break;
+      }
+
+    ESP_LOGD(pq_tag, "Budget exceeded, dropping (%s)", victim->msg);
+    Drop(victim);
+  }
+  return true;
+}
+
+// Caller holds the lock
+void PublishQueue::Drop(list<entry>::iterator it) {
+  bytes -= it->len;
+  free(it->msg);
+  queue.erase(it);
+  dropped++;
+}
+
+/*
+ * Send one burst of messages.
+ * Returns the number of ms to wait before the next call, or -1 to wait for a wakeup.
+ */
+int PublishQueue::Flush() {
+  for (int i=0; i<batch; i++) {
+    if (! connected || client == 0)
+      return -1;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (queue.empty()) {
+      xSemaphoreGive(lock);
+      return -1;
+    }
+
+    // Keep the entry queued while publishing, so a failure leaves it in place
+    entry e = queue.front();
+    e.msg = strdup(e.msg);
+    xSemaphoreGive(lock);
+
+    if (e.msg == 0)
+      return retry;
+
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    int id = client ? esp_mqtt_client_publish(client, e.topic, e.msg, e.len, e.qos, 0) : -1;
+    xSemaphoreGive(client_lock);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    list<entry>::iterator front = queue.begin();
+    // The head may have been coalesced or dropped meanwhile : only remove what we sent
+    bool same = (front != queue.end() && front->topic == e.topic && strcmp(front->msg, e.msg) == 0);
+
+    if (id >= 0) {
+      if (same) {
+        bytes -= front->len;
+	free(front->msg);
+	queue.erase(front);
+      }
+    } else if (same) {
+      front->tries++;
+      if (front->qos == 0 && front->tries >= max_tries) {
+        ESP_LOGE(pq_tag, "Giving up on message (%s)", front->msg);
+	Drop(front);
+      }
+    }
+    xSemaphoreGive(lock);
+    free(e.msg);
+
+    if (id < 0) {
+      ESP_LOGE(pq_tag, "Publish failed, retry in %d ms", retry);
+      return retry;
+    }
+  }
+
+  return (getQueued() == 0) ? -1 : interval;
+}
+
+void PublishQueue::Task(void *ptr) {
+  PublishQueue *pq = (PublishQueue *)ptr;
+  int wait = -1;
+
+  while (1) {
+    // A plain delay between bursts : new messages don't get to shorten it
+    if (wait < 0)
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    else
+      vTaskDelay(pdMS_TO_TICKS(wait));
+    wait = pq->Flush();
+  }
+}
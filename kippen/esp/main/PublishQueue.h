@@ -0,0 +1,83 @@
+/*
+ * Outbound MQTT queue : Report() calls only queue a message, a separate task
+ * publishes them in small batches when the broker connection is up.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_PUBLISH_QUEUE_H_
+#define	_PUBLISH_QUEUE_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "mqtt_client.h"
+
+#include <list>
+using namespace std;
+
+class PublishQueue {
+public:
+  PublishQueue(int max_entries = 32, int max_bytes = 4096);
+  ~PublishQueue();
+
+  // Topic and key must be constant strings, only the message is copied
+  bool Publish(const char *topic, const char *msg, int qos = 0, const char *key = 0);
+
+  void setClient(esp_mqtt_client_handle_t client);
+  void Connected(bool connected);
+
+  int getQueued();
+  int getDropped();
+
+private:
+  struct entry {
+    const char	*topic;
+    const char	*key;			// Messages with the same key supersede each other
+    char	*msg;
+    int		len;
+    int		qos;
+    int		tries;
+  };
+
+  list<entry>			queue;
+  SemaphoreHandle_t		lock;
+  SemaphoreHandle_t		client_lock;	// Held while publishing, so setClient() waits for that
+  TaskHandle_t			task;
+  esp_mqtt_client_handle_t	client;
+  volatile bool			connected;
+
+  int		max_entries, max_bytes;
+  int		bytes;
+  int		dropped;
+
+  static const int batch = 8;		// Messages per burst
+  static const int interval = 100;	// ms between bursts
+  static const int retry = 2000;	// ms to wait after a failed publish
+  static const int max_tries = 3;	// QoS 0 messages get dropped after this
+
+  static void Task(void *);
+  int Flush();
+  bool MakeRoom(int len);
+  void Drop(list<entry>::iterator it);
+
+  const char	*pq_tag = "PublishQueue";
+};
+#endif	/* _PUBLISH_QUEUE_H_ */
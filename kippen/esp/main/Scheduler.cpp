@@ -0,0 +1,132 @@
+/*
+ * Job scheduler for the kippen main loop : each module runs at its own pace,
+ * and the loop task blocks until the next one is due instead of spinning.
+ *
+ * All jobs run in the task that calls RunOnce(), so modules need no locking against
+ * each other, as before. Between jobs the task waits on its notification with a timeout,
+ * so FreeRTOS can go tickless (and, with power management enabled, into light sleep).
+ * Other tasks (e.g. the MQTT event handler) use Wake() to get a job to run right away.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Scheduler.h"
+#include "Profiler.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <string.h>
+
+Scheduler::Scheduler() {
+  njobs = 0;
+  memset(jobs, 0, sizeof(jobs));
+  task = 0;
+  idle = 0;
+  prof_loop = profiler ? profiler->Register("loop") : -1;
+}
+
+Scheduler::~Scheduler() {
+}
+
+int64_t Scheduler::Now() {
+  return esp_timer_get_time() / 1000;
+}
+
+/*
+ * Every job runs once at the first RunOnce(), then according to its period.
+ */
+int Scheduler::Register(const char *name, job_fn fn, void *arg, int period) {
+  if (njobs >= max_jobs) {
+    ESP_LOGE(scheduler_tag, "No room for job %s", name);
+    return -1;
+  }
+
+  job *j = &jobs[njobs];
+  j->name = name;
+  j->fn = fn;
+  j->arg = arg;
+  j->period = period;
+  j->due = Now();
+  j->woken = false;
+  j->prof = profiler ? profiler->Register(name) : -1;
+
+  ESP_LOGD(scheduler_tag, "Job %s, period %d ms", name, period);
+  return njobs++;
+}
+
+void Scheduler::Wake(int id) {
+  if (id < 0 || id >= njobs)
+    return;
+  jobs[id].woken = true;
+  if (task)
+    xTaskNotifyGive(task);
+}
+
+int Scheduler::getSleepTime() {
+  int64_t next = 0;
+  for (int i=0; i<njobs; i++) {
+    if (jobs[i].woken)
+      return 0;
+    if (jobs[i].due != 0 && (next == 0 || jobs[i].due < next))
+      next = jobs[i].due;
+  }
+  if (next == 0)
+    return -1;
+
+  int64_t ms = next - Now();
+  return (ms < 0) ? 0 : (int)ms;
+}
+
+int64_t Scheduler::getIdleTime() {
+  return idle;
+}
+
+void Scheduler::RunOnce(time_t now) {
+  if (task == 0)
+    task = xTaskGetCurrentTaskHandle();
+
+  uint32_t loop_start = profiler ? profiler->Begin() : 0;
+
+  for (int i=0; i<njobs; i++) {
+    job *j = &jobs[i];
+    if (! j->woken && (j->due == 0 || j->due > Now()))
+      continue;
+    j->woken = false;
+
+    uint32_t t = profiler ? profiler->Begin() : 0;
+    int next = j->fn(j->arg, now);
+    if (profiler)
+      profiler->End(j->prof, t);
+
+    if (next < 0)
+      next = j->period;
+    j->due = next ? Now() + next : 0;
+  }
+
+  if (profiler)
+    profiler->End(prof_loop, loop_start);
+
+  // A Wake() from now on leaves a notification pending, so it's never lost
+  int ms = getSleepTime();
+  if (ms != 0) {
+    int64_t t = Now();
+    ulTaskNotifyTake(pdTRUE, (ms < 0) ? portMAX_DELAY : pdMS_TO_TICKS(ms));
+    idle += Now() - t;
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * Job scheduler for the kippen main loop : each module runs at its own pace,
+ * and the loop task blocks until the next one is due instead of spinning.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_SCHEDULER_H_
+#define	_SCHEDULER_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <time.h>
+
+/*
+ * A job returns the number of ms until it wants to run again,
+ * -1 to keep its period, or 0 to sleep until someone calls Wake().
+ */
+typedef int (*job_fn)(void *arg, time_t now);
+
+class Scheduler {
+public:
+  Scheduler();
+  ~Scheduler();
+
+  // Name must be a constant string, returns a job id or -1
+  int Register(const char *name, job_fn fn, void *arg, int period);
+
+  void Wake(int id);			// Run this job soon, callable from any task
+  void RunOnce(time_t now);		// Run the jobs that are due, then block until the next one
+  int getSleepTime();			// ms until the next job is due, -1 if none
+  int64_t getIdleTime();		// ms spent waiting for jobs to be due
+
+  static const int max_jobs = 12;
+
+private:
+  struct job {
+    const char	*name;
+    job_fn	fn;
+    void	*arg;
+    int		period;			// ms
+    int64_t	due;			// ms since boot, 0 means waiting for Wake()
+    int		prof;			// Profiler id
+    volatile bool woken;
+  };
+
+  job		jobs[max_jobs];
+  int		njobs;
+  TaskHandle_t	task;
+  int		prof_loop;
+  int64_t	idle;
+
+  static int64_t Now();
+
+  const char	*scheduler_tag = "Scheduler";
+};
+
+extern Scheduler *scheduler;
+
+#endif	/* _SCHEDULER_H_ */
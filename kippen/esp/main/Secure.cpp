@@ -35,14 +35,21 @@
 #include <lwip/etharp.h>
 
 Secure::Secure() {
-  tbl_max = tbl_inc;
-  secure_tbl = (struct secure_device *)malloc(sizeof(struct secure_device) * tbl_max);
-  ndevices = ntrusts = 0;
+  SetInit(&macs, 5);
+  SetInit(&ips, 4);
+  ForgetVerdicts();
+  ntrusts = 0;
   tlsTask = 0;
   srvcert = 0;
   pkey = 0;
-  ssl = 0;
+  clients = 0;
   conf = 0;
+#if defined(MBEDTLS_SSL_CACHE_C)
+  cache = 0;
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C) && defined(MBEDTLS_SSL_SESSION_TICKETS)
+  ticket = 0;
+#endif
   WaitForAcmeCertificate = false;
   client_certs = 0;
 
@@ -131,6 +138,8 @@ Secure::Secure() {
 
 Secure::~Secure() {
   TlsServerStopTask();
+  free(macs.keys);
+  free(ips.keys);
   if (client_certs) {
     // FIX ME clear stuff pointed to as well
     free(client_certs);
@@ -245,50 +254,122 @@ boolean Secure::CheckPeerIP(struct sockaddr_in *sap) {
 
   ESP_LOGD(secure_tag, "%s -> %d", __FUNCTION__, ix);
 
-  if (ix < 0) {
+  if (ix < 0 || ix >= ARP_TABLE_SIZE) {
     ESP_LOGE(secure_tag, "%s(%s) unknown, errno %d", __FUNCTION__, inet_ntoa(sap->sin_addr), errno);
     return false;
   }
 
-  char mac[20];
-  sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", eap->addr[0], eap->addr[1],
-    eap->addr[2], eap->addr[3], eap->addr[4], eap->addr[5]);
+  uint32_t ip = sap->sin_addr.s_addr;
+  uint64_t mac = 0;
+  for (int i=0; i<6; i++)
+    mac = (mac << 8) | eap->addr[i];
+
+  // Same ARP entry as last time : same answer
+  int8_t verdict = -1;
+  portENTER_CRITICAL(&verdict_mux);
+  if (verdicts[ix].ip == ip && verdicts[ix].mac == mac)
+    verdict = verdicts[ix].verdict;
+  portEXIT_CRITICAL(&verdict_mux);
+
+  if (verdict < 0) {
+    verdict = (SetFind(&macs, mac) || SetFind(&ips, ip)) ? 1 : 0;
+
+    portENTER_CRITICAL(&verdict_mux);
+    verdicts[ix].ip = ip;
+    verdicts[ix].mac = mac;
+    verdicts[ix].verdict = verdict;
+    portEXIT_CRITICAL(&verdict_mux);
+  }
 
-  for (int i=0; i<ndevices; i++)
-    if (secure_tbl[i].mac && (strcasecmp(mac, secure_tbl[i].mac) == 0)) {
-      ESP_LOGD(secure_tag, "%s(%s) MAC %s is secure", __FUNCTION__, inet_ntoa(sap->sin_addr), mac);
-      return true;
-    } else if ((secure_tbl[i].ip.addr != 0) && (sap->sin_addr.s_addr == secure_tbl[i].ip.addr)) {
-      ESP_LOGD(secure_tag, "%s(%s) IP is secure", __FUNCTION__, inet_ntoa(sap->sin_addr));
-      return true;
-    }
+  if (verdict) {
+    ESP_LOGD(secure_tag, "%s(%s) is secure", __FUNCTION__, inet_ntoa(sap->sin_addr));
+    return true;
+  }
 
-  ESP_LOGE(secure_tag, "%s(%s) has MAC %s, unknown", __FUNCTION__, inet_ntoa(sap->sin_addr), mac);
+  ESP_LOGE(secure_tag, "%s(%s) has MAC %02x:%02x:%02x:%02x:%02x:%02x, unknown", __FUNCTION__,
+    inet_ntoa(sap->sin_addr), eap->addr[0], eap->addr[1], eap->addr[2], eap->addr[3], eap->addr[4], eap->addr[5]);
   return false;
 }
 
 void Secure::AddDevice(const char *mac) {
+  unsigned int m[6];
+
   ESP_LOGD(secure_tag, "Add Device %s", mac);
 
-  if (ndevices == tbl_max) {
-    tbl_max += tbl_inc;
-    secure_tbl = (struct secure_device *)realloc(secure_tbl, sizeof(struct secure_device) * tbl_max);
+  if (sscanf(mac, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6) {
+    ESP_LOGE(secure_tag, "Invalid MAC address %s", mac);
+    return;
   }
-  secure_tbl[ndevices].mac = mac;
-  secure_tbl[ndevices].ip.addr = 0;
-  ndevices++;
+
+  uint64_t key = 0;
+  for (int i=0; i<6; i++)
+    key = (key << 8) | (m[i] & 0xFF);
+  SetInsert(&macs, key);
+  ForgetVerdicts();
 }
 
 void Secure::AddDevice(in_addr_t ip) {
   ESP_LOGD(secure_tag, "Add Device %s", inet_ntoa(ip));
 
-  if (ndevices == tbl_max) {
-    tbl_max += tbl_inc;
-    secure_tbl = (struct secure_device *)realloc(secure_tbl, sizeof(struct secure_device) * tbl_max);
+  SetInsert(&ips, ip);
+  ForgetVerdicts();
+}
+
+void Secure::ForgetVerdicts() {
+  portENTER_CRITICAL(&verdict_mux);
+  for (int i=0; i<ARP_TABLE_SIZE; i++) {
+    verdicts[i].ip = 0;
+    verdicts[i].mac = 0;
+    verdicts[i].verdict = -1;
+  }
+  portEXIT_CRITICAL(&verdict_mux);
+}
+
+/*
+ * Fibonacci hashing, the set is kept at most half full so probe runs stay short.
+ */
+static inline int SetSlot(uint64_t key, int bits) {
+  return (int)((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+void Secure::SetInit(secure_set *set, int bits) {
+  set->bits = bits;
+  set->count = 0;
+  set->keys = (uint64_t *)calloc(1 << bits, sizeof(uint64_t));
+}
+
+/*
+ * Only called while configuring, so the lookup path never allocates.
+ */
+void Secure::SetInsert(secure_set *set, uint64_t key) {
+  if (key == 0 || SetFind(set, key))
+    return;
+
+  if (2 * (set->count + 1) > (1 << set->bits)) {
+    secure_set bigger;
+    SetInit(&bigger, set->bits + 1);
+    for (int i=0; i < (1 << set->bits); i++)
+      if (set->keys[i])
+        SetInsert(&bigger, set->keys[i]);
+    free(set->keys);
+    *set = bigger;
   }
-  secure_tbl[ndevices].mac = 0;
-  secure_tbl[ndevices].ip.addr = ip;
-  ndevices++;
+
+  int mask = (1 << set->bits) - 1;
+  int i = SetSlot(key, set->bits);
+  while (set->keys[i] != 0)
+    i = (i + 1) & mask;
+  set->keys[i] = key;
+  set->count++;
+}
+
+bool Secure::SetFind(const secure_set *set, uint64_t key) {
+  int mask = (1 << set->bits) - 1;
+
+  for (int i = SetSlot(key, set->bits); set->keys[i] != 0; i = (i + 1) & mask)
+    if (set->keys[i] == key)
+      return true;
+  return false;
 }
 
 /********************************************************************************
@@ -348,8 +429,6 @@ int Secure::TlsSetupAcme() {
 
   ESP_LOGI(tls_tag, "TLS setup, ACME version ...");
 
-  ssl = (mbedtls_ssl_context *)calloc(sizeof(mbedtls_ssl_context), 1);
-  mbedtls_ssl_init(ssl);
   conf = (mbedtls_ssl_config *)calloc(sizeof(mbedtls_ssl_config), 1);
   mbedtls_ssl_config_init(conf);
   // srvcert = (mbedtls_x509_crt *)calloc(sizeof(mbedtls_x509_crt), 1);
@@ -407,9 +486,7 @@ int Secure::TlsSetupAcme() {
     return ret;
   }
 
-  if ((ret = mbedtls_ssl_setup(ssl, conf)) != 0) {
-    mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-    ESP_LOGE(tls_tag, "mbedtls_ssl_setup failed, error %d (%s)", ret, error_buf);
+  if ((ret = TlsSetupSessionCache()) != 0) {
     TlsShutdown();
     return ret;
   }
@@ -460,8 +537,6 @@ int Secure::TlsSetupLocal() {
   int ret;
   char path[80];	// FIX ME
 
-  ssl = (mbedtls_ssl_context *)calloc(sizeof(mbedtls_ssl_context), 1);
-  mbedtls_ssl_init(ssl);
   conf = (mbedtls_ssl_config *)calloc(sizeof(mbedtls_ssl_config), 1);
   mbedtls_ssl_config_init(conf);
   srvcert = (mbedtls_x509_crt *)calloc(sizeof(mbedtls_x509_crt), 1);
@@ -560,9 +635,7 @@ int Secure::TlsSetupLocal() {
     return ret;
   }
 
-  if ((ret = mbedtls_ssl_setup(ssl, conf)) != 0) {
-    mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-    ESP_LOGE(tls_tag, "mbedtls_ssl_setup failed, error %d (%s)", ret, error_buf);
+  if ((ret = TlsSetupSessionCache()) != 0) {
     TlsShutdown();
     return ret;
   }
@@ -622,21 +695,70 @@ int Secure::TlsSetupLocal() {
 #endif
 }
 
+/*
+ * Both the classic session cache (session id) and session tickets, so clients that
+ * reconnect skip the ECDHE and certificate work. Resumed sessions keep their peer
+ * certificate, so the checks in TlsTaskLoop still see who's calling.
+ */
+int Secure::TlsSetupSessionCache() {
+#if defined(MBEDTLS_SSL_CACHE_C)
+  cache = (mbedtls_ssl_cache_context *)calloc(sizeof(mbedtls_ssl_cache_context), 1);
+  mbedtls_ssl_cache_init(cache);
+  mbedtls_ssl_cache_set_max_entries(cache, tls_cache_entries);
+  mbedtls_ssl_cache_set_timeout(cache, tls_session_lifetime);
+  mbedtls_ssl_conf_session_cache(conf, cache, mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+  ESP_LOGI(tls_tag, "Session cache, %d entries", tls_cache_entries);
+#endif
+
+#if defined(MBEDTLS_SSL_TICKET_C) && defined(MBEDTLS_SSL_SESSION_TICKETS)
+  int ret;
+
+  ticket = (mbedtls_ssl_ticket_context *)calloc(sizeof(mbedtls_ssl_ticket_context), 1);
+  mbedtls_ssl_ticket_init(ticket);
+  if ((ret = mbedtls_ssl_ticket_setup(ticket, mbedtls_ctr_drbg_random, &ctr_drbg,
+      MBEDTLS_CIPHER_AES_256_GCM, tls_session_lifetime)) != 0) {
+    mbedtls_strerror(ret, error_buf, sizeof(error_buf));
+    ESP_LOGE(tls_tag, "mbedtls_ssl_ticket_setup failed, error %d (%s)", ret, error_buf);
+    return ret;
+  }
+  mbedtls_ssl_conf_session_tickets_cb(conf, mbedtls_ssl_ticket_write, mbedtls_ssl_ticket_parse, ticket);
+  ESP_LOGI(tls_tag, "Session tickets enabled");
+#endif
+
+  return 0;
+}
+
 void Secure::TlsShutdown() {
   mbedtls_x509_crt_free(srvcert);
   free(srvcert);
   srvcert = 0;
   mbedtls_pk_free(pkey);
-  if (ssl) {
-    mbedtls_ssl_free(ssl);
-    free(ssl);
-    ssl = 0;
+  if (clients) {
+    for (int i=0; i<tls_max_clients; i++)
+      if (clients[i].state != TLS_FREE)
+        TlsClose(&clients[i], false);
+    free(clients);
+    clients = 0;
   }
   if (conf != 0) {
     mbedtls_ssl_config_free(conf);
     free(conf);
     conf = 0;
   }
+#if defined(MBEDTLS_SSL_CACHE_C)
+  if (cache) {
+    mbedtls_ssl_cache_free(cache);
+    free(cache);
+    cache = 0;
+  }
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C) && defined(MBEDTLS_SSL_SESSION_TICKETS)
+  if (ticket) {
+    mbedtls_ssl_ticket_free(ticket);
+    free(ticket);
+    ticket = 0;
+  }
+#endif
   mbedtls_ctr_drbg_free(&ctr_drbg);
   mbedtls_entropy_free(&entropy);
 }
@@ -697,13 +819,15 @@ int MyKeyVerification(void *param, mbedtls_x509_crt *cert, int depth, uint32_t *
 }
 
 /*
+ * The JSON server handles up to tls_max_clients connections at the same time.
+ * Sockets are non-blocking, each client is a small state machine stepped from
+ * one select() loop, so a slow client can only hold up its own connection.
+ *
  * Note this can not return (unless vTaskDelete() was called) or FreeRTOS deliberately panics.
  */
 void Secure::TlsTaskLoop(void *ptr) {
-  int ret, len;
+  int ret;
   mbedtls_net_context listen_fd;
-  unsigned char buf[1024];
-  char *caller = 0;
   char port[6];
   TaskHandle_t tsk;
 
@@ -728,227 +852,372 @@ void Secure::TlsTaskLoop(void *ptr) {
     vTaskDelete(tsk);
     return;
   }
+  mbedtls_net_set_nonblock(&listen_fd);
   ESP_LOGI(tls_tag, "Bind on https://localhost:%d ok", CONFIG_JSON_SERVERPORT);
 
-  // Accept incoming connections
+  clients = (tls_client *)calloc(tls_max_clients, sizeof(tls_client));
+  for (int i=0; i<tls_max_clients; i++)
+    clients[i].state = TLS_FREE;
+
+  ESP_LOGI(tls_tag, "Waiting for remote connections (max %d) ...", tls_max_clients);
   while (1) {
-    mbedtls_net_context client_fd;
-    ret = 0;
+    fd_set	rfds, wfds;
+    int		maxfd = -1, nfree = 0;
 
-    mbedtls_net_init(&client_fd);
-    mbedtls_ssl_session_reset(ssl);
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    for (int i=0; i<tls_max_clients; i++) {
+      tls_client *c = &clients[i];
 
-    ESP_LOGI(tls_tag, "Waiting for a remote connection ..." );
-    if ((ret = mbedtls_net_accept(&listen_fd, &client_fd, NULL, 0, NULL)) != 0) {
-      ESP_LOGE(tls_tag, "Accept failed, return %d", ret);
-      break;
+      if (c->state == TLS_FREE) {
+        nfree++;
+	continue;
+      }
+      FD_SET(c->fd.fd, c->want_write ? &wfds : &rfds);
+      if (c->fd.fd > maxfd)
+        maxfd = c->fd.fd;
     }
 
-    ESP_LOGI(tls_tag, "Got a remote connection ..." );
-    mbedtls_ssl_set_bio(ssl, &client_fd, mbedtls_net_send, mbedtls_net_recv, NULL );
+    // At the cap, new clients wait in the listen backlog
+    if (nfree > 0) {
+      FD_SET(listen_fd.fd, &rfds);
+      if (listen_fd.fd > maxfd)
+        maxfd = listen_fd.fd;
+    }
 
-    ESP_LOGI(tls_tag, "Start handshake ..." );
-    if ((ret = mbedtls_ssl_handshake(ssl)) != 0) {
-      if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-	mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-	ESP_LOGE(tls_tag, "SSL/TLS handshake failed, error %d (%s)", ret, error_buf);
-	mbedtls_net_free(&client_fd);
-	continue;
-      }
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    if ((ret = select(maxfd + 1, &rfds, &wfds, NULL, &tv)) < 0) {
+      ESP_LOGE(tls_tag, "select failed, errno %d", errno);
+      vTaskDelay(1000 / portTICK_PERIOD_MS);
+      continue;
     }
 
-    // Who are we talking to ?
-    mbedtls_x509_crt *crt = (mbedtls_x509_crt *)mbedtls_ssl_get_peer_cert(ssl);
+    for (int i=0; i<tls_max_clients; i++) {
+      tls_client *c = &clients[i];
 
-    // No client certificate --> no connection
-    if (crt == 0) {
-#if 1
-      if ((ret = mbedtls_ssl_write(ssl, (unsigned char *)json_not_authenticated, strlen(json_not_authenticated))) <= 0) {
-	mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-	ESP_LOGE(tls_tag, "Write to client failed, error %d (%s)", ret, error_buf);
-      }
-      if ((ret = mbedtls_ssl_close_notify(ssl)) < 0) {
-	mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-	ESP_LOGE(tls_tag, "Connection close error %d (%s)", ret, error_buf);
+      if (c->state == TLS_FREE)
+        continue;
+      if (FD_ISSET(c->fd.fd, &rfds) || FD_ISSET(c->fd.fd, &wfds))
+        TlsStep(c);
+
+      // Also for clients that keep trickling in data : each state gets tls_timeout in total
+      if (c->state != TLS_FREE && xTaskGetTickCount() - c->since > pdMS_TO_TICKS(tls_timeout)) {
+	ESP_LOGE(tls_tag, "Client timeout (%s)", (c->state == TLS_HANDSHAKE) ? "handshake"
+	  : (c->state == TLS_REQUEST) ? "request" : "reply");
+        TlsClose(c, false);
       }
-      mbedtls_net_free(&client_fd);
-      ESP_LOGE(tls_tag, "No client certificate, disconnect");
+    }
+
+    if (nfree > 0 && FD_ISSET(listen_fd.fd, &rfds))
+      TlsAccept(&listen_fd);
+  }
+}
+
+void Secure::TlsAccept(mbedtls_net_context *listen_fd) {
+  int ret;
+  tls_client *c = 0;
+  unsigned char ip[16];
+  size_t iplen = 0;
+
+  for (int i=0; i<tls_max_clients && c == 0; i++)
+    if (clients[i].state == TLS_FREE)
+      c = &clients[i];
+  if (c == 0)
+    return;
+
+  mbedtls_net_init(&c->fd);
+  if ((ret = mbedtls_net_accept(listen_fd, &c->fd, ip, sizeof(ip), &iplen)) != 0) {
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ)
+      ESP_LOGE(tls_tag, "Accept failed, return %d", ret);
+    return;
+  }
+  mbedtls_net_set_nonblock(&c->fd);
+
+  if (iplen == 4)
+    ESP_LOGI(tls_tag, "Got a remote connection from %d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+  else
+    ESP_LOGI(tls_tag, "Got a remote connection ...");
+
+  // Each client has its own record buffers, this is what limits tls_max_clients
+  mbedtls_ssl_init(&c->ssl);
+  if ((ret = mbedtls_ssl_setup(&c->ssl, conf)) != 0) {
+    mbedtls_strerror(ret, error_buf, sizeof(error_buf));
+    ESP_LOGE(tls_tag, "mbedtls_ssl_setup failed, error %d (%s)", ret, error_buf);
+    mbedtls_ssl_free(&c->ssl);
+    mbedtls_net_free(&c->fd);
+    return;
+  }
+  mbedtls_ssl_set_bio(&c->ssl, &c->fd, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+  c->state = TLS_HANDSHAKE;
+  c->since = xTaskGetTickCount();
+  c->want_write = false;
+  c->caller = 0;
+}
+
+void Secure::TlsClose(tls_client *c, boolean notify) {
+  int ret;
+
+  if (notify && (ret = mbedtls_ssl_close_notify(&c->ssl)) < 0) {
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      mbedtls_strerror(ret, error_buf, sizeof(error_buf));
+      ESP_LOGE(tls_tag, "Failed to close connection, error %d (%s)", ret, error_buf);
+    } else {
+      ESP_LOGI(tls_tag, "Connection closed" );
+    }
+  }
+  mbedtls_ssl_free(&c->ssl);
+  mbedtls_net_free(&c->fd);
+
+  // Free caller info
+  if (c->caller) {
+    free(c->caller);
+    c->caller = 0;
+  }
+  c->state = TLS_FREE;
+}
+
+/*
+ * Queue a reply and send what the socket takes now. The rest goes out from the select() loop
+ * as the client reads it, the connection gets closed when it's all sent.
+ */
+void Secure::TlsReply(tls_client *c, const char *p, int len) {
+  c->state = TLS_REPLY;
+  c->since = xTaskGetTickCount();
+  c->reply = p;
+  c->reply_len = len;
+  c->reply_off = 0;
+
+  TlsSendReply(c);
+}
+
+void Secure::TlsSendReply(tls_client *c) {
+  int ret;
+
+  while (c->reply_off < c->reply_len) {
+    ret = mbedtls_ssl_write(&c->ssl, (const unsigned char *)c->reply + c->reply_off,
+      c->reply_len - c->reply_off);
+    if (ret > 0) {
+      c->reply_off += ret;
       continue;
-#else
-      ESP_LOGE(tls_tag, "No client certificate, continuing anyway");
-#endif
-      }
+    }
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ)
+      return;
+    if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      c->want_write = true;
+      return;
+    }
 
-    ESP_LOGI(tls_tag, "SSL/TLS handshake ok");
+    mbedtls_strerror(ret, error_buf, sizeof(error_buf));
+    ESP_LOGE(tls_tag, "Write to client failed, error %d (%s)", ret, error_buf);
+    TlsClose(c, false);
+    return;
+  }
 
-    // FIXME to be upgraded to certificate / security check : authenticate the peer
-    if (crt) {
-      unsigned char buf[1024];
-      int ret;
+  TlsClose(c, true);
+}
 
-      // Get human-readable certificate info
-      if ((ret = mbedtls_x509_crt_info((char *) buf, sizeof(buf) - 1, "", crt)) >= 0) {
-	// Show it
-	// ESP_LOGI(tls_tag, "TLS client %s", buf);
-      }
+/*
+ * Advance one client as far as the data that has arrived allows.
+ */
+void Secure::TlsStep(tls_client *c) {
+  int ret;
+  unsigned char buf[1024];
 
-      // Issuer ?
-      mbedtls_x509_name issuer = crt->issuer;
-      if (mbedtls_x509_dn_gets((char *)buf, sizeof(buf), &issuer) > 0) {
-	ESP_LOGI(tls_tag, "TLS CA : %s", buf);
-      }
+  c->want_write = false;
 
-      // Subject (= calling node)
-      mbedtls_x509_name subject = crt->subject;
-      if (mbedtls_x509_dn_gets((char *)buf, sizeof(buf), &subject) > 0) {
-	ESP_LOGD(tls_tag, "TLS Node : %s", buf);
-
-	char *pcn = strstr((const char *)buf, "CN=");
-	if (pcn == 0)
-	  ESP_LOGE(tls_tag, "TLS Node not scanned");
-	else {
-	  caller = strdup(pcn+3);
-	  ESP_LOGI(tls_tag, "TLS Caller : %s", caller);
-	}
-      }
+  if (c->state == TLS_REPLY) {
+    TlsSendReply(c);
+    return;
+  }
+
+  if (c->state == TLS_HANDSHAKE) {
+    ret = mbedtls_ssl_handshake(&c->ssl);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ)
+      return;
+    if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      c->want_write = true;
+      return;
+    }
+    if (ret != 0) {
+      mbedtls_strerror(ret, error_buf, sizeof(error_buf));
+      ESP_LOGE(tls_tag, "SSL/TLS handshake failed, error %d (%s)", ret, error_buf);
+      TlsClose(c, false);
+      return;
     }
 
-    int (*vfn)(void *, mbedtls_x509_crt *, int, uint32_t *);
-    vfn = MyKeyVerification;
-    /*
-     * A CRL is a certificate revocation list.
-     * For now, we're using an empty list.
-     */
-    mbedtls_x509_crl client_crl;
-    mbedtls_x509_crl_init(&client_crl);
-
-    /*
-     * There are two ways to use this module.
-     * 1. With self signed certificates in the alarm modules as well as in the remote devices
-     *    (phones). In that case, getting here already proves that the remote device knows
-     *    "the secret" so they're ok, no further validation required.
-     * 2. With regular certificates, we still need to validate whether the remote client is
-     *    on our whitelist. That's what the code below does.
-     */
-#if defined(CONFIG_CHECK_LOCALCERTIFICATES)
-    if (crt) {
-      boolean ok = false;
-
-      // Validate whether the client is authorized
-      // for (int i=0; i<ntrusts; i++) {
-      // }
-      uint32_t flags = 0;
-      uint32_t vrfy = 0;
-
-      ESP_LOGI(tls_tag, "%s: mbedtls_x509_crt_verify(%p, %p, ..)", __FUNCTION__, (void *)crt, (void *)client_certs);
-      {
-        mbedtls_x509_crt * p = client_certs;
-	ESP_LOGI(tls_tag, "initial %p", p);
-	for (; p; p = p->next)
-	  ESP_LOGI(tls_tag, "next %p", p->next);
+    if (! TlsCheckClient(c))
+      return;
 
-      }
-      ret = mbedtls_x509_crt_verify(crt, client_certs, &client_crl, 0, &flags, vfn, &vrfy);
-      if (ret == 0 && flags == 0)	// Chain was verified and is valid
-	ok = true;
-      else if (ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
-        char error[120];
-	int len = mbedtls_x509_crt_verify_info(error, sizeof(error), "", flags);
-	if (len > 0) {
-#if 1
-	  ESP_LOGE(tls_tag, "Unverified connection : %s, refusing", error);
-#else
-	  ESP_LOGE(tls_tag, "Unverified connection : %s, flags 0x%X, allowing for now", error, flags);
-	  ok = true;
-#endif
-	}
-      } else {
-	mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-	ESP_LOGE(tls_tag, "mbedtls_x509_crt_verify error : %s", error_buf);
-      }
- 
-      if (! ok) {	// Unsecure connection, abort
-	mbedtls_net_free(&client_fd);
-	continue;
-      }
+    // The request may have come in together with the end of the handshake
+    c->state = TLS_REQUEST;
+    c->since = xTaskGetTickCount();
+  }
+
+  /*
+   * Make JSON request/reply server
+   */
+  // Read the HTTP Request
+  memset(buf, 0, sizeof(buf));
+  ret = mbedtls_ssl_read(&c->ssl, buf, sizeof(buf) - 1);
+
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ)
+    return;
+  if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    c->want_write = true;
+    return;
+  }
+  if (ret <= 0) {
+    switch (ret) {
+    case MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY:
+      ESP_LOGI(tls_tag, " connection was closed gracefully");
+      break;
+
+    case MBEDTLS_ERR_NET_CONN_RESET:
+      ESP_LOGE(tls_tag, " connection was reset by peer");
+      break;
+
+    default:
+      mbedtls_strerror(ret, error_buf, sizeof(error_buf));
+      ESP_LOGI(tls_tag, "mbedtls_ssl_read returned -0x%x (%s)", -ret, error_buf);
+      break;
     }
-#endif
 
-    /*
-     * Make JSON request/reply server
-     */
-    // Read the HTTP Request
-    do {
-      len = sizeof(buf) - 1;
-      memset(buf, 0, sizeof(buf));
-      ret = mbedtls_ssl_read(ssl, buf, len);
+    TlsClose(c, false);
+    return;
+  }
+
+  // Hack : to accomodate HTML requests, skip everything until "{"
+  char *p;
+  for (p=(char *)buf; *p && *p != '{'; p++) ;
 
-      if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
-	continue;
-      if (ret <= 0) {
-	switch (ret) {
-	case MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY:
-	  ESP_LOGI(tls_tag, " connection was closed gracefully");
-	  break;
-
-	case MBEDTLS_ERR_NET_CONN_RESET:
-	  ESP_LOGE(tls_tag, " connection was reset by peer");
-	  break;
-
-	default:
-	  mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-	  ESP_LOGI(tls_tag, "mbedtls_ssl_read returned -0x%x (%s)", -ret, error_buf);
-	  break;
-	}
-
-	break;
-      }
+  // Ok, interpret it now
+  char *q = kippen->HandleQueryAuthenticated(p, c->caller);
+  ESP_LOGD(tls_tag, "HandleQuery(%s) -> %s", p, q);
 
-      len = ret;
-      if (ret > 0)
-	break;
-    } while (1);
+  if (q) {	// Only write back if non-null, obviously
+    // Note : no need to free q, see Peers::HandleQueryInternal.
+    TlsReply(c, q, strlen(q));
+    return;
+  }
 
-    // Hack : to accomodate HTML requests, skip everything until "{"
-    char *p;
-    for (p=(char *)buf; *p && *p != '{'; p++) ;
+  TlsClose(c, true);
+}
 
-    // Ok, interpret it now
-    char *q = kippen->HandleQueryAuthenticated(p, caller);
-    ESP_LOGD(tls_tag, "HandleQuery(%s) -> %s", p, q);
+/*
+ * Who are we talking to ? Returns false if we don't like the client : the connection is then
+ * closed, or sending the refusal.
+ */
+boolean Secure::TlsCheckClient(tls_client *c) {
+  int ret;
+  mbedtls_x509_crt *crt = (mbedtls_x509_crt *)mbedtls_ssl_get_peer_cert(&c->ssl);
 
-    if (q) {	// Only write back if non-null, obviously
-      if ((ret = mbedtls_ssl_write(ssl, (unsigned char *)q, strlen(q))) <= 0) {
-	mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-	ESP_LOGE(tls_tag, "Write to client failed, error %d (%s)", ret, error_buf);
-      }
+  // No client certificate --> no connection
+  if (crt == 0) {
+#if 1
+    ESP_LOGE(tls_tag, "No client certificate, disconnect");
+    TlsReply(c, json_not_authenticated, strlen(json_not_authenticated));
+    return false;
+#else
+    ESP_LOGE(tls_tag, "No client certificate, continuing anyway");
+#endif
+  }
+
+  ESP_LOGI(tls_tag, "SSL/TLS handshake ok");
 
-      // Note : no need to free q, see Peers::HandleQueryInternal.
+  // FIXME to be upgraded to certificate / security check : authenticate the peer
+  if (crt) {
+    unsigned char buf[1024];
+
+    // Get human-readable certificate info
+    if ((ret = mbedtls_x509_crt_info((char *) buf, sizeof(buf) - 1, "", crt)) >= 0) {
+      // Show it
+      // ESP_LOGI(tls_tag, "TLS client %s", buf);
     }
 
-    // Free caller info
-    if (caller) {
-      free(caller);
-      caller = 0;
+    // Issuer ?
+    mbedtls_x509_name issuer = crt->issuer;
+    if (mbedtls_x509_dn_gets((char *)buf, sizeof(buf), &issuer) > 0) {
+      ESP_LOGI(tls_tag, "TLS CA : %s", buf);
     }
 
-    if ((ret = mbedtls_ssl_close_notify(ssl)) < 0) {
-      if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-	mbedtls_strerror(ret, error_buf, sizeof(error_buf));
-	ESP_LOGE(tls_tag, "Failed to close connection, error %d (%s)", ret, error_buf);
-      } else {
-	ESP_LOGI(tls_tag, "Connection closed" );
+    // Subject (= calling node)
+    mbedtls_x509_name subject = crt->subject;
+    if (mbedtls_x509_dn_gets((char *)buf, sizeof(buf), &subject) > 0) {
+      ESP_LOGD(tls_tag, "TLS Node : %s", buf);
+
+      char *pcn = strstr((const char *)buf, "CN=");
+      if (pcn == 0)
+	ESP_LOGE(tls_tag, "TLS Node not scanned");
+      else {
+	c->caller = strdup(pcn+3);
+	ESP_LOGI(tls_tag, "TLS Caller : %s", c->caller);
       }
     }
-    mbedtls_net_free(&client_fd);
   }
 
-  if (ret != 0) {
-    char error_buf[100];
-    mbedtls_strerror(ret, error_buf, 100);
-    ESP_LOGE(tls_tag, "Last error was: %d - %s", ret, error_buf);
+  int (*vfn)(void *, mbedtls_x509_crt *, int, uint32_t *);
+  vfn = MyKeyVerification;
+  /*
+   * A CRL is a certificate revocation list.
+   * For now, we're using an empty list.
+   */
+  mbedtls_x509_crl client_crl;
+  mbedtls_x509_crl_init(&client_crl);
+
+  /*
+   * There are two ways to use this module.
+   * 1. With self signed certificates in the alarm modules as well as in the remote devices
+   *    (phones). In that case, getting here already proves that the remote device knows
+   *    "the secret" so they're ok, no further validation required.
+   * 2. With regular certificates, we still need to validate whether the remote client is
+   *    on our whitelist. That's what the code below does.
+   */
+#if defined(CONFIG_CHECK_LOCALCERTIFICATES)
+  if (crt) {
+    boolean ok = false;
+
+    // Validate whether the client is authorized
+    // for (int i=0; i<ntrusts; i++) {
+    // }
+    uint32_t flags = 0;
+    uint32_t vrfy = 0;
+
+    ESP_LOGI(tls_tag, "%s: mbedtls_x509_crt_verify(%p, %p, ..)", __FUNCTION__, (void *)crt, (void *)client_certs);
+    {
+      mbedtls_x509_crt * p = client_certs;
+      ESP_LOGI(tls_tag, "initial %p", p);
+      for (; p; p = p->next)
+	ESP_LOGI(tls_tag, "next %p", p->next);
+
+    }
+    ret = mbedtls_x509_crt_verify(crt, client_certs, &client_crl, 0, &flags, vfn, &vrfy);
+    if (ret == 0 && flags == 0)	// Chain was verified and is valid
+      ok = true;
+    else if (ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
+      char error[120];
+      int len = mbedtls_x509_crt_verify_info(error, sizeof(error), "", flags);
+      if (len > 0) {
+#if 1
+	ESP_LOGE(tls_tag, "Unverified connection : %s, refusing", error);
+#else
+	ESP_LOGE(tls_tag, "Unverified connection : %s, flags 0x%X, allowing for now", error, flags);
+	ok = true;
+#endif
+      }
+    } else {
+      mbedtls_strerror(ret, error_buf, sizeof(error_buf));
+      ESP_LOGE(tls_tag, "mbedtls_x509_crt_verify error : %s", error_buf);
+    }
+ 
+    if (! ok) {	// Unsecure connection, abort
+      TlsClose(c, false);
+      return false;
+    }
   }
+#endif
 
-  mbedtls_net_free(&listen_fd);
-  TlsShutdown();
+  return true;
 }
@@ -25,6 +25,7 @@
 #define	_SECURE_H_
 
 #include <sys/socket.h>
+#include <lwip/etharp.h>
 
 #include "mbedtls/entropy.h"
 #include "mbedtls/ctr_drbg.h"
@@ -33,10 +34,15 @@
 #include "mbedtls/ssl.h"
 #include "mbedtls/net_sockets.h"
 #include "mbedtls/error.h"
+#include "mbedtls/ssl_cache.h"
+#include "mbedtls/ssl_ticket.h"
 
-struct secure_device {
-  const char	*mac;
-  ip4_addr_t	ip;
+/*
+ * Open addressing set of 48 bit MAC or 32 bit IP addresses, 0 marks a free slot.
+ */
+struct secure_set {
+  uint64_t	*keys;
+  int		bits, count;
 };
 
 class Secure {
@@ -64,9 +70,20 @@ class Secure {
 
     boolean CheckPeerIP(struct sockaddr_in *sap);
 
-    const int tbl_inc = 16;
-    int tbl_max, ndevices;
-    struct secure_device *secure_tbl;
+    struct secure_set macs, ips;
+    void SetInit(secure_set *set, int bits);
+    void SetInsert(secure_set *set, uint64_t key);
+    bool SetFind(const secure_set *set, uint64_t key);
+
+    // Verdicts for the current ARP entries, rechecked when the entry's IP or MAC changes
+    struct arp_verdict {
+      uint32_t	ip;
+      uint64_t	mac;
+      int8_t	verdict;		// -1 : not known yet
+    };
+    arp_verdict verdicts[ARP_TABLE_SIZE];
+    portMUX_TYPE verdict_mux = portMUX_INITIALIZER_UNLOCKED;
+    void ForgetVerdicts();
 
     // Test TLS server
     void tls();
@@ -77,16 +94,49 @@ class Secure {
     int TlsSetup();
     int TlsSetupAcme();
     int TlsSetupLocal();
+    int TlsSetupSessionCache();
     void TlsShutdown();
 
+    // One per client of the JSON server
+    enum { TLS_FREE, TLS_HANDSHAKE, TLS_REQUEST, TLS_REPLY };
+    struct tls_client {
+      int			state;
+      mbedtls_net_context	fd;
+      mbedtls_ssl_context	ssl;
+      TickType_t		since;		// Start of the current state, for the timeout
+      boolean			want_write;
+      char			*caller;
+      const char		*reply;		// Not owned, still to be sent from reply_off
+      int			reply_len, reply_off;
+    };
+    tls_client *clients;
+    const int tls_max_clients = 3;		// Each costs the mbedTLS record buffers
+    const int tls_timeout = 10000;		// ms, for the handshake, the request, and the reply
+
+    void TlsAccept(mbedtls_net_context *listen_fd);
+    void TlsStep(tls_client *c);
+    void TlsClose(tls_client *c, boolean notify);
+    void TlsReply(tls_client *c, const char *p, int len);
+    void TlsSendReply(tls_client *c);
+    boolean TlsCheckClient(tls_client *c);
+
     // MbedTLS stuff that is allocated per device
     mbedtls_entropy_context entropy;
     mbedtls_ctr_drbg_context ctr_drbg;
-    mbedtls_ssl_context *ssl;
     mbedtls_ssl_config *conf;
     mbedtls_x509_crt *srvcert;
     mbedtls_pk_context *pkey;
 
+    // Session resumption : clients that come back skip the full handshake
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_context *cache;
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C) && defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_ticket_context *ticket;
+#endif
+    const int tls_cache_entries = 8;		// Each holds a copy of the peer certificate
+    const int tls_session_lifetime = 86400;	// Seconds
+
     char error_buf[100];
 
     // Client certificate list
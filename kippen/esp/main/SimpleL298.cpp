@@ -46,6 +46,7 @@
 #include "soc/mcpwm_reg.h"
 #include "soc/mcpwm_struct.h"
 
+#if 0
 extern SimpleL298 *simple;
 static const char *sl298_tag = "L298s";
 
@@ -66,6 +67,7 @@ static void example(void *arg) {
   vTaskDelay(100 / portTICK_RATE_MS);
   vTaskDelete(0);
 }
+#endif
 
 
 SimpleL298::SimpleL298(int dir_pin1, int dir_pin2, int speed_pin) {
@@ -20,222 +20,121 @@
  *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *   THE SOFTWARE.
  *
- * This contains code to query the API server at api.sunrise-sunset.org .
- * Notes :
- * - This needs a patch to esp-link/el-client to cope with reply length ~500 bytes.
- * - All times in GMT so timezone and DST must still be applied.
- *   This is now treated very simply by adding a hardcoded value right before
- *   storing the times in private variables.
+ * This calculates sunrise, sunset and civil twilight locally, from latitude/longitude and date.
+ * No network access is needed, so the hatch never has to wait for a query.
  *
- * See http://www.sunrise-sunset.org
+ * The formulas are the "General Solar Position Calculations" from the NOAA Global Monitoring
+ * Division, which are accurate to about a minute for latitudes between +/- 60 degrees.
+ * See https://gml.noaa.gov/grad/solcalc/solareqns.PDF
  *
- * Example call : http://api.sunrise-sunset.org/json?lat=36.7201600&lng=-4.4203400&formatted=0
- *
- * Example reply (spacing added for clarity) :
- *	{
- *	  "results":
- *	  {
- *	    "sunrise":"2015-05-21T05:05:35+00:00",
- *	    "sunset":"2015-05-21T19:22:59+00:00",
- *	    "solar_noon":"2015-05-21T12:14:17+00:00",
- *	    "day_length":51444,
- *	    "civil_twilight_begin":"2015-05-21T04:36:17+00:00",
- *	    "civil_twilight_end":"2015-05-21T19:52:17+00:00",
- *	    "nautical_twilight_begin":"2015-05-21T04:00:13+00:00",
- *	    "nautical_twilight_end":"2015-05-21T20:28:21+00:00",
- *	    "astronomical_twilight_begin":"2015-05-21T03:20:49+00:00",
- *	    "astronomical_twilight_end":"2015-05-21T21:07:45+00:00"
- *	  },
- *	  "status":"OK"
- *	}
+ * The results are computed in UTC, and converted to the local timezone (including DST)
+ * with the C library, so the TZ setting is honoured.
  */
 #include "Kippen.h"
 #include "Sunset.h"
+#include <math.h>
 
 Sunset::Sunset() {
-  last_call = 0;
+  today = 0;
   stable = LIGHT_NONE;
 
-  memset(&http_config, 0, sizeof(http_config));
-  http_client = 0;
-
   sunrise =  sunset =  twilight_begin =  twilight_end = 0;
-  lat =  lon = 0;
-
-  buf = 0;
-  last_query = 0;
-  last_error = 0;
+  lat =  lon = 0.0;
 }
 
 Sunset::~Sunset() {
 }
 
-const char *ss_template = "http://api.sunrise-sunset.org/json?lat=%s&lng=%s&formatted=0";
-
+/*
+ * Remember the coordinates and calculate today's times.
+ */
 void Sunset::query(const char *lat, const char *lon, char *msg) {
-  char *query = (char *)malloc(strlen(ss_template) + strlen(lat) + strlen(lon));
-  sprintf(query, ss_template, lat, lon);
-
-  memset(&http_config, 0, sizeof(http_config));
-  http_config.url = query;
-  http_client = esp_http_client_init(&http_config);
-  if (http_client == 0) {
-    ESP_LOGE(sunset_tag, "Failed to open http client to %s", query);
-    free(query); query = 0; http_config.url = 0;
-    return;
-  }
-
-  ESP_LOGD(sunset_tag, "Querying .. {%s}", query);
-
-  esp_err_t err = esp_http_client_open(http_client, 0);
-  if (err != ESP_OK) {
-    ESP_LOGE(sunset_tag, "HTTP GET request failed: %s, trying again after %d minutes",
-      esp_err_to_name(err), error_delay / 60);
-
-    esp_http_client_cleanup(http_client);
-    the_delay = error_delay;
-    free(query); query = 0; http_config.url = 0;
-
-    return;
-  }
-
-  ESP_LOGD(sunset_tag, "Ok : got reply");
-
-  int content_length = esp_http_client_fetch_headers(http_client);
-  if (content_length < 0) {
-    ESP_LOGE(sunset_tag, "Invalid content length %d, discarding", content_length);
-
-    free(query); query = 0; http_config.url = 0;
-    esp_http_client_close(http_client);
-    esp_http_client_cleanup(http_client);
-    return;
-  } else
-    ESP_LOGD(sunset_tag, "Content length %d", content_length);
-
-  if (content_length == 0)
-    content_length = buflen;	// Allocate too much, but not for a very long time
-
-  buf = (char *)malloc(content_length + 1);
-  if (buf == 0) {
-    ESP_LOGE(sunset_tag, "malloc failed");
-    free(query); query = 0; http_config.url = 0;
-    return;
-  }
-
-  int pos = 0, total = 0, rlen = 0;
-  while (total < content_length && err == ESP_OK) {
-    rlen = esp_http_client_read(http_client, buf + pos, content_length - total);
-    if (rlen < 0) {
-      ESP_LOGE(sunset_tag, "error reading data");
-      esp_http_client_close(http_client);
-      esp_http_client_cleanup(http_client);
-      free(buf); buf = 0;
-      free(query); query = 0; http_config.url = 0;
-      return;
-    }
-    if (rlen == 0)
-      break;
-    buf[rlen] = 0;
-    // ESP_LOGI(sunset_tag, "rlen = %d", rlen);
-
-    pos += rlen;
-    total += rlen;
-  }
-
-  ESP_LOGD(sunset_tag, "Query %s", query);
-  ESP_LOGD(sunset_tag, "Response %s", buf);
-
-  if (last_error) {
-    last_error = false;
-    ESP_LOGE(sunset_tag, "Last_error set, response %s", buf);
-  }
-
-  free(query); query = 0; http_config.url = 0;
-
-  esp_http_client_close(http_client);
-  esp_http_client_cleanup(http_client);
-
-  boolean fail = true;
-
-  DynamicJsonBuffer jb;
-  JsonObject &root = jb.parseObject(buf);
-  if (root.success()) {
-    // ESP_LOGD(sunset_tag, "Root ok");
+  this->lat = atof(lat);
+  this->lon = atof(lon);
 
-    const char *s_sunrise = root["results"]["sunrise"];
-    const char *s_sunset = root["results"]["sunset"];
-    const char *s_twilight_begin = root["results"]["civil_twilight_begin"];
-    const char *s_twilight_end = root["results"]["civil_twilight_end"];
+  if (msg)
+    ESP_LOGD(sunset_tag, "Query (%s) lat %s lon %s", msg, lat, lon);
 
-    // "sunrise":"2020-08-13T04:58:47+00:00" --> 04 * 100 + 58 --> 0498
-    sunrise = TimeOnly(s_sunrise);
-    sunset = TimeOnly(s_sunset);
-    twilight_begin = TimeOnly(s_twilight_begin);
-    twilight_end = TimeOnly(s_twilight_end);
+  today = 0;
+  Calculate(time(0));
+}
 
-    ESP_LOGI(sunset_tag, "Decoded sunrise %04d sunset %04d twilight begin %04d end %04d",
-      sunrise, sunset, twilight_begin, twilight_end);
+/*
+ * Days since 1970-01-01 for a civil date, so we don't depend on timegm().
+ */
+static long DaysFromCivil(int y, int m, int d) {
+  y -= (m <= 2);
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
 
-    fail = false;
-  }
+/*
+ * Calculate one event for the day starting at UTC "midnight", day of year "doy" (0 based).
+ * Returns local time as hour * 100 + minute, or -1 if the sun doesn't cross this zenith today.
+ */
+int Sunset::SolarEvent(double zenith, bool rising, time_t midnight, int doy) {
+  double g = 2.0 * M_PI / 365.0 * doy;		// Fractional year, in radians
+  double eqtime = 229.18 * (0.000075 + 0.001868 * cos(g) - 0.032077 * sin(g)
+    - 0.014615 * cos(2 * g) - 0.040849 * sin(2 * g));
+  double decl = 0.006918 - 0.399912 * cos(g) + 0.070257 * sin(g)
+    - 0.006758 * cos(2 * g) + 0.000907 * sin(2 * g)
+    - 0.002697 * cos(3 * g) + 0.00148 * sin(3 * g);
+
+  double rlat = lat * M_PI / 180.0;
+  double c = cos(zenith * M_PI / 180.0) / (cos(rlat) * cos(decl)) - tan(rlat) * tan(decl);
+  if (c < -1.0 || c > 1.0)
+    return -1;					// Midnight sun or polar night
+  double ha = acos(c) * 180.0 / M_PI;
+
+  double minutes = 720.0 - 4.0 * (lon + (rising ? ha : -ha)) - eqtime;
+  time_t t = midnight + (time_t)(minutes * 60.0 + 30.0);	// Round to the minute
 
-  if (fail) {
-    last_error = true;
+  struct tm tm;
+  localtime_r(&t, &tm);
+  return tm.tm_hour * 100 + tm.tm_min;
+}
 
-    ESP_LOGE(sunset_tag, "Failed to parse JSON. Response length %d, {%s}", content_length, buf);
+/*
+ * Recalculate the times when the (local) date changes. This is cheap, a handful of
+ * floating point operations once per day.
+ */
+void Sunset::Calculate(time_t now) {
+  struct tm tm;
+  localtime_r(&now, &tm);
 
-    the_delay = error_delay;				// Shorter retry
-    free(buf); buf = 0;
-    free(query); query = 0;
+  int date = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+  if (date == today)
     return;
-  }
+  today = date;
 
-  free(buf);
-  buf = 0;
-  free(query); query = 0;
+  time_t midnight = DaysFromCivil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400L;
 
-  the_delay = normal_delay;
-}
+  sunrise = SolarEvent(zenith_official, true, midnight, tm.tm_yday);
+  sunset = SolarEvent(zenith_official, false, midnight, tm.tm_yday);
+  twilight_begin = SolarEvent(zenith_civil, true, midnight, tm.tm_yday);
+  twilight_end = SolarEvent(zenith_civil, false, midnight, tm.tm_yday);
 
-/*
- * Pick just hour and minute, and translate into (not quite) minutes since midnight (easily comparable)
- * We multiply by 100 instead of 60 so it's more readable; it's still as comparable...
- */
-int Sunset::TimeOnly(const char *s) {
-  // Note this can be done as string parsing locally but I'm using library functions
-  struct tm tm;
-  strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
-  return tm.tm_hour * 100 + tm.tm_min;
+  ESP_LOGI(sunset_tag, "%04d-%02d-%02d : sunrise %04d sunset %04d twilight begin %04d end %04d",
+    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, sunrise, sunset, twilight_begin, twilight_end);
 }
 
 /*
- * Query once per day
+ * Recalculate once per day
  * All times in local timezone.
  */
 enum lightState Sunset::loop(time_t now) {
-  // First call ever, so we just got initialized.
-  // Don't bother querying, this is done from elsewhere.
-  if (last_call == 0) {
-    last_call = now;
+  // Time not set yet
+  if (now < 1000)
     return LIGHT_NONE;
-  }
-
-  struct tm *tmp = localtime(&now);
 
-  /* Refresh our knowledge from time to time */
-  if (now - last_call > delay_queries) {
-    // Don't do this immediately after boot or midnight
-    if (now < 1000 || tmp->tm_hour < 4)
-      return LIGHT_NIGHT;
+  Calculate(now);
 
-    char _today[32];
-    sprintf(_today, "%04d-%02d-%02d, %02d:%02d", tmp->tm_year + 1900, tmp->tm_mon + 1, tmp->tm_mday,
-      tmp->tm_hour, tmp->tm_min);
-    query(lat, lon, _today);
-    last_call = now;
-  }
-
-  time_t tt = tmp->tm_hour * 3600L + tmp->tm_min * 60L + tmp->tm_sec;
+  struct tm tm;
+  localtime_r(&now, &tm);
+  int tt = tm.tm_hour * 100 + tm.tm_min;	// Same format as sunrise, sunset
 
   if (tt < sunrise) {
     stable = LIGHT_NIGHT;
@@ -257,9 +156,54 @@ enum lightState Sunset::loop(time_t now) {
   return LIGHT_DAY;
 }
 
+/*
+ * When is the next sunrise or sunset ? Tomorrow's times are taken to be today's,
+ * close enough for a caller that wants to know how long it can sleep.
+ */
+time_t Sunset::getNextEvent(time_t now) {
+  if (today == 0 || now < 1000)
+    return 0;
+
+  int events[2] = { sunrise, sunset };
+  time_t next = 0;
+
+  for (int day=0; day<2 && next == 0; day++)
+    for (int i=0; i<2; i++) {
+      if (events[i] < 0)
+        continue;
+
+      struct tm tm;
+      localtime_r(&now, &tm);
+      tm.tm_mday += day;
+      tm.tm_hour = events[i] / 100;
+      tm.tm_min = events[i] % 100;
+      tm.tm_sec = 0;
+      tm.tm_isdst = -1;
+
+      time_t t = mktime(&tm);
+      if (t > now && (next == 0 || t < next))
+        next = t;
+    }
+  return next;
+}
+
 void Sunset::reset() {
-  last_call = 0L;	// Causes re-query
-  Serial.println("Sunset : reset");
+  today = 0;	// Causes recalculation
+  ESP_LOGI(sunset_tag, "reset");
+}
+
+/*
+ * Produce a readable version of a time in hour * 100 + minute form
+ * Warning : always the same memory location
+ */
+char *Sunset::Time2String(int tm) {
+  static char buffer[16];
+
+  if (tm < 0)
+    strcpy(buffer, "--:--");
+  else
+    sprintf(buffer, "%02d:%02d", tm / 100, tm % 100);
+  return buffer;
 }
 
 /*
@@ -25,56 +25,34 @@
 
 #include "Light.h"
 
-// #define       WU_TIME_OK      90
-#define  WU_TIME_OK      10
-// #define       WU_TIME_FAIL    15
-#define  WU_TIME_FAIL    2
-
 class Sunset {
 public:
   Sunset();
   ~Sunset();
-  void query();
   void query(const char *lat, const char *lon, char *msg = NULL);
   enum lightState loop(time_t);
   void reset();
   void getSchedule(char *buffer, int buflen);
+  time_t getNextEvent(time_t now);	// Next sunrise or sunset, 0 if not known yet
 
 private:
   // State variables
-  int sunrise, sunset, twilight_begin, twilight_end;		// These are time-only, no date
-  time_t last_call;						// Date of last update
-  char *lat, *lon;						// Use this for daily update
+  int sunrise, sunset, twilight_begin, twilight_end;		// These are time-only, no date, local time
+  int today;							// Date of last calculation (yyyymmdd)
+  double lat, lon;						// Use this for daily update
   enum lightState stable;					// Stable state
 
   // Function definitions
-  time_t String2DateTime(char *);
-  time_t String2Time(char *);
-  char *Time2String(time_t);
-  byte daysInMonth(int yr, int m);
-  bool isLeapYear(int yr);
-  char *findData(char *, const char *);
-  void DebugPrint(const char *, time_t, const char *);
-  int TimeOnly(const char *s);				// pick just hour and minute
+  void Calculate(time_t now);
+  int SolarEvent(double zenith, bool rising, time_t midnight, int doy);
+  char *Time2String(int);
 
   // Internal stuff
   const char *sunset_tag = "Sunset";
 
-  esp_http_client_handle_t	http_client;
-  esp_http_client_config_t	http_config;
-
-  const int buflen = 2000;
-  char *buf;
-  int	the_delay;
-
-  time_t		last_query;
-  static const char	*pattern;
-  bool			last_error;	// Show debug query if previous one failed
-
-  static const int	normal_delay = WU_TIME_OK * 60;	// Wait time between successful queries
-  static const int	error_delay = WU_TIME_FAIL * 60;// Time to wait after error
-
-  static const int	delay_queries = 25 * 60 * 60;
+  // Zenith angles (degrees) : official sunrise/sunset includes refraction, civil twilight is -6
+  static constexpr double	zenith_official = 90.833;
+  static constexpr double	zenith_civil = 96.0;
 };
 
 extern Sunset *sunset;
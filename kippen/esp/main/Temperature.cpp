@@ -84,7 +84,7 @@ void Temperature::loop(time_t nowts) {
 
     // Report at sudden temperature differences, or every five minutes
     if (diff > 1.0 || nowts - reportts1 > 300) {
-      kippen->Report(msg);
+      kippen->Report(msg, "temperature");
       reportts1 = nowts;
     }
   }
@@ -0,0 +1,156 @@
+/*
+ * MQTT topic dispatcher : modules register topic patterns (with + and # wildcards)
+ * and a handler, incoming topics are matched against all of them in one walk down a trie.
+ *
+ * Each trie node is one level of a topic (the part between slashes), so matching costs
+ * one comparison per level and per sibling, no matter how many commands are registered elsewhere.
+ * Comparisons ignore case, like the code this replaces.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Kippen.h"
+#include "TopicTrie.h"
+
+TopicTrie::TopicTrie() {
+  root = (node *)calloc(1, sizeof(node));
+}
+
+TopicTrie::~TopicTrie() {
+  Free(root);
+  root = 0;
+}
+
+void TopicTrie::Free(node *n) {
+  if (n == 0)
+    return;
+  Free(n->child);
+  Free(n->next);
+  while (n->handlers) {
+    handler *h = n->handlers;
+    n->handlers = h->next;
+    free(h);
+  }
+  free(n->level);
+  free(n);
+}
+
+/*
+ * Find the child for this level, create it if asked to.
+ */
+TopicTrie::node *TopicTrie::Child(node *parent, const char *level, int len, bool create) {
+  for (node *c = parent->child; c; c = c->next)
+    if (c->len == len && strncasecmp(c->level, level, len) == 0)
+      return c;
+
+  if (! create)
+    return 0;
+
+  node *c = (node *)calloc(1, sizeof(node));
+  if (c == 0)
+    return 0;
+  c->level = strndup(level, len);
+  c->len = len;
+  c->next = parent->child;
+  parent->child = c;
+  return c;
+}
+
+/*
+ * Register a handler for a topic pattern, e.g. "/kippen/system/reboot" or "/kippen/state/+".
+ * A "#" matches the rest of the topic, and must be the last level.
+ */
+bool TopicTrie::Register(const char *pattern, TopicHandler f, void *arg) {
+  node *n = root;
+  const char *p = pattern;
+
+  while (n) {
+    const char *q = strchr(p, '/');
+    int len = q ? (q - p) : strlen(p);
+
+    if (len == 1 && p[0] == '#' && q != 0) {
+      ESP_LOGE(topic_tag, "Invalid pattern %s : # must be last", pattern);
+      return false;
+    }
+    n = Child(n, p, len, true);
+    if (q == 0)
+      break;
+    p = q + 1;
+  }
+  if (n == 0) {
+    ESP_LOGE(topic_tag, "Cannot register %s : out of memory", pattern);
+    return false;
+  }
+
+  handler *h = (handler *)malloc(sizeof(handler));
+  if (h == 0)
+    return false;
+  h->f = f;
+  h->arg = arg;
+  h->next = n->handlers;
+  n->handlers = h;
+
+  ESP_LOGD(topic_tag, "Registered %s", pattern);
+  return true;
+}
+
+int TopicTrie::Call(node *n, const char *topic, const char *payload) {
+  int count = 0;
+  for (handler *h = n->handlers; h; h = h->next, count++)
+    h->f(topic, payload, h->arg);
+  return count;
+}
+
+/*
+ * Match the topic from "level" onwards against the children of n.
+ * A zero level pointer means the topic has been consumed.
+ */
+int TopicTrie::Match(node *n, const char *level, const char *topic, const char *payload) {
+  int count = 0;
+
+  if (level == 0) {
+    count += Call(n, topic, payload);
+    node *c = Child(n, "#", 1, false);		// "a/#" also matches "a"
+    if (c)
+      count += Call(c, topic, payload);
+    return count;
+  }
+
+  const char *q = strchr(level, '/');
+  int len = q ? (q - level) : strlen(level);
+
+  for (node *c = n->child; c; c = c->next) {
+    if (c->len == 1 && c->level[0] == '#')
+      count += Call(c, topic, payload);
+    else if ((c->len == 1 && c->level[0] == '+')
+     || (c->len == len && strncasecmp(c->level, level, len) == 0))
+      count += Match(c, q ? q + 1 : 0, topic, payload);
+  }
+  return count;
+}
+
+/*
+ * Call all handlers whose pattern matches this topic, return how many were called.
+ */
+int TopicTrie::Dispatch(const char *topic, const char *payload) {
+  if (root == 0 || topic == 0)
+    return 0;
+  return Match(root, topic, topic, payload);
+}
@@ -0,0 +1,63 @@
+/*
+ * MQTT topic dispatcher : modules register topic patterns (with + and # wildcards)
+ * and a handler, incoming topics are matched against all of them in one walk down a trie.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_TOPIC_TRIE_H_
+#define	_TOPIC_TRIE_H_
+
+typedef void (*TopicHandler)(const char *topic, const char *payload, void *arg);
+
+class TopicTrie {
+public:
+  TopicTrie();
+  ~TopicTrie();
+
+  bool Register(const char *pattern, TopicHandler f, void *arg = 0);
+  int Dispatch(const char *topic, const char *payload);
+
+private:
+  struct handler {
+    TopicHandler	f;
+    void		*arg;
+    handler		*next;
+  };
+  struct node {
+    char		*level;		// One level of the pattern, can be "+" or "#"
+    int			len;
+    node		*child, *next;
+    handler		*handlers;
+  };
+
+  node			*root;
+
+  node *Child(node *parent, const char *level, int len, bool create);
+  int Match(node *n, const char *level, const char *topic, const char *payload);
+  int Call(node *n, const char *topic, const char *payload);
+  void Free(node *n);
+
+  const char		*topic_tag = "TopicTrie";
+};
+
+extern TopicTrie *topics;
+
+#endif	/* _TOPIC_TRIE_H_ */
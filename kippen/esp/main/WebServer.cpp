@@ -31,11 +31,13 @@
 #include "Kippen.h"
 #include "Network.h"
 #include "Secure.h"
+#include "Profiler.h"
 
 // Forward definitions of static functions
 esp_err_t alarm_handler(httpd_req_t *req);
 esp_err_t index_handler(httpd_req_t *req);
 esp_err_t wildcard_handler(httpd_req_t *req);
+esp_err_t stats_handler(httpd_req_t *req);
 esp_err_t WsNetworkConnected(void *ctx, system_event_t *event);
 esp_err_t WsNetworkDisconnected(void *ctx, system_event_t *event);
 
@@ -84,6 +86,11 @@ void WebServer::Start() {
   uri_hdl_def.uri = "/alarm";
   uri_hdl_def.handler = alarm_handler;
   httpd_register_uri_handler(server, &uri_hdl_def);
+
+  // Loop profile
+  uri_hdl_def.uri = "/stats";
+  uri_hdl_def.handler = stats_handler;
+  httpd_register_uri_handler(server, &uri_hdl_def);
 }
 
 WebServer::~WebServer() {
@@ -162,6 +169,47 @@ esp_err_t alarm_handler(httpd_req_t *req) {
   return ESP_OK;
 }
 
+/*
+ * Show the loop profile, one line per module
+ */
+esp_err_t stats_handler(httpd_req_t *req) {
+  int sock = httpd_req_to_sockfd(req);
+
+  if (! security->isPeerSecure(sock)) {
+    const char *reply = "Error: not authorized";
+    httpd_resp_set_status(req, "401 Not authorized");
+    httpd_resp_send(req, reply, strlen(reply));
+    return ESP_OK;
+  }
+
+  const char *head =
+    "<!DOCTYPE html>"
+    "<HTML>"
+    "<TITLE>ESP32 kippen controller</TITLE>\r\n"
+    "<BODY>"
+    "<H1>Loop profile</H1>\r\n"
+    "<PRE>\r\n";
+  const char *tail =
+    "</PRE>\r\n"
+    "</BODY>"
+    "</HTML>";
+
+  httpd_resp_send_chunk(req, head, strlen(head));
+
+  char line[100];
+  for (int i=0; profiler && i<profiler->getCount(); i++) {
+    int len = profiler->Format(i, line, sizeof(line) - 2);
+    if (len > (int)sizeof(line) - 3)
+      len = sizeof(line) - 3;
+    strcpy(line + len, "\r\n");
+    httpd_resp_send_chunk(req, line, len + 2);
+  }
+
+  httpd_resp_send_chunk(req, tail, strlen(tail));
+  httpd_resp_send_chunk(req, tail, 0);
+  return ESP_OK;
+}
+
 /*
  * Used by handlers after their processing, to send a normal page back to the user.
  * No status or error codes called.
@@ -200,9 +248,8 @@ void WebServer::SendPage(httpd_req_t *req) {
   char *buf2 = (char *)malloc(strlen(reply_template1) + 70);
   
   char ts[20];
-  struct timeval tv;
-  gettimeofday(&tv, 0);
-  struct tm *now = localtime(&tv.tv_sec);
+  time_t nowts = kippen->getCurrentTime();
+  struct tm *now = localtime(&nowts);
   strftime(ts, sizeof(ts)-1, "%F %R", now);
 
   sprintf(buf2, reply_template1, "kippen", ts);
@@ -39,11 +39,14 @@
 
 #include "ftpserv.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0x4000
-typedef void * gnutls_session_t;
 #endif
+typedef void * gnutls_session_t;
 
 void * x_malloc(size_t size);	// Forward declaration, avoid additional files
 
@@ -67,8 +70,41 @@ static const char *ftpcmds[MAX_CMDS] = {
  */
 #define FTP_PASSCMD_INDEX  13
 
+FTP_CONFIG g_cfg;
 unsigned int g_newid = 0;
 
+static char		transmit_pool[TRANSMIT_BUFFER_COUNT][TRANSMIT_BUFFER_SIZE];
+static int		transmit_busy[TRANSMIT_BUFFER_COUNT];
+static pthread_mutex_t	transmit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Get a data transfer buffer from the pool, NULL if they're all in use.
+ */
+char *transmit_buffer_get()
+{
+  char *r = NULL;
+
+  pthread_mutex_lock(&transmit_lock);
+  for (int i=0; i<TRANSMIT_BUFFER_COUNT; i++)
+    if (transmit_busy[i] == 0) {
+      transmit_busy[i] = 1;
+      r = transmit_pool[i];
+      break;
+    }
+  pthread_mutex_unlock(&transmit_lock);
+
+  return r;
+}
+
+void transmit_buffer_put(char *buffer)
+{
+  pthread_mutex_lock(&transmit_lock);
+  for (int i=0; i<TRANSMIT_BUFFER_COUNT; i++)
+    if (transmit_pool[i] == buffer)
+      transmit_busy[i] = 0;
+  pthread_mutex_unlock(&transmit_lock);
+}
+
 void delete_last_slash(char *s)
 {
   if (*s != 0)
@@ -620,7 +656,7 @@ int list_sub (char *dirname, SOCKET s, gnutls_session_t session, struct dirent *
 
     if (deltatime <= 180*24*60*60) {
       snprintf(text, sizeof(text), "%s %u %lu %lu %llu %s %02u %02u:%02u %s\r\n",
-        sacl, filestats.st_nlink,
+        sacl, (unsigned int)filestats.st_nlink,
         (unsigned long int)filestats.st_uid,
         (unsigned long int)filestats.st_gid,
         (unsigned long long int)filestats.st_size,
@@ -630,7 +666,7 @@ int list_sub (char *dirname, SOCKET s, gnutls_session_t session, struct dirent *
     else
     {
       snprintf(text, sizeof(text), "%s %u %lu %lu %llu %s %02u %02u %s\r\n",
-        sacl, filestats.st_nlink,
+        sacl, (unsigned int)filestats.st_nlink,
         (unsigned long int)filestats.st_uid,
         (unsigned long int)filestats.st_gid,
         (unsigned long long int)filestats.st_size,
@@ -794,19 +830,91 @@ int ftpCWD(PFTPCONTEXT context, const char *params)
   return sendstring(context, error550);
 }
 
+/*
+ * RETR double buffering : a reader task fills one half of the transfer buffer from the
+ * file while retr_thread sends the other half, so flash reads overlap with the network.
+ */
+typedef struct _RETR_PIPE {
+  int			File;
+  char			*Half[2];
+  ssize_t		Length[2];
+  size_t		Size;
+  volatile int		Stop;
+  SemaphoreHandle_t	Free, Filled, Done;
+} RETR_PIPE, *PRETR_PIPE;
+
+void retr_reader(void *p)
+{
+  PRETR_PIPE  pipe = (PRETR_PIPE)p;
+  ssize_t    sz;
+  int      i = 0;
+
+  do {
+    xSemaphoreTake(pipe->Free, portMAX_DELAY);
+    sz = pipe->Stop ? 0 : read(pipe->File, pipe->Half[i], pipe->Size);
+    pipe->Length[i] = sz;
+    xSemaphoreGive(pipe->Filled);
+    i ^= 1;
+  } while (sz > 0);
+
+  xSemaphoreGive(pipe->Done);
+  vTaskDelete(NULL);
+}
+
+int retr_reader_start(PRETR_PIPE pipe, int f, char *buffer, size_t buffer_size)
+{
+  memset(pipe, 0, sizeof(RETR_PIPE));
+  pipe->File = f;
+  pipe->Size = buffer_size / 2;
+  pipe->Half[0] = buffer;
+  pipe->Half[1] = buffer + pipe->Size;
+  pipe->Free = xSemaphoreCreateCounting(2, 2);
+  pipe->Filled = xSemaphoreCreateCounting(2, 0);
+  pipe->Done = xSemaphoreCreateBinary();
+
+  if (pipe->Free && pipe->Filled && pipe->Done &&
+      xTaskCreate(retr_reader, "FTP reader", FTP_READER_STACK, pipe,
+        2 | portPRIVILEGE_BIT, NULL) == pdPASS)
+    return 1;
+
+  if (pipe->Free)
+    vSemaphoreDelete(pipe->Free);
+  if (pipe->Filled)
+    vSemaphoreDelete(pipe->Filled);
+  if (pipe->Done)
+    vSemaphoreDelete(pipe->Done);
+  return 0;
+}
+
+/*
+ * Wait for the reader to end, it only looks at Stop after it got a free half : give it one.
+ */
+void retr_reader_stop(PRETR_PIPE pipe)
+{
+  pipe->Stop = 1;
+  xSemaphoreGive(pipe->Free);
+  xSemaphoreTake(pipe->Done, portMAX_DELAY);
+
+  vSemaphoreDelete(pipe->Free);
+  vSemaphoreDelete(pipe->Filled);
+  vSemaphoreDelete(pipe->Done);
+}
+
 void *retr_thread(PFTPCONTEXT context)
 {
   volatile SOCKET    clientsocket;
-  int          sent_ok, f;
+  int          sent_ok, f, i;
   off_t        offset;
   ssize_t        sz, sz_total;
   size_t        buffer_size;
   char        *buffer;
+  RETR_PIPE      reader;
   struct timespec    t;
   signed long long  lt0, lt1, dtx;
   // gnutls_session_t  TLS_datasession;
 
   f = -1;
+  clientsocket = INVALID_SOCKET;
   sent_ok = 0;
   sz_total = 0;
   buffer = NULL;
@@ -815,7 +923,7 @@ void *retr_thread(PFTPCONTEXT context)
   lt0 = t.tv_sec*1e9 + t.tv_nsec;
     dtx = t.tv_sec+30;
 
-  buffer = (char *)malloc(TRANSMIT_BUFFER_SIZE);
+  buffer = transmit_buffer_get();
   while (buffer != NULL)
   {
         clientsocket = create_datasocket(context);
@@ -843,17 +951,21 @@ void *retr_thread(PFTPCONTEXT context)
     if (offset != context->RestPoint)
       break;
 
-    while ( context->WorkerThreadAbort == 0 ) {
-      sz = read(f, buffer, buffer_size);
+    if (! retr_reader_start(&reader, f, buffer, buffer_size))
+      break;
+
+    for (i = 0; context->WorkerThreadAbort == 0; i ^= 1) {
+      xSemaphoreTake(reader.Filled, portMAX_DELAY);
+      sz = reader.Length[i];
       if (sz <= 0)
         break;
 
       sz_total += sz;
 
 #if 0
-      if (send_auto(clientsocket, TLS_datasession, buffer, sz) == sz)
+      if (send_auto(clientsocket, TLS_datasession, reader.Half[i], sz) == sz)
 #else
-      if (send_auto(clientsocket, 0, buffer, sz) == sz)
+      if (send_auto(clientsocket, 0, reader.Half[i], sz) == sz)
 #endif
         sent_ok = 1;
       else
@@ -861,6 +973,7 @@ void *retr_thread(PFTPCONTEXT context)
         sent_ok = 0;
         break;
       }
+      xSemaphoreGive(reader.Free);
 
             /* heartbeat to control channel */
             clock_gettime(CLOCK_MONOTONIC, &t);
@@ -871,6 +984,10 @@ void *retr_thread(PFTPCONTEXT context)
                writelogentry(context, "keepalive sent", "");
             }
     }
+    retr_reader_stop(&reader);
+
+    context->Transfers++;
+    context->BytesSent += sz_total;
 
     /* calculating performance */
 
@@ -890,7 +1007,7 @@ void *retr_thread(PFTPCONTEXT context)
   context->File = -1;
 
     if (buffer != NULL) {
-      free(buffer);
+      transmit_buffer_put(buffer);
     }
 
   if (clientsocket == INVALID_SOCKET) {
@@ -1255,6 +1372,7 @@ void *stor_thread(PFTPCONTEXT context)
   // gnutls_session_t  TLS_datasession;
 
   f = -1;
+  clientsocket = INVALID_SOCKET;
   sz_total = 0;
   buffer = NULL;
   // TLS_datasession = NULL;
@@ -1262,7 +1380,7 @@ void *stor_thread(PFTPCONTEXT context)
   lt0 = t.tv_sec*1e9 + t.tv_nsec;
     dtx = t.tv_sec+30;
 
-  buffer = (char *)malloc(TRANSMIT_BUFFER_SIZE);
+  buffer = transmit_buffer_get();
   while (buffer != NULL)
   {
         clientsocket = create_datasocket(context);
@@ -1309,6 +1427,9 @@ void *stor_thread(PFTPCONTEXT context)
             }
     }
 
+    context->Transfers++;
+    context->BytesReceived += sz_total;
+
     /* calculating performance */
 
     clock_gettime(CLOCK_MONOTONIC, &t);
@@ -1327,7 +1448,7 @@ void *stor_thread(PFTPCONTEXT context)
   context->File = -1;
 
   if (buffer != NULL) {
-      free(buffer);
+      transmit_buffer_put(buffer);
     }
 
   if (clientsocket == INVALID_SOCKET) {
@@ -1427,6 +1548,7 @@ void *append_thread(PFTPCONTEXT context)
   // gnutls_session_t  TLS_datasession;
 
   f = -1;
+  clientsocket = INVALID_SOCKET;
   sz_total = 0;
   buffer = NULL;
   // TLS_datasession = NULL;
@@ -1434,7 +1556,7 @@ void *append_thread(PFTPCONTEXT context)
   lt0 = t.tv_sec*1e9 + t.tv_nsec;
     dtx = t.tv_sec+30;
 
-  buffer = (char *)malloc(TRANSMIT_BUFFER_SIZE);
+  buffer = transmit_buffer_get();
   while (buffer != NULL)
   {
         clientsocket = create_datasocket(context);
@@ -1484,6 +1606,9 @@ void *append_thread(PFTPCONTEXT context)
             }
     }
 
+    context->Transfers++;
+    context->BytesReceived += sz_total;
+
     /* calculating performance */
 
     clock_gettime(CLOCK_MONOTONIC, &t);
@@ -1502,7 +1627,7 @@ void *append_thread(PFTPCONTEXT context)
   context->File = -1;
 
     if (buffer != NULL) {
-        free(buffer);
+        transmit_buffer_put(buffer);
     }
 
   if (clientsocket == INVALID_SOCKET) {
@@ -1981,7 +2106,9 @@ void *ftp_client_thread(SOCKET *s)
 
     WorkerThreadCleanup(&ctx);
 
-    writelogentry(&ctx, "User disconnected", "");
+    snprintf(rcvbuf, sizeof(rcvbuf), "User disconnected, %u transfers, %llu bytes sent, %llu bytes received",
+        ctx.Transfers, ctx.BytesSent, ctx.BytesReceived);
+    writelogentry(&ctx, rcvbuf, "");
     break;
   }
 
@@ -2026,13 +2153,17 @@ void ftpmain(void *p)
   rv = 1;
   setsockopt(ftpsocket, SOL_SOCKET, SO_REUSEADDR, &rv, sizeof(rv));
 
-  scb = (SOCKET *)x_malloc(sizeof(SOCKET)*5);
-  for (i = 0; i<5; i++)
+  /*
+   * Each session runs in its own task, at most g_cfg.MaxUsers of them. Data transfers
+   * run in the session's task, with buffers from the transmit pool.
+   */
+  scb = (SOCKET *)x_malloc(sizeof(SOCKET)*g_cfg.MaxUsers);
+  for (i = 0; i<g_cfg.MaxUsers; i++)
     scb[i] = INVALID_SOCKET;
 
   memset(&laddr, 0, sizeof(laddr));
   laddr.sin_family = AF_INET;
-  laddr.sin_port = htons(21);
+  laddr.sin_port = htons(g_cfg.Port);
   laddr.sin_addr.s_addr = 0;
   socketret = bind(ftpsocket, (struct sockaddr *)&laddr, sizeof(laddr));
   if  ( socketret != 0 ) {
@@ -2052,11 +2183,15 @@ void ftpmain(void *p)
  
     if (clientsocket != INVALID_SOCKET) {
       rv = -1;
-      for (i=0; i<5; i++) {
+      for (i=0; i<g_cfg.MaxUsers; i++) {
         if ( scb[i] == INVALID_SOCKET ) {
 
           scb[i] = clientsocket;
-	  ftp_client_thread(&scb[i]);
+          if (xTaskCreate(ftpclient_handler, "FTP session", FTP_SESSION_STACK, &scb[i],
+              2 | portPRIVILEGE_BIT, NULL) == pdPASS)
+            rv = 0;
+          else
+            scb[i] = INVALID_SOCKET;
           break;
         }
       }
@@ -2075,7 +2210,9 @@ void ftpmain(void *p)
 TaskHandle_t ftpTask;
 
 void ftp_init() {
-  xTaskCreate(ftpmain, "FTP server task", 12000, 0, 2 | portPRIVILEGE_BIT, &ftpTask);
+  g_cfg.MaxUsers = DEFAULT_MAX_USERS;
+  g_cfg.Port = DEFAULT_FTP_PORT;
+  xTaskCreate(ftpmain, "FTP server task", 6000, 0, 2 | portPRIVILEGE_BIT, &ftpTask);
 }
 
 void ftp_stop() {
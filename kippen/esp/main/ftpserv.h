@@ -35,8 +35,10 @@
 #ifndef FTPSERV_H_
 #define FTPSERV_H_
 
+#ifndef _GNU_SOURCE
 #define __USE_GNU
 #define _GNU_SOURCE
+#endif
 
 #include <limits.h>
 #include <stdint.h>
@@ -55,6 +57,7 @@
 #include <netinet/in.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include "sdkconfig.h"
 // #include <gnutls/gnutls.h>
 
 typedef struct _FTP_CONFIG {
@@ -71,6 +74,8 @@ typedef struct _FTP_CONFIG {
 #define	CONFIG_FILE_NAME		"fftp.conf"
 #define	CONFIG_SECTION_NAME		"ftpconfig"
 #define	DEFAULT_FTP_PORT		21
+#define	DEFAULT_MAX_USERS		2
+#define	FTP_SESSION_STACK		12000
 
 #define INVALID_SOCKET -1
 #define SOCKET	int
@@ -90,7 +95,18 @@ typedef struct _FTP_CONFIG {
 #define FTP_ACCESS_CREATENEW		2
 #define FTP_ACCESS_FULL				3
 
-#define TRANSMIT_BUFFER_SIZE	65536
+/*
+ * Data transfers use buffers from a small static pool instead of a malloc per transfer.
+ * They're sized to the LWIP TCP window, more can't be in flight on a data connection anyway.
+ * RETR splits its buffer in two halves : a reader task fills one while the other is sent.
+ */
+#ifdef CONFIG_TCP_WND_DEFAULT
+#define TRANSMIT_BUFFER_SIZE	CONFIG_TCP_WND_DEFAULT
+#else
+#define TRANSMIT_BUFFER_SIZE	5744
+#endif
+#define	TRANSMIT_BUFFER_COUNT	2
+#define	FTP_READER_STACK	4096
 
 static const unsigned long int	FTP_PATH_MAX = PATH_MAX;
 
@@ -121,6 +137,9 @@ typedef struct	_FTPCONTEXT {
 	char				CurrentDir[PATH_MAX];
 	char				RootDir[PATH_MAX];
 	char				*GPBuffer;
+	unsigned int		Transfers;
+	unsigned long long	BytesSent;
+	unsigned long long	BytesReceived;
 	// gnutls_session_t	TLS_session;
 } FTPCONTEXT, *PFTPCONTEXT;
 
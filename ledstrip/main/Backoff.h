@@ -0,0 +1,73 @@
+/*
+ * Reconnection backoff : wait longer after each consecutive failure, with random jitter
+ * so a group of nodes doesn't retry in lockstep, and keep statistics per cause.
+ *
+ * Copyright (c) 2020 Danny Backx
+ *
+ *
+ * License (GNU Lesser General Public License) :
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 3 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_BACKOFF_H_
+#define	_BACKOFF_H_
+
+#include <freertos/FreeRTOS.h>
+#include <stdint.h>
+
+class Backoff {
+public:
+  // Delays in ms : the first retry comes after base, doubling up to cap
+  Backoff(const char *name, int base = 1000, int cap = 300000);
+  ~Backoff();
+
+  void Failure(int cause);		// Schedule the next attempt
+  void Success();
+  void Attempt();			// A connection attempt was started
+  bool Due();				// Time for the next attempt ? Only returns true once
+  void Retry();				// Make the next attempt due right away
+
+  bool isWaiting();
+  int getFailures();			// Consecutive failures
+
+  int Format(char *buf, int len, const char *(*cause2string)(int));
+
+private:
+  enum { BO_IDLE, BO_WAITING, BO_TRYING } state;
+
+  const char	*name;
+  int		base, cap;
+  int		failures;
+  int64_t	next;			// ms since boot
+
+  uint32_t	attempts, successes;
+
+  static const int max_causes = 8;
+  struct {
+    int		cause;
+    uint32_t	count;
+  }		causes[max_causes];
+  int		ncauses;
+  uint32_t	other;			// Failures with a cause that didn't fit in the table
+
+  portMUX_TYPE	mux;
+
+  static int64_t Now();
+
+  const char	*backoff_tag = "Backoff";
+};
+
+#endif	/* _BACKOFF_H_ */
@@ -59,6 +59,9 @@ Mqtt::Mqtt() {
   mqttConnected = false;
   mqttSubscribed = false;
 
+  // Reports get queued from the start, they go out once MQTT is connected
+  pubq = new PublishQueue();
+
   network->RegisterModule(mqtt_tag, PeersNetworkConnected, PeersNetworkDisconnected);
 }
 
@@ -80,6 +83,7 @@ esp_err_t PeersNetworkConnected(void *ctx, system_event_t *event) {
 
   // Note Tuan's MQTT component starts a separate task for event handling
   mqtth = esp_mqtt_client_init(&mqtt_config);
+  mqtt->pubq->setClient(mqtth);
   esp_err_t err = esp_mqtt_client_start(mqtth);
 
   if (err == ESP_OK)
@@ -98,6 +102,7 @@ esp_err_t PeersNetworkDisconnected(void *ctx, system_event_t *event) {
   if (mqtt) {
     esp_err_t err = esp_mqtt_client_stop(mqtth);
     mqtt->mqttConnected = false;
+    mqtt->pubq->Connected(false);
     ESP_LOGD(mqtt->mqtt_tag, "MQTT Client Stop : %d %s", (int)err,
       (err == ESP_OK) ? "ok" : (err == ESP_FAIL) ? "fail" : "?");
   }
@@ -139,6 +144,7 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
     conn_ts = esp_timer_get_time();
     if (mqtt) {
       mqtt->mqttConnected = true;
+      mqtt->pubq->Connected(true);
       mqtt->mqttSubscribe();
     } else {
       // This should not happen, there's almost nothing after mqtt startup in our ctor
@@ -156,8 +162,10 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
       }
     }
     ESP_LOGE(mqtt_tag, "disconnected");
-    if (mqtt)
+    if (mqtt) {
       mqtt->mqttConnected = false;
+      mqtt->pubq->Connected(false);
+    }
     network->mqttDisconnected();
     break;
   case MQTT_EVENT_SUBSCRIBED:
@@ -279,6 +287,12 @@ static void PeersNetworkHandler(const char *payload) {
     ESP_LOGE(mqtt_tag, "Could not get network info");
 }
 
+static void PeersBackoffHandler(const char *payload) {
+  char reply[200];
+  network->FormatBackoff(reply, sizeof(reply));
+  esp_mqtt_client_publish(mqtth, mqtt->reply_topic, reply, 0, 0, 0);
+}
+
 void PeersWifiHandler(const char *payload) {
   mqtt->GetWifiInfo();
 }
@@ -292,6 +306,7 @@ struct payload_handler_table {
   { "boot",		0,	PeersBootHandler },
   { "time",		0,	PeersTimeHandler },
   { "network",		0,	PeersNetworkHandler },
+  { "backoff",		0,	PeersBackoffHandler },
   { NULL,		0,	NULL }
 };
 
@@ -331,14 +346,15 @@ void Mqtt::mqttSubscribe() {
   }
 }
 
-bool Mqtt::Report(const char *msg) {
-  if (mqttConnected) {
-    esp_mqtt_client_publish(mqtth, reply_topic, msg, 0, 0, 0);
-    // ESP_LOGE(mqtt_tag, "Reporting via MQTT: %s", msg);
+/*
+ * Queue a message for the reply topic, the PublishQueue task sends it when MQTT is up.
+ * Pass a key for state messages : a newer one replaces a pending message with the same key.
+ */
+bool Mqtt::Report(const char *msg, const char *key) {
+  if (pubq->Publish(reply_topic, msg, 0, key))
     return true;
-  }
 
-  ESP_LOGI(mqtt_tag, "Report: mqtt not connected yet (msg %s)", msg);
+  ESP_LOGE(mqtt_tag, "Report: could not queue msg %s", msg);
   return false;
 }
 
@@ -25,6 +25,7 @@
 
 #include "App.h"
 #include <esp_event.h>
+#include "PublishQueue.h"
 
 #include <list>
 using namespace std;
@@ -35,12 +36,13 @@ public:
   ~Mqtt();
   void loop(time_t);
 
-  bool Report(const char *msg);
+  bool Report(const char *msg, const char *key = 0);
   void timeString(time_t t, const char *format, char *buffer, int len);
 
   void mqttSubscribe();
   void mqttReconnect();
   bool	 mqttConnected, mqttSubscribed;
+  PublishQueue	*pubq;
 
   friend void PeersWifiHandler(const char *payload);
   friend void PeersNodesHandler(const char *payload);
@@ -36,19 +36,19 @@
 #include <esp_event_legacy.h>
 #include "esp_wpa2.h"
 
-Network::Network() {
+Network::Network() : wifi_backoff("wifi") {
   reconnect_interval = 30;
 
   status = NS_NONE;
 
   last_mqtt_message_received = 0;
+  mqtt_failures = 0;
 }
 
 Network::Network(const char *name,
     esp_err_t (*nc)(void *, system_event_t *),
     esp_err_t (*nd)(void *, system_event_t *),
-    void (*ts)(struct timeval *)) {
-  Network();
+    void (*ts)(struct timeval *)) : Network() {
   struct module_registration *mr = new module_registration(name, nc, nd, ts);
   RegisterModule(mr);
 }
@@ -164,6 +164,14 @@ static const char *WifiReason2String(int r) {
   }
 }
 
+static const char *Cause2String(int c) {
+  switch (c) {
+  case NC_MQTT:					return "MQTT";
+  case NC_OTHER:				return "OTHER";
+  default:					return WifiReason2String(c);
+  }
+}
+
 esp_err_t wifi_event_handler(void *ctx, system_event_t *event) {
   ESP_LOGD(snetwork_tag, "wifi_event_handler(%d,%s)", event->event_id, EventId2String(event->event_id));
 
@@ -237,10 +245,8 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event) {
 	  break;
 	}
 
-	// Trigger next try
-	network->setStatus(NS_SETUP_DONE);
-	network->SetupWifi();
-        network->WaitForWifi();
+	// Trigger next try, after a delay that grows with each failure
+	network->ScheduleRestartWifi(evp->reason);
       } else {
 	/*
 	 * We were connected but lost the network. So gracefully shut down open connections,
@@ -250,7 +256,9 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event) {
 
 	if (network) network->NetworkDisconnected(ctx, event);
 
-        network->StopWifi();			// This also schedules a restart
+	// This also schedules a restart
+        network->StopWifi((network->mqtt_failures >= Network::mqtt_escalate) ? NC_MQTT
+	  : event->event_info.disconnected.reason);
       }
       break;
 
@@ -310,6 +318,7 @@ void Network::WaitForWifi(void)
   esp_err_t err;
 
   ESP_LOGI(network_tag, "Waiting for wifi");
+  wifi_backoff.Attempt();
  
   for (int ix = 0; mywifi[ix].ssid != 0; ix++) {
     if (mywifi[ix].discard) {
@@ -457,9 +466,12 @@ void Network::WaitForWifi(void)
 void Network::setWifiOk(bool ok) {
   wifi_ok = ok;
   status = NS_RUNNING;
+  mqtt_failures = 0;
+  if (ok)
+    wifi_backoff.Success();
 }
 
-void Network::StopWifi() {
+void Network::StopWifi(int cause) {
   esp_err_t err;
 
   ESP_LOGI(network_tag, "StopWifi");
@@ -476,6 +488,9 @@ void Network::StopWifi() {
   if (err != ESP_OK)
     ESP_LOGE(network_tag, "%s: esp_wifi_deinit failed, reason %d (%s)", __FUNCTION__,
       err, esp_err_to_name(err));
+
+  status = NS_FAILED;
+  ScheduleRestartWifi(cause);
 }
 
 /*
@@ -553,6 +568,7 @@ void Network::NetworkDisconnected(void *ctx, system_event_t *event) {
  * Check whether the broadcast at startup to find peers was succesfull.
  */
 void Network::loop(time_t now) {
+  LoopRestartWifi(now);
 }
 
 bool Network::isConnected() {
@@ -587,10 +603,20 @@ void Network::mqttDisconnected() {
   if (mqtt_message < 3)
     ESP_LOGE(network_tag, "MQTT disconnected");
   mqtt_message++;
+
+  /*
+   * The MQTT client reconnects by itself. Only when it keeps failing while Wi-Fi looks fine,
+   * assume the connection is stale : disconnect, the event handler takes it from there.
+   */
+  if (status == NS_RUNNING && ++mqtt_failures == mqtt_escalate) {
+    ESP_LOGE(network_tag, "Network:mqttDisconnected %d times -> disconnect", mqtt_failures);
+    esp_wifi_disconnect();
+  }
 }
 
 void Network::mqttConnected() {
   ESP_LOGD(network_tag, "MQTT connected");
+  mqtt_failures = 0;
 }
 
 void Network::gotMqttMessage() {
@@ -599,12 +625,29 @@ void Network::gotMqttMessage() {
   last_mqtt_message_received = stableTime->Query();
 }
 
+/*
+ * (delayed) Restart handler : wait longer after each consecutive failure, see Backoff.
+ * Called from the event handler, the restart itself happens in loop().
+ */
+void Network::ScheduleRestartWifi(int cause) {
+  wifi_backoff.Failure(cause);
+}
+
+void Network::LoopRestartWifi(time_t now) {
+  if (wifi_backoff.Due())
+    RestartWifi();
+}
+
 void Network::RestartWifi() {
   ESP_LOGI(network_tag, "RestartWifi");
 
   esp_wifi_stop();
   SetupWifi();
   WaitForWifi();
+
+  // Nothing to wait for, so no event will get us going again
+  if (status != NS_CONNECTING)
+    ScheduleRestartWifi(NC_OTHER);
 }
 
 bool Network::NetworkIsNatted() {
@@ -672,3 +715,10 @@ void Network::RegisterModule(const char *name,
 
   RegisterModule(mr);
 }
+
+/*
+ * Reconnect statistics : success rate, current backoff, and why connections failed.
+ */
+void Network::FormatBackoff(char *buf, int len) {
+  wifi_backoff.Format(buf, len, Cause2String);
+}
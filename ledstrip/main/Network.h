@@ -24,6 +24,7 @@
 #define	_MY_NETWORK_H_
 
 #include <esp_event_loop.h>
+#include "Backoff.h"
 
 #include <list>
 using namespace std;
@@ -36,6 +37,12 @@ enum NetworkStatus {
   NS_FAILED		// We got completely disconnected
 };
 
+// Reconnect causes other than the Wi-Fi disconnect reasons
+enum {
+  NC_MQTT = -1,		// Too many MQTT failures in a row
+  NC_OTHER = -2
+};
+
 /*
  * This allows other modules of the application to be network aware
  */
@@ -105,6 +112,8 @@ public:
   void setReason(int);
   void DiscardCurrentNetwork();
 
+  void FormatBackoff(char *buf, int len);
+
   void RegisterModule(module_registration);
   void RegisterModule(module_registration *);
   void RegisterModule(const char *,
@@ -128,13 +137,15 @@ private:
   // MQTT
   time_t			last_mqtt_message_received;
   uint				mqtt_message;
+  int				mqtt_failures;		// In a row
+  static const int		mqtt_escalate = 5;	// Then restart Wi-Fi
 
   // Restart
-  time_t			restart_time;
+  Backoff			wifi_backoff;
 
   void LoopRestartWifi(time_t now);
-  void ScheduleRestartWifi();
-  void StopWifi();
+  void ScheduleRestartWifi(int cause);
+  void StopWifi(int cause);
   void RestartWifi();
 
   // Modules interested in network events
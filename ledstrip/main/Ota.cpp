@@ -1,6 +1,8 @@
 /*
  * This module implements a small web server, with specific stuff to implement OTA.
  *   curl -X POST -T build/ledstrip.bin http://esp/update
+ * or, to have the image hash checked before it becomes bootable :
+ *   curl -X POST -H "X-SHA256: $(sha256sum build/ledstrip.bin | cut -c1-64)" -T build/ledstrip.bin http://esp/update
  *
  * Copyright (c) 2019, 2020 Danny Backx
  *
@@ -30,6 +32,9 @@
 #include "Network.h"
 #include <sys/socket.h>
 #include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include "StableTime.h"
 
 // Forward definitions of static functions
@@ -70,15 +75,159 @@ Ota::~Ota() {
     httpd_stop(server);
 }
 
-static char *memmem(char *haystack, int hsl, char *needle, int nl) {
-  for (int i=0; i<hsl - nl + 1; i++)
-    if (strncmp(haystack+i, needle, nl) == 0)
-      return haystack+i;
-  return 0;
+/*
+ * OTA pipeline : the httpd task receives and strips the multipart envelope, a writer
+ * task does esp_ota_write() and the SHA-256, so flash writes overlap with the network.
+ * Two buffers go back and forth between them through a pair of queues.
+ */
+#define	OTA_BUFSIZE	4096		// One flash sector
+#define	OTA_NBUFS	2
+#define	OTA_RECVSIZE	1460		// One TCP segment
+#define	OTA_MAX_TIMEOUTS	10
+
+struct ota_buf {
+  int		len;
+  char		data[OTA_BUFSIZE];
+};
+
+struct ota_pipe {
+  QueueHandle_t		full, empty;
+  SemaphoreHandle_t	done;
+  esp_ota_handle_t	handle;
+  mbedtls_sha256_context sha;
+  esp_err_t		err;		// First write error, set by the writer
+  int			written;
+  ota_buf		*cur;		// Being filled by the receiver
+};
+
+static void OtaWriterTask(void *ptr) {
+  ota_pipe *pp = (ota_pipe *)ptr;
+  ota_buf *b;
+
+  while (1) {
+    xQueueReceive(pp->full, &b, portMAX_DELAY);
+    if (b == 0)			// End marker
+      break;
+
+    if (pp->err == ESP_OK) {
+      esp_err_t err = esp_ota_write(pp->handle, b->data, b->len);
+      if (err != ESP_OK) {
+        ESP_LOGE(swebserver_tag, "Failed to write OTA, %d %s", err, esp_err_to_name(err));
+	pp->err = err;
+      } else {
+        mbedtls_sha256_update_ret(&pp->sha, (const unsigned char *)b->data, b->len);
+	pp->written += b->len;
+      }
+    }
+
+    b->len = 0;
+    xQueueSend(pp->empty, &b, portMAX_DELAY);
+  }
+
+  xSemaphoreGive(pp->done);
+  vTaskDelete(NULL);
+}
+
+// Queue data for the writer, waits for a free buffer if both are in use
+static void OtaEmit(ota_pipe *pp, const char *data, int len) {
+  while (len > 0) {
+    if (pp->cur == 0)
+      xQueueReceive(pp->empty, &pp->cur, portMAX_DELAY);
+
+    int n = OTA_BUFSIZE - pp->cur->len;
+    if (n > len)
+      n = len;
+    memcpy(pp->cur->data + pp->cur->len, data, n);
+    pp->cur->len += n;
+    data += n;
+    len -= n;
+
+    if (pp->cur->len == OTA_BUFSIZE) {
+      xQueueSend(pp->full, &pp->cur, portMAX_DELAY);
+      pp->cur = 0;
+    }
+  }
+}
+
+/*
+ * Streaming multipart/form-data parser : skip the part headers, pass on the data
+ * up to the "\r\n--boundary" delimiter. Without a boundary, the whole body is data.
+ * Works on any split of the input, only a partial delimiter match is held back.
+ */
+enum { MP_HEADERS, MP_DATA, MP_DONE };
+
+struct multipart {
+  int		state;
+  char		*delim;
+  int		dlen;
+  int		match;		// Bytes of the delimiter (or the CRLFCRLF) seen so far
+};
+
+static void MultipartFeed(multipart *mp, ota_pipe *pp, const char *in, int len) {
+  static const char *crlfcrlf = "\r\n\r\n";
+  int i = 0;
+
+  if (mp->delim == 0) {		// Raw upload
+    OtaEmit(pp, in, len);
+    return;
+  }
+
+  while (i < len && mp->state == MP_HEADERS) {
+    if (in[i++] == crlfcrlf[mp->match]) {
+      if (++mp->match == 4) {
+        mp->state = MP_DATA;
+	mp->match = 0;
+      }
+    } else
+      mp->match = (in[i-1] == '\r') ? 1 : 0;
+  }
+
+  int start = i;	// Start of the data run not passed on yet
+  while (i < len && mp->state == MP_DATA) {
+    if (mp->match == 0) {
+      // Fast path : everything up to the next CR is data
+      const char *cr = (const char *)memchr(in + i, '\r', len - i);
+      if (cr == 0) {
+        i = len;
+	break;
+      }
+      i = cr - in;
+    }
+
+    if (in[i] == mp->delim[mp->match]) {
+      if (mp->match == 0 && i > start)
+        OtaEmit(pp, in + start, i - start);
+      i++;
+      if (++mp->match == mp->dlen)
+        mp->state = MP_DONE;
+      start = i;
+    } else {
+      // False alarm : what we held back was data after all. CR only starts the delimiter.
+      OtaEmit(pp, mp->delim, mp->match);
+      mp->match = 0;
+      start = i;
+    }
+  }
+
+  if (mp->state == MP_DATA && mp->match == 0 && i > start)
+    OtaEmit(pp, in + start, i - start);
+}
+
+static char *GetHeader(httpd_req_t *req, const char *var) {
+  size_t vl = httpd_req_get_hdr_value_len(req, var);
+  if (vl == 0)
+    return 0;
+
+  char *vv = (char *)malloc(vl + 1);
+  httpd_req_get_hdr_value_str(req, var, vv, vl + 1);
+  ESP_LOGD(swebserver_tag, "%s : %s", var, vv);
+  return vv;
 }
 
 /*
  * OTA
+ *   Either a raw body (curl -T) or multipart/form-data (a browser, curl -F).
+ *   An optional X-SHA256 header holds the expected image hash in hex.
  */
 esp_err_t update_handler(httpd_req_t *req) {
   int sock = httpd_req_to_sockfd(req);
@@ -95,7 +244,6 @@ esp_err_t update_handler(httpd_req_t *req) {
 
   const esp_partition_t *configured = esp_ota_get_boot_partition();
   const esp_partition_t *running = esp_ota_get_running_partition();
-  esp_ota_handle_t update_handle = 0;
 
   if (configured != running) {
     ESP_LOGE(swebserver_tag, "Configured != running --> fix this first");
@@ -103,190 +251,135 @@ esp_err_t update_handler(httpd_req_t *req) {
     return ESP_FAIL;
   }
 
-  size_t vl;
-  const char *var = "Content-Length";
-  vl = httpd_req_get_hdr_value_len(req, var);
-  if (vl != 0) {
-    char *vv = (char *)malloc(vl + 3);
-    httpd_req_get_hdr_value_str(req, var, vv, vl+2);
-    ESP_LOGD(swebserver_tag, "%s : %s", var, vv);
-    free((void *)vv);
+  multipart mp;
+  mp.state = MP_DATA;
+  mp.delim = 0;
+  mp.dlen = mp.match = 0;
+
+  char *ct = GetHeader(req, "Content-Type");
+  char *boundary = ct ? strstr(ct, "boundary=") : 0;
+  if (boundary != 0) {
+    boundary += 9;
+    // The body starts with "--boundary", the data ends at "\r\n--boundary"
+    mp.dlen = strlen(boundary) + 4;
+    mp.delim = (char *)malloc(mp.dlen + 1);
+    sprintf(mp.delim, "\r\n--%s", boundary);
+    mp.state = MP_HEADERS;
+    ESP_LOGD(swebserver_tag, "Boundary {%s}", boundary);
   }
+  if (ct)
+    free(ct);
 
-  char *boundary = 0;
-  var = "Content-Type";
-  vl = httpd_req_get_hdr_value_len(req, var);
-  if (vl != 0) {
-    char *vv = (char *)malloc(vl + 3);
-    httpd_req_get_hdr_value_str(req, var, vv, vl+2);
-    ESP_LOGD(swebserver_tag, "%s : %s", var, vv);
-
-    boundary = strstr(vv, "boundary=");
-    if (boundary != 0) {
-      char *p = boundary + 9;
-      int len = strlen(p);
-      boundary = (char *)malloc(len+1);
-      strcpy(boundary, p);
-      ESP_LOGD(swebserver_tag, "Boundary {%s}", boundary);
-    }
-
-    free((void *)vv);
-  }
+  char *expected = GetHeader(req, "X-SHA256");
 
   const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
-  char line[80];
+  char line[160];
   sprintf(line, "OTA : writing to partition subtype %d at offset 0x%x (%s)",
     update_partition->subtype, update_partition->address, stableTime->TimeStamp());
   ESP_LOGI(swebserver_tag, "%s", line);
   mqtt->Report(line);
 
-  esp_err_t err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-  if (err != ESP_OK) {
-    ESP_LOGE(swebserver_tag, "esp_ota_begin failed, %d %s", err, esp_err_to_name(err));
+  ota_pipe pp;
+  memset(&pp, 0, sizeof(pp));
+  pp.err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &pp.handle);
+  if (pp.err != ESP_OK) {
+    ESP_LOGE(swebserver_tag, "esp_ota_begin failed, %d %s", pp.err, esp_err_to_name(pp.err));
+    free(mp.delim);
+    free(expected);
     OTAbusy = false;
     return ESP_FAIL;
   }
+  mbedtls_sha256_init(&pp.sha);
+  mbedtls_sha256_starts_ret(&pp.sha, 0);
+
+  pp.full = xQueueCreate(OTA_NBUFS + 1, sizeof(ota_buf *));
+  pp.empty = xQueueCreate(OTA_NBUFS, sizeof(ota_buf *));
+  pp.done = xSemaphoreCreateBinary();
+  ota_buf *bufs[OTA_NBUFS];
+  for (int i=0; i<OTA_NBUFS; i++) {
+    bufs[i] = (ota_buf *)calloc(1, sizeof(ota_buf));
+    xQueueSend(pp.empty, &bufs[i], 0);
+  }
+  xTaskCreate(OtaWriterTask, "OTA writer", 4096, &pp, uxTaskPriorityGet(NULL), NULL);
 
-  int		buflen = 1560;	// Larger than official Ethernet MTU, this should be a good start
-  char		*buf = (char *)malloc(buflen + 1);
-  int		ret;
-
+  char		*buf = (char *)malloc(OTA_RECVSIZE);
   int		remain = req->content_len;
-  int		offset = 0;
+  int		timeouts = 0;
+  const char	*failure = 0;
 
   ESP_LOGD(swebserver_tag, "Receiving (req content-len %d)", remain);
-  while (remain > 0) {
-    int len = remain;
-    if (buflen < len)
-      len = buflen;
-
-/*
- * Sometimes we fail here :
- * E (3773882) Ota: httpd_req_recv failed, 0 ESP_OK
- * W (3773882) httpd_uri: httpd_uri: uri handler execution failed
- */
-    if ((ret = httpd_req_recv(req, buf, len)) <= 0) {
-      if (ret == HTTPD_SOCK_ERR_TIMEOUT)
-        // retry
-	continue;
-
-      free(buf);
-      sprintf(line, "OTA : httpd_req_recv failed, %d %s, len %d", ret, esp_err_to_name(ret), len);
-      mqtt->Report(line);
-      ESP_LOGE(swebserver_tag, "httpd_req_recv failed, %d %s, len %d", ret, esp_err_to_name(ret), len);
-      OTAbusy = false;
-      return ESP_FAIL;	// Fail in other cases than timeout
-    }
-
-    // Skip initial headers, until 2x CRLR (0x0D 0x0A 0x0D 0x0A)
-    char *ptr = buf;
-    if (offset == 0) {
-      int i;
-      for (i=0; i<ret-3; i++) {
-        if (buf[i] == 0x0D && buf[i+1] == 0x0A && buf[i+2] == 0x0D && buf[i+3] == 0x0A) {
-	  ptr = &buf[i+4];
-	  ret -= i+4;
-
-	  // Start counting from here
-	  remain = req->content_len;
-	  remain += 500;	// HACK
-
-	  break;
-	}
-      }
-    }
-
-    ESP_LOGD(swebserver_tag, "Received %d, remain %d", ret, remain-ret);
-
-    int pos = 0;
-    if (boundary && (remain < 10000)) {
-      ESP_LOGE(swebserver_tag, "Checking boundary (offset %d), received %d, remain %d",
-        offset, ret, remain-ret);
-
-      char *p = memmem(ptr, ret, boundary, strlen(boundary));
-      if (p != 0) {
-        pos = p - ptr;
-	if (0 < pos && pos < ret) {
-	  ESP_LOGE(swebserver_tag, "End of message at offset %d, %04X", offset, pos);
-	  ret = pos - 2;	// Remove CR-LF that precedes the boundary
-
-	  // Write last piece
-	  err = esp_ota_write(update_handle, ptr, ret);
-	  if (err != ESP_OK) {
-	    ESP_LOGE(swebserver_tag, "Failed to write OTA, %d %s", err, esp_err_to_name(err));
-	    free(buf);
-	    if (boundary)
-	      free((void *)boundary);
-	    OTAbusy = false;
-	    return ESP_FAIL;
-	  }
-
-	  remain -= ret;
-	  offset += ret;
-
-	  break;
-	}
-#if 1
-      } else {
-	if (remain < 2500) {
-	  char line[120];
-	  line[0] = 0;
-	  for (int i=0; i<ret; i++) {
-	    if ((i % 32) == 0) {
-	      if (i > 0)
-		ESP_LOGE(swebserver_tag, "recv %s", line);
-	      sprintf(line, "%04X ", i);
-	    }
-	    char x[4];
-	    sprintf(x, "%02x ", 255 & ptr[i]);
-	    strcat(line, x);
-	  }
-	  ESP_LOGE(swebserver_tag, "recv %s", line);
-	}
-
-#endif
-      }
+  while (remain > 0 && pp.err == ESP_OK) {
+    int ret = httpd_req_recv(req, buf, (remain < OTA_RECVSIZE) ? remain : OTA_RECVSIZE);
+
+    if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < OTA_MAX_TIMEOUTS)
+      continue;
+    if (ret <= 0) {
+      sprintf(line, "OTA : httpd_req_recv failed, %d %s, remain %d", ret, esp_err_to_name(ret), remain);
+      ESP_LOGE(swebserver_tag, "%s", line);
+      failure = line;
+      break;
     }
 
+    timeouts = 0;
     remain -= ret;
-    offset += ret;
-
-    err = esp_ota_write(update_handle, ptr, ret);
-    if (err != ESP_OK) {
-      ESP_LOGE(swebserver_tag, "Failed to write OTA, %d %s", err, esp_err_to_name(err));
-      free(buf);
-      if (boundary)
-        free((void *)boundary);
-      return ESP_FAIL;
-    }
-
-    if (pos > 0)
-      break;
-
-    vTaskDelay(1);
+    if (mp.state != MP_DONE)
+      MultipartFeed(&mp, &pp, buf, ret);
   }
-
-  ESP_LOGI(swebserver_tag, "Bytes received : %d", offset);
-
-  httpd_resp_send_chunk(req, NULL, 0);
   free(buf);
-  if (boundary)
-    free((void *)boundary);
 
-  err = esp_ota_end(update_handle);
-  if (err != ESP_OK) {
+  // Flush, stop the writer, and wait until it has written everything
+  if (pp.cur && pp.cur->len > 0)
+    xQueueSend(pp.full, &pp.cur, portMAX_DELAY);
+  ota_buf *end = 0;
+  xQueueSend(pp.full, &end, portMAX_DELAY);
+  xSemaphoreTake(pp.done, portMAX_DELAY);
+
+  for (int i=0; i<OTA_NBUFS; i++)
+    free(bufs[i]);
+  vQueueDelete(pp.full);
+  vQueueDelete(pp.empty);
+  vSemaphoreDelete(pp.done);
+
+  unsigned char sha[32];
+  char hex[65];
+  mbedtls_sha256_finish_ret(&pp.sha, sha);
+  mbedtls_sha256_free(&pp.sha);
+  for (int i=0; i<32; i++)
+    sprintf(hex + 2*i, "%02x", sha[i]);
+
+  ESP_LOGI(swebserver_tag, "Bytes written : %d, sha256 %s", pp.written, hex);
+
+  if (failure == 0 && pp.err != ESP_OK)
+    failure = "OTA : flash write failed";
+  if (failure == 0 && mp.delim != 0 && mp.state != MP_DONE)
+    failure = "OTA : multipart body ended without boundary";
+  if (failure == 0 && expected != 0 && strcasecmp(expected, hex) != 0)
+    failure = "OTA : SHA-256 mismatch";
+
+  free(mp.delim);
+  free(expected);
+
+  esp_err_t err = esp_ota_end(pp.handle);
+  if (failure == 0 && err != ESP_OK) {
     ESP_LOGE(swebserver_tag, "OTA failed, %d %s", err, esp_err_to_name(err));
-    OTAbusy = false;
-    return ESP_FAIL;
+    failure = "OTA : image verification failed";
   }
-  err = esp_ota_set_boot_partition(update_partition);
-  if (err != ESP_OK) {
+  if (failure == 0 && (err = esp_ota_set_boot_partition(update_partition)) != ESP_OK) {
     ESP_LOGE(swebserver_tag, "OTA set bootable failed, %d %s", err, esp_err_to_name(err));
+    failure = "OTA : set bootable failed";
+  }
+
+  if (failure) {
+    ESP_LOGE(swebserver_tag, "%s", failure);
+    mqtt->Report(failure);
+    httpd_resp_set_status(req, HTTPD_500);
+    httpd_resp_send(req, failure, strlen(failure));
     OTAbusy = false;
-    return ESP_FAIL;
+    return ESP_OK;
   }
 
-  sprintf(line, "OTA success, rebooting (%s)", stableTime->TimeStamp());
+  sprintf(line, "OTA success, %d bytes, sha256 %s, rebooting (%s)", pp.written, hex, stableTime->TimeStamp());
+  httpd_resp_send(req, line, strlen(line));
   mqtt->Report(line);
   vTaskDelay(500);
 
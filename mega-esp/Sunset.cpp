@@ -20,40 +20,19 @@
  *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *   THE SOFTWARE.
  *
- * This contains code to query the API server at api.sunrise-sunset.org .
+ * This calculates sunrise, sunset and civil twilight locally from latitude/longitude
+ * and the date, so no REST query to api.sunrise-sunset.org is needed anymore.
  * Notes :
- * - This needs a patch to esp-link/el-client to cope with reply length ~500 bytes.
- * - All times in GMT so timezone and DST must still be applied.
- *   This is now treated very simply by adding a hardcoded value right before
+ * - Formulas from the NOAA "General Solar Position Calculations",
+ *   see https://gml.noaa.gov/grad/solcalc/solareqns.PDF . Accurate to about a minute.
+ * - Times are calculated in GMT so the timezone must still be applied.
+ *   This is treated very simply by adding personal_timezone right before
  *   storing the times in private variables.
- *
- * See http://www.sunrise-sunset.org
- *
- * Example call : http://api.sunrise-sunset.org/json?lat=36.7201600&lng=-4.4203400&formatted=0
- *
- * Example reply (spacing added for clarity) :
- *	{
- *	  "results":
- *	  {
- *	    "sunrise":"2015-05-21T05:05:35+00:00",
- *	    "sunset":"2015-05-21T19:22:59+00:00",
- *	    "solar_noon":"2015-05-21T12:14:17+00:00",
- *	    "day_length":51444,
- *	    "civil_twilight_begin":"2015-05-21T04:36:17+00:00",
- *	    "civil_twilight_end":"2015-05-21T19:52:17+00:00",
- *	    "nautical_twilight_begin":"2015-05-21T04:00:13+00:00",
- *	    "nautical_twilight_end":"2015-05-21T20:28:21+00:00",
- *	    "astronomical_twilight_begin":"2015-05-21T03:20:49+00:00",
- *	    "astronomical_twilight_end":"2015-05-21T21:07:45+00:00"
- *	  },
- *	  "status":"OK"
- *	}
  */
 #include <Arduino.h>
 
 #include <ELClient.h>
 #include <ELClientCmd.h>
-#include <ELClientRest.h>
 #include <ELClientMqtt.h>
 
 #include "SFE_BMP180.h"
@@ -64,96 +43,70 @@
 #include "Sunset.h"
 #include "global.h"
 
-extern ELClient esp;
-
-char *ss_url = "api.sunrise-sunset.org";
-char *ss_template = "/json?lat=%s&lng=%s&formatted=0";
-
-static char *buf = 0;
-static int bufsiz = 700;
+// Zenith angles in degrees : official sunrise/sunset includes refraction, civil twilight is -6
+#define	ZENITH_OFFICIAL	90.833
+#define	ZENITH_CIVIL	96.0
 
 Sunset::Sunset() {
-  rest = 0;	// Don't do more here, keep CTOR and rest->begin() together
   today = 0;
   stable = LIGHT_NONE;
+  sunrise = sunset = twilight_begin = twilight_end = 0;
 }
 
 Sunset::~Sunset() {
-  delete rest;
-  rest = 0;
 }
 
 void Sunset::query(char *lat, char *lon, char *msg) {
   this->lat = lat;
   this->lon = lon;
 
-  if (rest == 0) {
-    rest = new ELClientRest(&esp);
-    if (rest == 0) {
-      Serial.println("Sunset : could not create REST api");
-      return;
-    }
-    int err = rest->begin(ss_url);
-    if (err != 0) {
-      delete rest;
-      rest = 0;
-
-      Serial.print("Sunset : could not initialize ");
-      Serial.print(ss_url);
-      Serial.print(" , error code ");
-      Serial.println(err);
-      return;
-    }
-
-    Serial.print("Sunset : initialized ");
-    if (msg != NULL) {
-      Serial.print("(");
-      Serial.print(msg);
-      Serial.print(") ");
-    }
-    Serial.println(ss_url);
+  Serial.print("Sunset : calculate ");
+  if (msg != NULL) {
+    Serial.print("(");
+    Serial.print(msg);
+    Serial.print(") ");
   }
 
-  if (buf == 0)
-    buf = (char *)malloc(bufsiz);
-
-  sprintf(buf, ss_template, lat, lon);
-  rest->get(buf);
+  Calculate(now());
 
-  uint16_t totalLen = 0, packetLen = 0;
-  memset(buf, 0, bufsiz);
-  char *ptr = buf;
-  int err = rest->waitResponse2(ptr, bufsiz-1, &totalLen, &packetLen);
-  while (totalLen) {
-    ptr += packetLen;
-    err = rest->waitResponse2(ptr, bufsiz-1, &totalLen, &packetLen);
-  }
-  if (err == HTTP_STATUS_OK) {
-    Serial.print("Sunset success ");
-
-    sunrise = String2Time(findData(buf, "sunrise"))
-      + personal_timezone * 3600;
-    sunset = String2Time(findData(buf, "sunset"))
-      + personal_timezone * 3600;
-    twilight_begin = String2Time(findData(buf, "civil_twilight_begin"))
-      + personal_timezone * 3600;
-    twilight_end = String2Time(findData(buf, "civil_twilight_end"))
-      + personal_timezone * 3600;
-
-    DebugPrint("sunrise ", sunrise, ", ");
-    DebugPrint("sunset ", sunset, "\n");
-  } else if (err == 0) {
-    // timeout
-    Serial.print("Sunset timeout "); Serial.println(buf);
-  } else {
-    Serial.print("Sunset GET failure" ); Serial.println(err);
-  }
+  DebugPrint("sunrise ", sunrise, ", ");
+  DebugPrint("sunset ", sunset, "\n");
+}
 
-  // free(buf);
-  // buf = 0;
+/*
+ * Calculate one event (in seconds since midnight GMT) for day of year "doy" (0 based).
+ * Returns -1 if the sun doesn't cross this zenith on that day.
+ */
+time_t Sunset::SolarEvent(float zenith, bool rising, int doy) {
+  float g = 2.0 * M_PI / 365.0 * doy;		// Fractional year, in radians
+  float eqtime = 229.18 * (0.000075 + 0.001868 * cos(g) - 0.032077 * sin(g)
+    - 0.014615 * cos(2 * g) - 0.040849 * sin(2 * g));
+  float decl = 0.006918 - 0.399912 * cos(g) + 0.070257 * sin(g)
+    - 0.006758 * cos(2 * g) + 0.000907 * sin(2 * g)
+    - 0.002697 * cos(3 * g) + 0.00148 * sin(3 * g);
+
+  float rlat = atof(lat) * M_PI / 180.0;
+  float c = cos(zenith * M_PI / 180.0) / (cos(rlat) * cos(decl)) - tan(rlat) * tan(decl);
+  if (c < -1.0 || c > 1.0)
+    return -1;					// Midnight sun or polar night
+  float ha = acos(c) * 180.0 / M_PI;
+
+  float minutes = 720.0 - 4.0 * (atof(lon) + (rising ? ha : -ha)) - eqtime;
+  return (time_t)(minutes * 60.0);
+}
 
-  // delete rest;
-  // rest = 0;
+/*
+ * Calculate the times for the date of t, and store them in local time.
+ */
+void Sunset::Calculate(time_t t) {
+  int doy = day(t) - 1;
+  for (int m=1; m<month(t); m++)
+    doy += daysInMonth(year(t), m);
+
+  sunrise = SolarEvent(ZENITH_OFFICIAL, true, doy) + personal_timezone * 3600;
+  sunset = SolarEvent(ZENITH_OFFICIAL, false, doy) + personal_timezone * 3600;
+  twilight_begin = SolarEvent(ZENITH_CIVIL, true, doy) + personal_timezone * 3600;
+  twilight_end = SolarEvent(ZENITH_CIVIL, false, doy) + personal_timezone * 3600;
 }
 
 void Sunset::DebugPrint(const char *prefix, time_t tm, const char *suffix) {
@@ -168,71 +121,6 @@ void Sunset::DebugPrint(const char *prefix, time_t tm, const char *suffix) {
   Serial.print(suffix);
 }
 
-void Sunset::query() {
-  query("36.7201600", "-4.4203400", "demo");	// Demo coordinates from their site
-}
-
-/*
- * In the "response", find the date/time field after the specified search string.
- * Return a pointer into the original string (no private copy, not terminated).
- * Flag error if we don't see quotes/column in the expected places.
- */
-char *Sunset::findData(char *response, const char *search) {
-  char *f = strstr(response, search);
-
-  int len = strlen(search);
-  if (! f) {
-    // Serial.println("error 1");
-    return (char *)0;
-  }
-  if (f[-1] != '"') {
-    // Serial.println("error 2");
-    return (char *)0;
-  }
-  if (f[len] != '"') {
-    // Serial.println("error 3");
-    return (char *)0;
-  }
-  if (f[len+1] != ':') {
-    // Serial.println("error 4");
-    return (char *)0;
-  }
-  if (f[len+2] != '"') {
-    // Serial.println("error 5");
-    return (char *)0;
-  }
-
-  return f + len + 3;
-}
-
-/*
- * Convert a standard time string such as
- *	    "sunrise":"2015-05-21T05:05:35+00:00",
- * to the seconds since "the epoch" (January 1, 1970) like on a Unix system.
- */
-time_t Sunset::String2DateTime(char *ts) {
-  long epoch=0;
-  int year, month, day, hour, minute, second;
-
-  sscanf(ts, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second);
-  if (year<100) year+=2000;
-
-  for (int yr=1970;yr<year;yr++)
-    if (isLeapYear(yr))
-      epoch+=366*86400L;
-    else
-      epoch+=365*86400L;
-
-  for(int m=1;m<month;m++)
-    epoch += daysInMonth(year,m)*86400L;
-  epoch += (day-1)*86400L;
-  epoch += hour*3600L;
-  epoch += minute*60;
-  epoch += second;
-
-  return epoch;
-}
-
 /*
  * Produce a readable version of a time in "seconds since midnight" form
  * Warning : always the same memory location
@@ -247,30 +135,6 @@ char *Sunset::Time2String(time_t tm) {
   return buffer;
 }
 
-/*
- * Convert a standard time string such as
- *	    "sunrise":"2015-05-21T05:05:35+00:00",
- * to just the seconds since midnight.
- */
-time_t Sunset::String2Time(char *ts) {
-  int year, month, day, hour, minute, second;
-
-  sscanf(ts, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second);
-
-  time_t r = hour * 3600L + minute * 60L + second;
-#if 0
-  Serial.print("String2Time(");
-  char *p = ts;
-  char c = *p;
-  while (c != '"') {
-    Serial.print(c);
-    c = *++p;
-  }
-  Serial.print(") -> "); Serial.println(r);
-#endif
-  return r;
-}
-
 bool Sunset::isLeapYear(int yr)
 {
   if (yr % 4 == 0 && yr % 100 != 0 || yr % 400 == 0)
@@ -289,12 +153,12 @@ byte Sunset::daysInMonth(int yr, int m)
 }
 
 /*
- * Query once per day
+ * Recalculate once per day
  * All times in local timezone.
  */
 enum lightState Sunset::loop(time_t t) {
   // First call ever, so we just got initialized.
-  // Don't bother querying, this is done from elsewhere.
+  // Don't bother calculating, this is done from elsewhere.
   if (today == 0) {
     today = t;
     return LIGHT_NONE;
@@ -303,9 +167,7 @@ enum lightState Sunset::loop(time_t t) {
   int	h = hour(t), m = minute(t), s = second(t);
   int	dd = day(t), mm = month(t), yy = year(t);
 
-  // To debug whether this causes the issue, delay this call until 3am
-  if (((dd != day(today)) || (mm != month(today)) || (yy != year(today)))
-     && (h > 3)) {
+  if ((dd != day(today)) || (mm != month(today)) || (yy != year(today))) {
     char _today[32];
     sprintf(_today, "%04d-%02d-%02d, %02d:%02d", yy, mm, dd, h, m);
     query(lat, lon, _today);
@@ -334,7 +196,7 @@ enum lightState Sunset::loop(time_t t) {
 }
 
 void Sunset::reset() {
-  today = 123456789L;	// Causes re-query
+  today = 123456789L;	// Causes recalculation
   Serial.println("Sunset : reset");
 }
 
@@ -23,14 +23,10 @@
 #ifndef _INCLUDE_SUNSET_H_
 #define _INCLUDE_SUNSET_H_
 
-#include <ELClient.h>
-#include <ELClientRest.h>
-
 class Sunset {
 public:
   Sunset();
   ~Sunset();
-  void query();
   void query(char *lat, char *lon, char *msg = NULL);
   enum lightState loop(time_t);
   void reset();
@@ -44,15 +40,11 @@ private:
   enum lightState stable;					// Stable state
 
   // Function definitions
-  time_t String2DateTime(char *);
-  time_t String2Time(char *);
+  void Calculate(time_t);
+  time_t SolarEvent(float zenith, bool rising, int doy);
   char *Time2String(time_t);
   byte daysInMonth(int yr, int m);
   bool isLeapYear(int yr);
-  char *findData(char *, const char *);
   void DebugPrint(const char *, time_t, const char *);
-
-  // Internal stuff
-  ELClientRest *rest;
 };
 #endif
@@ -34,6 +34,7 @@
 #include "ThingSpeak.h"
 #include "Sunset.h"
 #include "global.h"
+#include "cmdtable.h"
 #include <TimeLib.h>
 #include <DS1307RTC.h>
 
@@ -112,18 +113,24 @@ struct mqtt_callback_table {
   { NULL, NULL}
 };
 
+static int ncallbacks = 0;
+
 /*
- * Create the lengths in the table
+ * Create the lengths in the table, and sort it (once) for CmdFind().
  * Only subscribe to one topic : "kippen". Everything else is in the message.
  */
 void mqConnected(void *response) {
   // Serial.println("MQTT connect");
 
-  for (int i=0; mqtt_callback_table[i].token != NULL; i++) {
-    if (mqtt_callback_table[i].len == 0)
-      mqtt_callback_table[i].len = strlen(mqtt_callback_table[i].token);
+  if (ncallbacks == 0) {
+    for (int i=0; mqtt_callback_table[i].token != NULL; i++) {
+      if (mqtt_callback_table[i].len == 0)
+        mqtt_callback_table[i].len = strlen(mqtt_callback_table[i].token);
+      ncallbacks++;
 
-    // mqtt.subscribe(mqtt_callback_table[i].token);
+      // mqtt.subscribe(mqtt_callback_table[i].token);
+    }
+    CmdSort(mqtt_callback_table, ncallbacks, sizeof(mqtt_callback_table[0]));
   }
 
   mqtt.subscribe("kippen");
@@ -144,11 +151,10 @@ void mqData(void *response) {
   if (strncasecmp(topic.c_str(), "kippen", 6) != 0)
     return;
 
-  for (ix=0; mqtt_callback_table[ix].token; ix++)
-    if (strncasecmp(data.c_str(), mqtt_callback_table[ix].token,
-          mqtt_callback_table[ix].len) == 0) {
-      mqtt_callback_table[ix].f((char *)topic.c_str(), (char *)data.c_str());
-    }
+  // At most one handler, ix is used by the handlers to find their argument
+  ix = CmdFind(mqtt_callback_table, ncallbacks, sizeof(mqtt_callback_table[0]), data.c_str());
+  if (ix >= 0)
+    mqtt_callback_table[ix].f((char *)topic.c_str(), (char *)data.c_str());
 }
 
 static int busy = 1;
@@ -46,23 +46,18 @@ Water::~Water() {
 }
 
 int Water::loop(int hr, int mn) {
-  for (int i=0; i<nitems; i++) {
-    if (items[i].hour == hr && items[i].minute == mn) {
-      state = items[i].state;
-      if (verbose & VERBOSE_WATER) {
-        if (state != 0 && state != 1) {
-	  char t[80];
-          sprintf(t, "## State %d, i %d, hr %d min %d\n", state, i, hr, mn);
-	  Serial.print(t);
-        }
-      }
-      if (verbose & VERBOSE_WATER) {
-        Serial.printf("Water(%d,%d) : change ix %d (%d,%d) %d -> %d\n",
-	  hr, mn, i, items[i].hour, items[i].minute, state, items[i].state);
+  int i = ItemFind(items, nitems, hr * 60 + mn);
+  if (i >= 0) {
+    if (verbose & VERBOSE_WATER) {
+      if (items[i].state != 0 && items[i].state != 1) {
+        char t[80];
+        sprintf(t, "## State %d, i %d, hr %d min %d\n", items[i].state, i, hr, mn);
+        Serial.print(t);
       }
-      state = items[i].state;
-      return state;
+      Serial.printf("Water(%d,%d) : change ix %d (%d,%d) %d -> %d\n",
+        hr, mn, i, items[i].hour, items[i].minute, state, items[i].state);
     }
+    state = items[i].state;
   }
   return state;
 }
@@ -110,6 +105,9 @@ void Water::setSchedule(char *desc) {
     items[i].state = val;
   }
 
+  // Sort on time of day so loop() can do a binary search
+  ItemSort(items, nitems);
+
 #if 0
   Debug("\nProgram :\n");
   for (int i=0; i<nitems; i++) {
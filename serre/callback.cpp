@@ -43,10 +43,154 @@ extern "C" {
 extern PubSubClient	client;
 
 #include "global.h"
+#include "cmdtable.h"
+
+static char reply[80];
+
+static void BmpQuery() {
+  /*
+   * Read temperature / barometric pressure
+   */
+  if (verbose & VERBOSE_BMP) Serial.println("Topic bmp");
+
+  if (bmp) {
+    BMPQuery();
+
+    int a, b, c;
+    // Temperature
+    a = (int) newTemperature;
+    double td = newTemperature - a;
+    b = 100 * td;
+    c = newPressure;
+
+    // Format the result
+    sprintf(reply, "bmp (%2d.%02d, %d)", a, b, c);
+
+  } else {
+    sprintf(reply, "No sensor detected");
+  }
+
+  if (verbose & VERBOSE_BMP) Serial.println(reply);
+  client.publish(mqtt_topic_bmp180, reply);
+}
+
+static void ValveQuery() {
+  /*
+   * Read valve/pump status
+   */
+  if (verbose & VERBOSE_VALVE) Serial.println("Topic valve");
+  client.publish(mqtt_topic_valve, valve ? "Open" : "Closed");
+}
+
+static void ValveStart() {
+  if (verbose & VERBOSE_VALVE) Serial.println("Topic valve start");
+#ifdef SERRE
+  SetState(1);
+  ValveOpen();
+#endif
+}
+
+static void ValveStop() {
+  if (verbose & VERBOSE_VALVE) Serial.println("Topic valve stop");
+#ifdef SERRE
+  SetState(0);
+  ValveReset();
+#endif
+}
+
+static void Restart() {
+  // Always stop water flow before reboot
+#ifdef SERRE
+  SetState(0);
+  ValveReset();
+#endif
+  // Reboot the ESP without a software update.
+  ESP.restart();
+}
+
+static void CurrentTimeQuery() {
+  if (verbose & VERBOSE_SYSTEM) Serial.println("Topic current time");
+
+  time_t tsnow = sntp_get_current_timestamp();
+  now = localtime(&tsnow);
+  strftime(reply, sizeof(reply), "Current time %F %T", now);
+  client.publish(mqtt_topic_current_time, reply);
+
+  if (verbose & VERBOSE_SYSTEM) Serial.printf("Reply {%s} {%s}\n", mqtt_topic_current_time, reply);
+}
+
+static void BootTimeQuery() {
+  if (verbose & VERBOSE_SYSTEM) Serial.println("Topic boot time");
+
+  now = localtime(&tsboot);
+  strftime(reply, sizeof(reply), "Boot %F %T", now);
+  client.publish(mqtt_topic_boot_time, reply);
+
+  if (verbose & VERBOSE_SYSTEM) Serial.printf("Reply {%s} {%s}\n", mqtt_topic_boot_time, reply);
+}
+
+static void ReconnectsQuery() {
+  // Report the number of MQTT reconnects to our broker
+  sprintf(reply, "Reconnect count %d", nreconnects);
+  client.publish(mqtt_topic_reconnects, reply);
+}
+
+static void VersionQuery() {
+  // Report the build version
+  sprintf(reply, "Build version %s %s", _BuildInfo.date, _BuildInfo.time);
+  client.publish(mqtt_topic_version, reply);
+}
+
+static void InfoQuery() {
+  // Report the build version
+  sprintf(reply, "System Info %s", SystemInfo1);
+  client.publish(mqtt_topic_info, reply);
+  sprintf(reply, "System Info %s", SystemInfo2);
+  client.publish(mqtt_topic_info, reply);
+}
+
+static void ScheduleQuery() {
+#ifdef SERRE
+  char *sched = water->getSchedule();
+#else
+  char *sched = hatch->getSchedule();
+#endif
+  client.publish(mqtt_topic_schedule, sched);
+  Serial.printf("Schedule %s -> %s\n", mqtt_topic_schedule, sched);
+  free(sched);
+#ifdef SERRE
+  // Always stop water flow when schedule is manipulated
+  SetState(0);
+  ValveReset();
+#endif
+}
+
+/*
+ * Requests for information, or commands for the module, as sent in the payload on mqtt_topic.
+ * The tokens are only known at run time (they're built from SystemId in mqtt.cpp),
+ * so they're picked up and the table is sorted on first use.
+ */
+static struct command {
+  const char		*token;
+  const char * const	*ref;
+  void			(*f)();
+} commands[] = {
+  { 0,	&mqtt_topic_bmp180,		BmpQuery },
+  { 0,	&mqtt_topic_valve,		ValveQuery },
+  { 0,	&mqtt_topic_valve_start,	ValveStart },
+  { 0,	&mqtt_topic_valve_stop,		ValveStop },
+  { 0,	&mqtt_topic_restart,		Restart },
+  { 0,	&mqtt_topic_current_time,	CurrentTimeQuery },
+  { 0,	&mqtt_topic_boot_time,		BootTimeQuery },
+  { 0,	&mqtt_topic_reconnects,		ReconnectsQuery },
+  { 0,	&mqtt_topic_version,		VersionQuery },
+  { 0,	&mqtt_topic_info,		InfoQuery },
+  { 0,	&mqtt_topic_schedule,		ScheduleQuery },
+};
+static const int ncommands = sizeof(commands) / sizeof(commands[0]);
 
 void callback(char *topic, byte *payload, unsigned int length) {
   char *pl = (char *)payload;
-  char reply[80];
 
   pl[length] = 0;
 
@@ -60,121 +204,19 @@ void callback(char *topic, byte *payload, unsigned int length) {
     Serial.printf(",%d}\n", length);
   }
 
-  /* 
-  Serial.printf("Comparing strcmp(%s, %s) -> %d\n",
-    topic, mqtt_topic_serre, strcmp(topic, mqtt_topic_serre));
-  Serial.printf("Comparing strncmp(%s, %s, %d) -> %d\n",
-    pl, mqtt_topic_boot_time, length, strncmp(pl, mqtt_topic_boot_time, length));
-  /* */
+  if (commands[0].token == 0) {
+    for (int i=0; i<ncommands; i++)
+      commands[i].token = *commands[i].ref;
+    CmdSort(commands, ncommands, sizeof(commands[0]));
+  }
 
   /*
    * Requests for information, or commands for the module
    */
   if (strcmp(topic, mqtt_topic) == 0) {
-    /*
-     * Note : must always compare just the indicated length when comparing with payload.
-     * Also make sure to compare in the right order, e.g.
-     *   Serre/Valve/0
-     * needs to be matched before
-     *   Serre/Valve
-     */
-    if (strncmp(pl, mqtt_topic_bmp180, length) == 0) {
-      /*
-       * Read temperature / barometric pressure
-       */
-      if (verbose & VERBOSE_BMP) Serial.println("Topic bmp");
-
-      if (bmp) {
-        BMPQuery();
-
-        int a, b, c;
-        // Temperature
-        a = (int) newTemperature;
-        double td = newTemperature - a;
-        b = 100 * td;
-        c = newPressure;
-
-        // Format the result
-        sprintf(reply, "bmp (%2d.%02d, %d)", a, b, c);
-  
-      } else {
-        sprintf(reply, "No sensor detected");
-      }
-
-      if (verbose & VERBOSE_BMP) Serial.println(reply);
-      client.publish(mqtt_topic_bmp180, reply);
-    } else if (strncmp(pl, mqtt_topic_valve, length) == 0) {
-      /*
-       * Read valve/pump status
-       */
-      if (verbose & VERBOSE_VALVE) Serial.println("Topic valve");
-      client.publish(mqtt_topic_valve, valve ? "Open" : "Closed");
-    } else if (strncmp(pl, mqtt_topic_valve_start, length) == 0) {
-      if (verbose & VERBOSE_VALVE) Serial.println("Topic valve start");
-#ifdef SERRE
-      SetState(1);
-      ValveOpen();
-#endif
-    } else if (strncmp(pl, mqtt_topic_valve_stop, length) == 0) {
-      if (verbose & VERBOSE_VALVE) Serial.println("Topic valve stop");
-#ifdef SERRE
-      SetState(0);
-      ValveReset();
-#endif
-    } else if (strncmp(pl, mqtt_topic_restart, length) == 0) {
-      // Always stop water flow before reboot
-#ifdef SERRE
-      SetState(0);
-      ValveReset();
-#endif
-      // Reboot the ESP without a software update.
-      ESP.restart();
-    } else if (strncmp(pl, mqtt_topic_current_time, length) == 0) {
-      if (verbose & VERBOSE_SYSTEM) Serial.println("Topic current time");
-
-      time_t tsnow = sntp_get_current_timestamp();
-      now = localtime(&tsnow);
-      strftime(reply, sizeof(reply), "Current time %F %T", now);
-      client.publish(mqtt_topic_current_time, reply);
-
-      if (verbose & VERBOSE_SYSTEM) Serial.printf("Reply {%s} {%s}\n", mqtt_topic_current_time, reply);
-    } else if (strncmp(pl, mqtt_topic_boot_time, length) == 0) {
-      if (verbose & VERBOSE_SYSTEM) Serial.println("Topic boot time");
-
-      now = localtime(&tsboot);
-      strftime(reply, sizeof(reply), "Boot %F %T", now);
-      client.publish(mqtt_topic_boot_time, reply);
-
-      if (verbose & VERBOSE_SYSTEM) Serial.printf("Reply {%s} {%s}\n", mqtt_topic_boot_time, reply);
-    } else if (strncmp(pl, mqtt_topic_reconnects, length) == 0) {
-      // Report the number of MQTT reconnects to our broker
-      sprintf(reply, "Reconnect count %d", nreconnects);
-      client.publish(mqtt_topic_reconnects, reply);
-    } else if (strncmp(pl, mqtt_topic_version, length) == 0) {
-      // Report the build version
-      sprintf(reply, "Build version %s %s", _BuildInfo.date, _BuildInfo.time);
-      client.publish(mqtt_topic_version, reply);
-    } else if (strncmp(pl, mqtt_topic_info, length) == 0) {
-      // Report the build version
-      sprintf(reply, "System Info %s", SystemInfo1);
-      client.publish(mqtt_topic_info, reply);
-      sprintf(reply, "System Info %s", SystemInfo2);
-      client.publish(mqtt_topic_info, reply);
-    } else if (strncmp(pl, mqtt_topic_schedule, length) == 0) {
-#ifdef SERRE
-      char *sched = water->getSchedule();
-#else
-      char *sched = hatch->getSchedule();
-#endif
-      client.publish(mqtt_topic_schedule, sched);
-      Serial.printf("Schedule %s -> %s\n", mqtt_topic_schedule, sched);
-      free(sched);
-#ifdef SERRE
-      // Always stop water flow when schedule is manipulated
-      SetState(0);
-      ValveReset();
-#endif
-    }
+    int ix = CmdFind(commands, ncommands, sizeof(commands[0]), pl);
+    if (ix >= 0)
+      commands[ix].f();
 
     // End topic == mqtt_topic_serre
 
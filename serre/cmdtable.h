@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016 Danny Backx
+ *
+ * License (MIT license):
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy
+ *   of this software and associated documentation files (the "Software"), to deal
+ *   in the Software without restriction, including without limitation the rights
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *   copies of the Software, and to permit persons to whom the Software is
+ *   furnished to do so, subject to the following conditions:
+ *
+ *   The above copyright notice and this permission notice shall be included in
+ *   all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *   THE SOFTWARE.
+ */
+#ifndef _INCLUDE_CMDTABLE_H_
+#define _INCLUDE_CMDTABLE_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+ * Command dispatch tables, as in callback.cpp : an array of structs that start with the command
+ * token (a const char *). The table is sorted once with CmdSort(), after which CmdFind() does a
+ * binary search, so only one entry can match a command.
+ *
+ * Matching ignores case. A token ending in '/' takes an argument, so it matches as a prefix
+ * (e.g. "/schedule/set/" matches "/schedule/set/0600,1"), other tokens must match the whole command.
+ */
+#define	CMD_MAXLEN	48		// Longer commands can still match a token ending in '/'
+
+#define	CmdToken(table, size, i)	(*(const char * const *)((const char *)(table) + (i) * (size)))
+
+static inline int CmdCompare(const void *a, const void *b) {
+  return strcasecmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+static inline void CmdSort(void *table, int n, size_t size) {
+  qsort(table, n, size, CmdCompare);
+}
+
+// Exact lookup of a key, ignoring case
+static inline int CmdSearch(const void *table, int n, size_t size, const char *key) {
+  int lo = 0, hi = n - 1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int r = strcasecmp(CmdToken(table, size, mid), key);
+    if (r == 0)
+      return mid;
+    if (r < 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -1;
+}
+
+/*
+ * Return the index of the entry matching cmd, or -1.
+ * Trailing white space is ignored.
+ */
+static inline int CmdFind(const void *table, int n, size_t size, const char *cmd) {
+  char key[CMD_MAXLEN];
+  int len = 0;
+
+  while (cmd[len] && len < CMD_MAXLEN - 1) {
+    key[len] = cmd[len];
+    len++;
+  }
+  bool truncated = (cmd[len] != 0);
+  while (len > 0 && isspace((unsigned char)key[len - 1]))
+    len--;
+  key[len] = 0;
+
+  int ix;
+  if (! truncated && (ix = CmdSearch(table, n, size, key)) >= 0)
+    return ix;
+
+  // Try the tokens that take an argument, longest first
+  for (int l = len - 1; l > 0; l--)
+    if (key[l - 1] == '/') {
+      key[l] = 0;
+      if ((ix = CmdSearch(table, n, size, key)) >= 0)
+        return ix;
+    }
+  return -1;
+}
+#endif
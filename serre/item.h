@@ -23,8 +23,56 @@
 #ifndef _INCLUDE_ITEM_H_
 #define _INCLUDE_ITEM_H_
 
+#include <stdlib.h>
+
 struct item {
   short hour, minute, state;
+  short mod;			// Minute of day (hour * 60 + minute), set by ItemSort()
 };
 
+/*
+ * A schedule is compiled once (when set) into an array sorted on minute of day,
+ * so lookups in the loop are a binary search instead of a scan of the list.
+ */
+static inline int ItemCompare(const void *a, const void *b) {
+  return ((const item *)a)->mod - ((const item *)b)->mod;
+}
+
+static inline void ItemSort(item *items, int nitems) {
+  for (int i=0; i<nitems; i++)
+    items[i].mod = items[i].hour * 60 + items[i].minute;
+  qsort(items, nitems, sizeof(item), ItemCompare);
+}
+
+/*
+ * Index of the first entry at or after minute of day mod, nitems if there is none.
+ */
+static inline int ItemFrom(const item *items, int nitems, int mod) {
+  int lo = 0, hi = nitems;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (items[mid].mod < mod)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/*
+ * Index of the entry exactly at minute of day mod, -1 if there is none.
+ */
+static inline int ItemFind(const item *items, int nitems, int mod) {
+  int i = ItemFrom(items, nitems, mod);
+  return (i < nitems && items[i].mod == mod) ? i : -1;
+}
+
+/*
+ * Index of the last entry at or before minute of day mod (i.e. the one that is in effect),
+ * -1 if there is none.
+ */
+static inline int ItemAt(const item *items, int nitems, int mod) {
+  return ItemFrom(items, nitems, mod + 1) - 1;
+}
+
 #endif
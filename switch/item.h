@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2016 Danny Backx
+ *
+ * License (MIT license):
+ *   Permission is hereby granted, free of charge, to any person obtaining a copy
+ *   of this software and associated documentation files (the "Software"), to deal
+ *   in the Software without restriction, including without limitation the rights
+ *   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *   copies of the Software, and to permit persons to whom the Software is
+ *   furnished to do so, subject to the following conditions:
+ *
+ *   The above copyright notice and this permission notice shall be included in
+ *   all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *   THE SOFTWARE.
+ */
+#ifndef _INCLUDE_ITEM_H_
+#define _INCLUDE_ITEM_H_
+
+#include <stdlib.h>
+
+struct item {
+  short hour, minute, state;
+  short mod;			// Minute of day (hour * 60 + minute), set by ItemSort()
+};
+
+/*
+ * A schedule is compiled once (when set) into an array sorted on minute of day,
+ * so lookups in the loop are a binary search instead of a scan of the list.
+ */
+static inline int ItemCompare(const void *a, const void *b) {
+  return ((const item *)a)->mod - ((const item *)b)->mod;
+}
+
+static inline void ItemSort(item *items, int nitems) {
+  for (int i=0; i<nitems; i++)
+    items[i].mod = items[i].hour * 60 + items[i].minute;
+  qsort(items, nitems, sizeof(item), ItemCompare);
+}
+
+/*
+ * Index of the first entry at or after minute of day mod, nitems if there is none.
+ */
+static inline int ItemFrom(const item *items, int nitems, int mod) {
+  int lo = 0, hi = nitems;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (items[mid].mod < mod)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/*
+ * Index of the entry exactly at minute of day mod, -1 if there is none.
+ */
+static inline int ItemFind(const item *items, int nitems, int mod) {
+  int i = ItemFrom(items, nitems, mod);
+  return (i < nitems && items[i].mod == mod) ? i : -1;
+}
+
+/*
+ * Index of the last entry at or before minute of day mod (i.e. the one that is in effect),
+ * -1 if there is none.
+ */
+static inline int ItemAt(const item *items, int nitems, int mod) {
+  return ItemFrom(items, nitems, mod + 1) - 1;
+}
+
+#endif
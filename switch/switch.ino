@@ -39,6 +39,7 @@ static int OTAprev;
 #include "secrets.h"
 #include "personal.h"
 #include "buildinfo.h"
+#include "item.h"
 
 struct mywifi {
   const char *ssid, *pass;
@@ -90,10 +91,6 @@ int		state = 0;
 int		manual = 0;
 
 // Schedule
-struct item {
-  short hour, minute, state;
-};
-
 int nitems = 0;
 item *items;
 
@@ -265,31 +262,27 @@ void loop() {
     int the_year = tmp->tm_year + 1900;
     int the_dow = tmp->tm_wday;
 
+    /*
+     * The schedule is sorted and starts with a 00:00 entry, so the entry in effect
+     * is found with a binary search.
+     */
     int tn = newhour * 60 + newminute;
-    for (int i=1; i<nitems; i++) {
-      int t1 = items[i-1].hour * 60 + items[i-1].minute;
-      int t2 = items[i].hour * 60 + items[i].minute;
-
-      // On the exact hour, turn off manual mode
-      if (t1 == tn && manual == 1) {
-        manual = 0;
-
-	if (items[i-1].state == 1 && state == 0) {
-	  PinOn();
-	  RelayDebug("%04d.%02d.%02d %02d:%02d : %s", the_year, the_month, the_day, newhour, newminute, "on");
-	} else if (items[i-1].state == 0 && state == 1) {
-	  PinOff();
-	  RelayDebug("%04d.%02d.%02d %02d:%02d : %s", the_year, the_month, the_day, newhour, newminute, "off");
-	}
-      } else if (t1 <= tn && tn < t2 && manual == 0) {
-        // Between the hours, only change state if not manual
-	if (items[i-1].state == 1 && state == 0) {
-	  PinOn();
-	  RelayDebug("%04d.%02d.%02d %02d:%02d : %s", the_year, the_month, the_day, newhour, newminute, "on");
-	} else if (items[i-1].state == 0 && state == 1) {
-	  PinOff();
-	  RelayDebug("%04d.%02d.%02d %02d:%02d : %s", the_year, the_month, the_day, newhour, newminute, "off");
-	}
+    int i = ItemAt(items, nitems, tn);
+    if (i < 0)
+      return;
+
+    // On the exact hour, turn off manual mode
+    if (items[i].mod == tn && manual == 1)
+      manual = 0;
+
+    // Only change state if not manual
+    if (manual == 0) {
+      if (items[i].state == 1 && state == 0) {
+	PinOn();
+	RelayDebug("%04d.%02d.%02d %02d:%02d : %s", the_year, the_month, the_day, newhour, newminute, "on");
+      } else if (items[i].state == 0 && state == 1) {
+	PinOff();
+	RelayDebug("%04d.%02d.%02d %02d:%02d : %s", the_year, the_month, the_day, newhour, newminute, "off");
       }
     }
   }
@@ -423,25 +416,9 @@ void SetSchedule(const char *desc) {
 
   // for (int i=0; i<nitems; i++) Debug("SetSchedule %d (%d:%d) %d", i, items[i].hour, items[i].minute, items[i].state);
 
-  // Sort the damn thing
-  for (int i=1; i<nitems; i++) {
-    int m=i;
-    int tm = items[i].hour * 60 + items[i].minute;
-    // Find lowest value
-    for (int j=i+1; j<nitems; j++) {
-      int tj = items[j].hour * 60 + items[j].minute;
-      if (tj < tm) {
-        m = j;
-	tm = tj;
-      }
-    }
-    // Swap if necessary
-    if (i != m) {
-      struct item xx = items[i];
-      items[i] = items[m];
-      items[m] = xx;
-    }
-  }
+  // Sort on time of day, leaving the first entry in front
+  ItemSort(items + 1, nitems - 1);
+  items[0].mod = 0;
 
   // for (int i=0; i<nitems; i++) Debug("Sorted schedule %d (%d:%d) %d", i, items[i].hour, items[i].minute, items[i].state);
 
@@ -72,11 +72,13 @@ struct Wunderground {
 void SetupWifi();
 void SetupOTA();
 Wunderground *ReadSensorInformation();
-boolean UploadDataToWU(Wunderground *);
+boolean StartUploadToWU(Wunderground *);
+void WuLoop();
 time_t mySntpInit();
 bool IsDST(int day, int month, int dow);
 bool IsDST2(int day, int month, int dow, int hr);
 void reconnect(void);
+void MqttLoop(void);
 void callback(char * topic, byte *payload, unsigned int length);
 void ReportToMqtt(Wunderground *);
 
@@ -98,6 +100,29 @@ PubSubClient	client(espClient);
 // Delay between updates, in milliseconds
 // WU allows 500 requests per-day maximum, this sets the time to 30-mins
 const unsigned long  UpdateInterval     = 30L*60L*1000L;
+unsigned long	last_update = 0;
+boolean		first_update = true;
+
+// MQTT reconnect attempts don't block the loop, they're just spaced out
+const unsigned long  MqttRetryInterval	= 5000L;
+unsigned long	mqtt_retry = 0;
+
+/*
+ * Weather Underground upload, driven from loop() one step at a time,
+ * so a slow server doesn't hold up OTA, MQTT or the sensor.
+ */
+enum WuState { WU_IDLE, WU_CONNECT, WU_SEND, WU_HEADERS, WU_RESPONSE };
+WuState		wu_state = WU_IDLE;
+WiFiClientSecure wu_client;
+#ifdef	wificlientbearssl_h
+BearSSL::Session wu_session;		// Lets the next handshake resume this one
+#endif
+char		wu_request[512];	// Preallocated, only the numbers change
+int		wu_reqlen;
+char		wu_line[128];		// Response line being read
+int		wu_linelen;
+unsigned long	wu_ts;			// Start of the current step
+const unsigned long  WuTimeout	= 10000L;
 
 boolean ok;
 
@@ -116,6 +141,12 @@ void setup() {
   client.setServer(mqtt_server, mqtt_port);
   client.setCallback(callback);
 
+#ifdef	wificlientbearssl_h
+  // Newer (BearSSL) cores : same as axTLS before, no certificate check, but resume sessions
+  wu_client.setInsecure();
+  wu_client.setSession(&wu_session);
+#endif
+
   // Set up real time clock
   // Note : DST processing comes later
   (void)sntp_set_timezone(MY_TIMEZONE);
@@ -139,8 +170,13 @@ void setup() {
 
 void loop() {
   ArduinoOTA.handle();
+  MqttLoop();
+  WuLoop();
+
+  if (ok && (first_update || millis() - last_update >= UpdateInterval)) {
+    first_update = false;
+    last_update = millis();
 
-  if (ok) {
     Wunderground *data = ReadSensorInformation();
 
     time_t the_time = sntp_get_current_timestamp();
@@ -153,85 +189,141 @@ void loop() {
     if (data) {
       data->time = the_time;
 
-      if (!UploadDataToWU(data))
+      if (!StartUploadToWU(data))
         Serial.println("Error uploading to Weather Underground, trying next time");
 
-      // MQTT
-      if (!client.connected())
-        reconnect();
-      if (!client.loop())
-        reconnect();
-
       ReportToMqtt(data);
+      free(data);
     }
   }
 
-  delay(UpdateInterval);
+  delay(10);
 }
 
-boolean UploadDataToWU(Wunderground *wup) {
-  WiFiClientSecure client;
-
-  Serial.print("Connecting to   : " + String(WU_UPDATE_HOST));
-  // Serial.println();
-
-  // Create SSL connection
-  if (!client.connect(WU_UPDATE_HOST, HTTPS_PORT)) {
-    Serial.println("Connection failed");
+/*
+ * Build the request in the preallocated buffer, WuLoop() sends it.
+ */
+boolean StartUploadToWU(Wunderground *wup) {
+  if (wu_state != WU_IDLE) {
+    Serial.println("Previous upload still busy");
     return false;
   }
 
   float dewpt = wup->sensor_temperature - (100 - wup->sensor_humidity) / 5.0;
 
-  // Put info in the right (String) variables
-  String tempf		= String(wup->sensor_tempf);
-  String dewptf		= String(dewpt*9/5+32);
-  String humidity	= String(wup->sensor_humidity,2);
-  String baromin	= String(wup->sensor_pressurem,5);
-
-  String url =
-    "/weatherstation/updateweatherstation.php?ID=" + String(WU_MY_STATION_ID)
-    + "&PASSWORD=" + String(WU_MY_STATION_PASS)
-    + "&dateutc=" + "now"
-    + (indoor ? "&indoortempf=" : "&tempf=") + tempf
-    + "&humidity=" + humidity
-    + "&dewptf=" + dewptf
-    + "&baromin=" + baromin
-    + "&action=updateraw&realtime=1&rtfreq=60";
-
-  boolean ok = true;
-
-  // Serial.println("Requesting      : "+url);
-  client.print(String("GET ") + url + " HTTP/1.1\r\n" +
-               "Host: " + WU_UPDATE_HOST + "\r\n" +
-               "User-Agent: Danny Backx Garden Sensor\r\n" +
-               "Connection: close\r\n\r\n");
-  // Serial.print("Request sent    : ");
-  while (client.connected()) {
-    String line = client.readStringUntil('\n');
-    if (line == "\r") {
-      // Serial.println("Headers received");
-      break;
-    }
+  // No %f in our printf
+  char tempf[16], dewptf[16], humidity[16], baromin[16];
+  dtostrf(wup->sensor_tempf, 1, 2, tempf);
+  dtostrf(dewpt*9/5+32, 1, 2, dewptf);
+  dtostrf(wup->sensor_humidity, 1, 2, humidity);
+  dtostrf(wup->sensor_pressurem, 1, 5, baromin);
+
+  wu_reqlen = snprintf(wu_request, sizeof(wu_request),
+    "GET /weatherstation/updateweatherstation.php?ID=%s&PASSWORD=%s&dateutc=now"
+    "&%s=%s&humidity=%s&dewptf=%s&baromin=%s"
+    "&action=updateraw&realtime=1&rtfreq=60 HTTP/1.1\r\n"
+    "Host: %s\r\n"
+    "User-Agent: Danny Backx Garden Sensor\r\n"
+    "Connection: close\r\n\r\n",
+    WU_MY_STATION_ID, WU_MY_STATION_PASS,
+    indoor ? "indoortempf" : "tempf", tempf, humidity, dewptf, baromin,
+    WU_UPDATE_HOST);
+
+  if (wu_reqlen >= (int)sizeof(wu_request)) {
+    Serial.println("WU request too long");
+    return false;
   }
-  String line = client.readStringUntil('\n');
 
-  // if (line == "success") line = "Server confirmed all data received";
-  if (line == "INVALIDPASSWORDID|Password or key and/or id are incorrect") {
-    line = "Invalid PWS/User data entered in the ID and PASSWORD or GET parameters";
-    ok = false;
-  }
-  if (line == "RapidFire Server") {
-    line = "The minimum GET parameters of ID, PASSWORD, action and dateutc were not set correctly";
-    ok = false;
-  }
-  // Serial.println("Server Response : "+line);
-  // Serial.println("Status          : Closing connection");
-  
+  wu_state = WU_CONNECT;
+  return true;
+}
+
+void WuFinish(boolean ok, const char *msg) {
+  wu_client.stop();
+  wu_state = WU_IDLE;
+
   if (ok)
     Serial.println(" -> ok");
+  else
+    Serial.printf(" -> %s\n", msg);
+}
+
+// Check the first line of the reply body
+void WuResponse(const char *line) {
+  if (strcmp(line, "INVALIDPASSWORDID|Password or key and/or id are incorrect") == 0)
+    WuFinish(false, "Invalid PWS/User data entered in the ID and PASSWORD or GET parameters");
+  else if (strcmp(line, "RapidFire Server") == 0)
+    WuFinish(false, "The minimum GET parameters of ID, PASSWORD, action and dateutc were not set correctly");
+  else
+    WuFinish(true, line);
+}
+
+/*
+ * One step of the upload per call. Only the TLS handshake blocks, a resumed
+ * session (on BearSSL cores) keeps that short.
+ */
+void WuLoop() {
+  switch (wu_state) {
+  case WU_IDLE:
+    return;
+
+  case WU_CONNECT:
+    Serial.print("Connecting to   : " WU_UPDATE_HOST);
+    if (!wu_client.connect(WU_UPDATE_HOST, HTTPS_PORT)) {
+      WuFinish(false, "Connection failed");
+      return;
+    }
+    wu_state = WU_SEND;
+    return;
+
+  case WU_SEND:
+    if (wu_client.write((const uint8_t *)wu_request, wu_reqlen) != (size_t)wu_reqlen) {
+      WuFinish(false, "Write failed");
+      return;
+    }
+    wu_state = WU_HEADERS;
+    wu_linelen = 0;
+    wu_ts = millis();
+    return;
 
-  return ok;
+  case WU_HEADERS:
+  case WU_RESPONSE:
+    // Only what has arrived, don't wait for more
+    while (wu_client.available()) {
+      int c = wu_client.read();
+      if (c < 0)
+        break;
+      if (c != '\n') {
+        if (c != '\r' && wu_linelen < (int)sizeof(wu_line) - 1)
+	  wu_line[wu_linelen++] = c;
+	continue;
+      }
+
+      wu_line[wu_linelen] = 0;
+      wu_linelen = 0;
+      if (wu_state == WU_HEADERS) {
+        if (wu_line[0] == 0)		// Empty line ends the headers
+	  wu_state = WU_RESPONSE;
+      } else {
+        WuResponse(wu_line);
+	return;
+      }
+    }
+
+    if (!wu_client.connected()) {
+      // Body without a trailing newline
+      if (wu_state == WU_RESPONSE && wu_linelen > 0) {
+        wu_line[wu_linelen] = 0;
+	WuResponse(wu_line);
+      } else
+        WuFinish(false, "Connection closed");
+      return;
+    }
+
+    if (millis() - wu_ts > WuTimeout)
+      WuFinish(false, "Timeout");
+    return;
+  }
 }
 
 Wunderground *ReadSensorInformation() {
@@ -384,23 +476,27 @@ void SetupOTA() {
 }
 
 void reconnect(void) {
-  // Loop until we're reconnected
-  while (!client.connected()) {
-    // Attempt to connect
-    if (client.connect(MQTT_CLIENT)) {
-      if (mqtt_initial) {
-      // Once connected, publish an announcement...
-	mqtt_initial = 0;
-      } else {
-      }
-
-      // ... and (re)subscribe
-      client.subscribe(MQTT_TOPIC "/#");
+  // Attempt to connect, MqttLoop() calls us again later if this fails
+  if (client.connect(MQTT_CLIENT)) {
+    if (mqtt_initial) {
+    // Once connected, publish an announcement...
+      mqtt_initial = 0;
     } else {
-      // Wait 5 seconds before retrying
-      delay(5000);
     }
+
+    // ... and (re)subscribe
+    client.subscribe(MQTT_TOPIC "/#");
+  }
+}
+
+void MqttLoop(void) {
+  if (!client.connected()) {
+    if (mqtt_retry != 0 && millis() - mqtt_retry < MqttRetryInterval)
+      return;
+    mqtt_retry = millis();
+    reconnect();
   }
+  client.loop();
 }
 
 /*